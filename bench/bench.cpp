@@ -0,0 +1,456 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "tgaimage.h"
+#include "tgaio.h"
+#include "pipeline.h"
+#include "cpu.h"
+#include "threadpool.h"
+#include "histogram.h"
+#include "compare.h"
+using namespace std;
+
+// Throughput benchmark for file I/O and every Picture operation. Each case
+// runs on synthetic images of several sizes, from cache-resident to main
+// memory bound, with warmup runs followed by timed repeats.
+
+class ImageSize{
+    public:
+        int width;
+        int height;
+};
+
+// One benchmarked operation at one size. bytes is the pixel data read plus
+// written by a single run, used for GB/s.
+class Result{
+    public:
+        string operation;
+        ImageSize size;
+        size_t pixels;
+        size_t bytes;
+        vector<double> seconds;
+
+        double percentile(double p) const;
+        double nsPerPixel() const;
+        double gigabytesPerSecond() const;
+};
+
+double Result::percentile(double p) const {
+    vector<double> sorted = seconds;
+    sort(sorted.begin(), sorted.end());
+    size_t index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[min(index, sorted.size() - 1)];
+}
+
+double Result::nsPerPixel() const {
+    return percentile(50) * 1e9 / pixels;
+}
+
+double Result::gigabytesPerSecond() const {
+    return bytes / percentile(50) / 1e9;
+}
+
+class Settings{
+    public:
+        vector<ImageSize> sizes;
+        int warmup;
+        int repeat;
+        double minimumSeconds;
+        string csvPath;
+        string jsonPath;
+        string scratchDirectory;
+        string only;
+};
+
+void helpMessage() {
+    cout << "Usage: ./bench.out [options]" << endl;
+    cout << "Options:" << endl;
+    cout << "\t--sizes WxH,...\timage sizes (default 64x64,512x512,2048x2048,8192x8192)" << endl;
+    cout << "\t--large\t\talso run 16384x16384 (268 megapixels, about 2.5 GB)" << endl;
+    cout << "\t--warmup N\tuntimed runs before measuring (default 2)" << endl;
+    cout << "\t--repeat N\tminimum timed runs (default 10)" << endl;
+    cout << "\t--min-time S\tkeep repeating until S seconds have been measured (default 0.2)" << endl;
+    cout << "\t--only NAME\trun only operations whose name contains NAME" << endl;
+    cout << "\t--csv FILE\twrite results as CSV" << endl;
+    cout << "\t--json FILE\twrite results as JSON" << endl;
+    cout << "\t--dir DIR\tscratch directory for readData/writeData (default /tmp)" << endl;
+    cout << "\t--threads N\twork on N threads" << endl;
+    cout << "\t--isa LEVEL\tforce the blend kernels to scalar, sse2, avx2 or avx512" << endl;
+}
+
+bool parseSizes(const string& text, vector<ImageSize>& sizes) {
+    sizes.clear();
+    stringstream list(text);
+    string item;
+    while (getline(list, item, ',')) {
+        ImageSize size;
+        char separator = 0;
+        stringstream parts(item);
+        if (!(parts >> size.width >> separator >> size.height) || separator != 'x' ||
+            size.width < 1 || size.height < 1 || size.width > 32767 || size.height > 32767) {
+            cout << "Invalid argument, --sizes expects WxH pairs up to 32767x32767." << endl;
+            return false;
+        }
+        sizes.push_back(size);
+    }
+    return !sizes.empty();
+}
+
+// Deterministic noise so that no operation can take a shortcut on flat data.
+void fillSynthetic(Picture& image, ImageSize size, unsigned seed) {
+    image.idLength = 0;
+    image.colorMapType = 0;
+    image.dataTypeCode = TGA_TRUECOLOR;
+    image.colorMapOrigin = 0;
+    image.colorMapLength = 0;
+    image.colorMapDepth = 0;
+    image.xOrigin = 0;
+    image.yOrigin = 0;
+    image.width = (short)size.width;
+    image.height = (short)size.height;
+    image.bitsPerPixel = 24;
+    image.imageDescriptor = 0;
+    image.pixels.resize((size_t)size.width * size.height);
+
+    unsigned state = seed * 2654435761u + 1;
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(image.pixels.data());
+    size_t total = image.pixels.size() * sizeof(Pixel);
+    for (size_t i = 0; i < total; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        bytes[i] = (unsigned char)state;
+    }
+}
+
+Result measure(const Settings& settings, const string& name, ImageSize size, int images,
+               const function<void()>& body) {
+    Result result;
+    result.operation = name;
+    result.size = size;
+    result.pixels = (size_t)size.width * size.height;
+    result.bytes = result.pixels * sizeof(Pixel) * images;
+
+    for (int i = 0; i < settings.warmup; i++) {
+        body();
+    }
+    double measured = 0;
+    while ((int)result.seconds.size() < settings.repeat || measured < settings.minimumSeconds) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        body();
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        result.seconds.push_back(elapsed);
+        measured += elapsed;
+    }
+    return result;
+}
+
+// The operation column is nameWidth wide, the longest name measured.
+size_t nameWidth(const vector<Result>& results) {
+    size_t width = 9;
+    for (size_t i = 0; i < results.size(); i++) {
+        width = max(width, results[i].operation.size());
+    }
+    return width;
+}
+
+void printHeader(size_t width) {
+    char line[160];
+    snprintf(line, sizeof(line), "%-*s %11s %9s %8s %10s %10s %10s %6s", (int)width, "operation", "size", "ns/px",
+             "GB/s", "p50(us)", "p90(us)", "p99(us)", "runs");
+    cout << line << endl;
+}
+
+void printResult(const Result& result, size_t width) {
+    char line[256];
+    snprintf(line, sizeof(line), "%-*s %11s %9.3f %8.2f %10.1f %10.1f %10.1f %6zu",
+             (int)width, result.operation.c_str(),
+             (to_string(result.size.width) + "x" + to_string(result.size.height)).c_str(),
+             result.nsPerPixel(), result.gigabytesPerSecond(),
+             result.percentile(50) * 1e6, result.percentile(90) * 1e6, result.percentile(99) * 1e6,
+             result.seconds.size());
+    cout << line << endl;
+}
+
+bool writeCsv(const string& path, const vector<Result>& results) {
+    ofstream file(path);
+    if (!file.is_open()) {
+        cout << "Could not write " << path << endl;
+        return false;
+    }
+    file << "operation,width,height,pixels,runs,ns_per_pixel,gb_per_s,min_us,p50_us,p90_us,p99_us,max_us\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        file << r.operation << ',' << r.size.width << ',' << r.size.height << ',' << r.pixels << ','
+             << r.seconds.size() << ',' << r.nsPerPixel() << ',' << r.gigabytesPerSecond() << ','
+             << r.percentile(0) * 1e6 << ',' << r.percentile(50) * 1e6 << ','
+             << r.percentile(90) * 1e6 << ',' << r.percentile(99) * 1e6 << ','
+             << r.percentile(100) * 1e6 << '\n';
+    }
+    return true;
+}
+
+bool writeJson(const string& path, const vector<Result>& results) {
+    ofstream file(path);
+    if (!file.is_open()) {
+        cout << "Could not write " << path << endl;
+        return false;
+    }
+    file << "{\n  \"isa\": \"" << isaName(activeIsa()) << "\",\n  \"threads\": " << threadCount()
+         << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        file << "    {\"operation\": \"" << r.operation << "\", \"width\": " << r.size.width
+             << ", \"height\": " << r.size.height << ", \"pixels\": " << r.pixels
+             << ", \"runs\": " << r.seconds.size() << ", \"ns_per_pixel\": " << r.nsPerPixel()
+             << ", \"gb_per_s\": " << r.gigabytesPerSecond()
+             << ", \"min_us\": " << r.percentile(0) * 1e6 << ", \"p50_us\": " << r.percentile(50) * 1e6
+             << ", \"p90_us\": " << r.percentile(90) * 1e6 << ", \"p99_us\": " << r.percentile(99) * 1e6
+             << ", \"max_us\": " << r.percentile(100) * 1e6 << "}"
+             << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return true;
+}
+
+bool wanted(const Settings& settings, const string& name) {
+    return settings.only.empty() || name.find(settings.only) != string::npos;
+}
+
+// Runs every case at one size. Images are allocated once per size and
+// reused, so the timings exclude allocation and first-touch page faults.
+void benchmarkSize(const Settings& settings, ImageSize size, vector<Result>& results) {
+    Picture top, bottom, third, outcome, work, turned;
+    fillSynthetic(top, size, 1);
+    fillSynthetic(bottom, size, 2);
+    fillSynthetic(third, size, 3);
+    top.initializeImage(top, outcome);
+    top.initializeImage(top, turned);
+    work.copyFrom(top);
+
+    vector<pair<string, function<void()> > > unary;
+    vector<pair<string, function<void()> > > binary;
+    Picture& a = top;
+    Picture& out = outcome;
+    ImageView b(bottom);
+    ImageView c(third);
+
+    binary.push_back(make_pair(string("multiply"), function<void()>([&] { a.multiply(a, b, out); })));
+    binary.push_back(make_pair(string("subtract"), function<void()>([&] { a.subtract(a, b, out); })));
+    binary.push_back(make_pair(string("overlay"), function<void()>([&] { a.overlay(a, b, out); })));
+    binary.push_back(make_pair(string("screen"), function<void()>([&] { a.screen(a, b, out); })));
+    unary.push_back(make_pair(string("onlyred"), function<void()>([&] { a.onlyred(a, out); })));
+    unary.push_back(make_pair(string("onlygreen"), function<void()>([&] { a.onlygreen(a, out); })));
+    unary.push_back(make_pair(string("onlyblue"), function<void()>([&] { a.onlyblue(a, out); })));
+    unary.push_back(make_pair(string("addred"), function<void()>([&] { a.addred(a, 100, out); })));
+    unary.push_back(make_pair(string("addgreen"), function<void()>([&] { a.addgreen(a, 100, out); })));
+    unary.push_back(make_pair(string("addblue"), function<void()>([&] { a.addblue(a, 100, out); })));
+    unary.push_back(make_pair(string("scalered"), function<void()>([&] { a.scalered(a, 3, out); })));
+    unary.push_back(make_pair(string("scalegreen"), function<void()>([&] { a.scalegreen(a, 3, out); })));
+    unary.push_back(make_pair(string("scaleblue"), function<void()>([&] { a.scaleblue(a, 3, out); })));
+    // memcpy is the reference the geometry methods are measured against.
+    unary.push_back(make_pair(string("memcpy"), function<void()>([&] {
+        memcpy(out.pixels.data(), a.pixels.data(), a.pixels.size() * sizeof(Pixel));
+    })));
+    unary.push_back(make_pair(string("mirrorh"), function<void()>([&] { a.mirrorh(a, out); })));
+    unary.push_back(make_pair(string("mirrorv"), function<void()>([&] { a.mirrorv(a, out); })));
+    unary.push_back(make_pair(string("transpose"), function<void()>([&] { a.transpose(a, turned); })));
+    unary.push_back(make_pair(string("rotate90"), function<void()>([&] { a.rotate90(a, turned); })));
+    unary.push_back(make_pair(string("rotate270"), function<void()>([&] { a.rotate270(a, turned); })));
+    unary.push_back(make_pair(string("boxblur 2"), function<void()>([&] { a.boxblur(a, 2, EDGE_CLAMP, out); })));
+    unary.push_back(make_pair(string("boxblur 20"), function<void()>([&] { a.boxblur(a, 20, EDGE_CLAMP, out); })));
+    unary.push_back(make_pair(string("gaussian 2"), function<void()>([&] { a.gaussian(a, 2, EDGE_CLAMP, out); })));
+    // The same filter on one plane, as --planar keeps a grayscale image.
+    PlanarPicture grayPlanes;
+    if (wanted(settings, "planar gray gaussian 2")) {
+        grayPlanes.fromInterleaved(a);
+        setGrayscale(grayPlanes.header, true);
+        grayPlanes.reduce();
+    }
+    unary.push_back(make_pair(string("planar gray gaussian 2"), function<void()>([&] {
+        grayPlanes.gaussian(2, EDGE_CLAMP);
+    })));
+    unary.push_back(make_pair(string("sharpen 1 1"), function<void()>([&] { a.sharpen(a, 1, 1, EDGE_CLAMP, out); })));
+    int halfWidth = max(size.width / 2, 1);
+    int halfHeight = max(size.height / 2, 1);
+    unary.push_back(make_pair(string("resize half"), function<void()>([&] {
+        a.resize(a, halfWidth, halfHeight, turned);
+    })));
+    unary.push_back(make_pair(string("resize third"), function<void()>([&] {
+        a.resize(a, max(size.width / 3, 1), max(size.height / 3, 1), turned);
+    })));
+    unary.push_back(make_pair(string("stats"), function<void()>([&] { ImageStats stats; imageStats(a, stats); })));
+    unary.push_back(make_pair(string("autolevels"), function<void()>([&] { a.autolevels(a, out); })));
+    unary.push_back(make_pair(string("equalize"), function<void()>([&] { a.equalize(a, out); })));
+
+    string scratch = settings.scratchDirectory + "/project2-bench-" + to_string(getpid()) + ".tga";
+    if (wanted(settings, "writeData")) {
+        // Read and written data both count once: the file holds the pixels.
+        results.push_back(measure(settings, "writeData", size, 1, [&] { a.writeData(scratch, a); }));
+    }
+    if (wanted(settings, "readData")) {
+        a.writeData(scratch, a);
+        results.push_back(measure(settings, "readData", size, 1, [&] { work.readData(scratch, work); }));
+    }
+    // The same pixels stored as 32-bit BGRA and as 8-bit grayscale.
+    if (wanted(settings, "readData bgra")) {
+        Picture stored;
+        stored.copyHeader(a);
+        stored.allocate(LAYOUT_BGRA, a.size());
+        for (size_t i = 0; i < a.size(); i++) {
+            const Pixel& p = a.pixels[i];
+            stored.alphaPixels[i] = AlphaPixel(p.blue, p.green, p.red, (char)255);
+        }
+        stored.writeData(scratch, stored);
+        results.push_back(measure(settings, "readData bgra", size, 1, [&] { work.readData(scratch, work); }));
+    }
+    if (wanted(settings, "readData gray")) {
+        Picture stored;
+        stored.copyFrom(a);
+        setGrayscale(stored, true);
+        stored.writeData(scratch, stored);
+        results.push_back(measure(settings, "readData gray", size, 1, [&] { work.readData(scratch, work); }));
+    }
+    remove(scratch.c_str());
+
+    for (size_t i = 0; i < binary.size(); i++) {
+        if (wanted(settings, binary[i].first)) {
+            results.push_back(measure(settings, binary[i].first, size, 3, binary[i].second));
+        }
+    }
+    if (wanted(settings, "combine")) {
+        results.push_back(measure(settings, "combine", size, 4, [&] { a.combine(a, b, c, out); }));
+    }
+    // Equal images only scan; different ones also count and write the
+    // difference image.
+    if (wanted(settings, "compare")) {
+        Picture copy;
+        copy.copyFrom(a);
+        CompareResult result;
+        results.push_back(measure(settings, "compare", size, 2, [&] { compareImages(a, copy, false, result, 0); }));
+    }
+    if (wanted(settings, "compare diff")) {
+        CompareResult result;
+        results.push_back(measure(settings, "compare diff", size, 3, [&] {
+            compareImages(a, bottom, false, result, &out);
+        }));
+    }
+    if (wanted(settings, "flip")) {
+        // flip works in place: each run reads and writes the image once.
+        results.push_back(measure(settings, "flip", size, 2, [&] { work.flip(work, work); }));
+    }
+    for (size_t i = 0; i < unary.size(); i++) {
+        if (wanted(settings, unary[i].first)) {
+            results.push_back(measure(settings, unary[i].first, size, 2, unary[i].second));
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    parseSizes("64x64,512x512,2048x2048,8192x8192", settings.sizes);
+    settings.warmup = 2;
+    settings.repeat = 10;
+    settings.minimumSeconds = 0.2;
+    settings.scratchDirectory = "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--help") {
+            helpMessage();
+            return 0;
+        }
+        else if (option == "--sizes" && hasValue) {
+            if (!parseSizes(argv[++i], settings.sizes)) {
+                return 1;
+            }
+        }
+        else if (option == "--large") {
+            ImageSize large = {16384, 16384};
+            settings.sizes.push_back(large);
+        }
+        else if ((option == "--warmup" || option == "--repeat") && hasValue) {
+            string count = argv[++i];
+            if (!isInt(count) || stoi(count) < (option == "--repeat" ? 1 : 0)) {
+                cout << "Invalid argument, " << option << " expects a number." << endl;
+                return 1;
+            }
+            (option == "--warmup" ? settings.warmup : settings.repeat) = stoi(count);
+        }
+        else if (option == "--min-time" && hasValue) {
+            string seconds = argv[++i];
+            if (!isNumber(seconds) || stod(seconds) < 0) {
+                cout << "Invalid argument, --min-time expects seconds." << endl;
+                return 1;
+            }
+            settings.minimumSeconds = stod(seconds);
+        }
+        else if (option == "--only" && hasValue) {
+            settings.only = argv[++i];
+        }
+        else if (option == "--csv" && hasValue) {
+            settings.csvPath = argv[++i];
+        }
+        else if (option == "--json" && hasValue) {
+            settings.jsonPath = argv[++i];
+        }
+        else if (option == "--dir" && hasValue) {
+            settings.scratchDirectory = argv[++i];
+        }
+        else if (option == "--threads" && hasValue) {
+            string count = argv[++i];
+            if (!isInt(count) || stoi(count) < 1) {
+                cout << "Invalid argument, --threads expects a positive number." << endl;
+                return 1;
+            }
+            setThreadCount(stoi(count));
+        }
+        else if (option == "--isa" && hasValue) {
+            if (!forceIsa(argv[++i])) {
+                return 1;
+            }
+        }
+        else {
+            cout << "Unknown option " << option << endl;
+            helpMessage();
+            return 1;
+        }
+    }
+
+    cout << "isa " << isaName(activeIsa()) << ", " << threadCount() << " threads, "
+         << settings.warmup << " warmup, at least " << settings.repeat << " runs" << endl;
+
+    // Every size runs the same cases, so the first one fixes the width and
+    // each size's rows are printed once it finishes.
+    vector<Result> results;
+    size_t width = 0;
+    for (size_t i = 0; i < settings.sizes.size(); i++) {
+        size_t first = results.size();
+        benchmarkSize(settings, settings.sizes[i], results);
+        if (i == 0) {
+            width = nameWidth(results);
+            printHeader(width);
+        }
+        for (size_t j = first; j < results.size(); j++) {
+            printResult(results[j], width);
+        }
+    }
+
+    bool ok = true;
+    if (!settings.csvPath.empty()) {
+        ok = writeCsv(settings.csvPath, results) && ok;
+    }
+    if (!settings.jsonPath.empty()) {
+        ok = writeJson(settings.jsonPath, results) && ok;
+    }
+    return ok ? 0 : 1;
+}
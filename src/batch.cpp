@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "tgaio.h"
+#include "threadpool.h"
+#include "bufferpool.h"
+#include "resize.h"
+
+using namespace std;
+
+// Bytes of decoded images in flight. A job that alone exceeds the limit
+// still runs, but only once nothing else holds memory.
+class MemoryBudget{
+    public:
+        MemoryBudget(size_t limit) {
+            this->limit = limit;
+            used = 0;
+        }
+
+        void acquire(size_t bytes) {
+            if (limit == 0) {
+                return;
+            }
+            unique_lock<mutex> guard(lock);
+            released.wait(guard, [&] { return used == 0 || used + bytes <= limit; });
+            used += bytes;
+        }
+
+        void release(size_t bytes) {
+            if (limit == 0) {
+                return;
+            }
+            lock_guard<mutex> guard(lock);
+            used -= bytes;
+            released.notify_all();
+        }
+
+    private:
+        size_t limit;
+        size_t used;
+        mutex lock;
+        condition_variable released;
+};
+
+static bool hasTgaExtension(const string& name) {
+    return name.size() >= 4 && name.substr(name.size() - 4) == ".tga";
+}
+
+static bool readImage(const string& filePath, Picture& image) {
+    return image.readData(filePath, image);
+}
+
+static bool writeImage(const string& filePath, Picture& image) {
+    return image.writeData(filePath, image);
+}
+
+static bool readImage(const string& filePath, PlanarPicture& image) {
+    return image.readData(filePath);
+}
+
+static bool writeImage(const string& filePath, PlanarPicture& image) {
+    return image.writeData(filePath);
+}
+
+static void setImageType(Picture& image, char type) {
+    setRunLength(image, type == TGA_TRUECOLOR_RLE);
+}
+
+static void setImageType(PlanarPicture& image, char type) {
+    setRunLength(image.header, type == TGA_TRUECOLOR_RLE);
+}
+
+static size_t fileSize(const string& filePath) {
+    struct stat info;
+    if (stat(filePath.c_str(), &info) != 0) {
+        return 0;
+    }
+    return info.st_size;
+}
+
+// Bytes an image takes once decoded: its pixels and, for BGRA, the alpha
+// plane. An RLE or grayscale file is much smaller than that. Falls back to
+// the file size when the header cannot be read; readData then reports why.
+static size_t decodedSize(const string& filePath, size_t fileBytes) {
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return fileBytes;
+    }
+    unsigned char buffer[TGA_HEADER_SIZE];
+    bool ok = readFully(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (!ok) {
+        return fileBytes;
+    }
+    Picture header;
+    decodeHeader(buffer, header);
+    size_t count = imagePixelCount(header);
+    return count * sizeof(Pixel) + (filePixelBytes(header) == 4 ? count : 0);
+}
+
+Batch::Batch() {
+    memoryLimit = 0;
+    planar = false;
+    outputType = 0;
+}
+
+// Reads, runs and writes one image in the requested layout; returns the
+// error, or an empty string on success.
+template <class Image>
+static string processImage(const BatchJob& job, Image& image, const Pipeline& pipeline,
+                           OperandStore& operands, char outputType) {
+    if (!readImage(job.input, image)) {
+        return "could not read input";
+    }
+    if (!pipeline.execute(image, operands)) {
+        return "pipeline failed";
+    }
+    if (outputType) {
+        setImageType(image, outputType);
+    }
+    if (!writeImage(job.output, image)) {
+        return "could not write output";
+    }
+    if (!writePyramid(image, pipeline.pyramidLevels(), job.output)) {
+        return "could not write pyramid";
+    }
+    return "";
+}
+
+bool Batch::readManifest(const string& filePath) {
+    ifstream manifest(filePath);
+    if (!manifest.is_open()) {
+        cout << "Manifest " << filePath << " not found." << endl;
+        return false;
+    }
+    string line;
+    size_t number = 0;
+    while (getline(manifest, line)) {
+        number++;
+        istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.input) || job.input[0] == '#') {
+            continue;
+        }
+        string extra;
+        if (!(fields >> job.output) || (fields >> extra)) {
+            cout << "Manifest line " << number << ": expected \"input.tga output.tga\"." << endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+bool Batch::scanDirectory(const string& inputDir, const string& outputDir) {
+    DIR* directory = opendir(inputDir.c_str());
+    if (!directory) {
+        cout << "Directory " << inputDir << " not found." << endl;
+        return false;
+    }
+    vector<string> names;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != 0) {
+        string name = entry->d_name;
+        if (hasTgaExtension(name)) {
+            names.push_back(name);
+        }
+    }
+    closedir(directory);
+
+    sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); i++) {
+        BatchJob job;
+        job.input = inputDir + "/" + names[i];
+        job.output = outputDir + "/" + names[i];
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+size_t Batch::run(const Pipeline& pipeline, OperandStore& operands) const {
+    if (!pipeline.loadOperands(operands, planar)) {
+        return jobs.size();
+    }
+
+    Pipeline quiet = pipeline;
+    quiet.verbose = false;
+
+    MemoryBudget budget(memoryLimit);
+    mutex console;
+    atomic<size_t> failures(0);
+    atomic<size_t> bytesMoved(0);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // One image per chunk: each worker runs a whole pipeline, and the
+    // pipeline's own row-band parallelism runs inline on that worker.
+    defaultPool().parallelFor(jobs.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            const BatchJob& job = jobs[i];
+            string error;
+            // The readers', writers' and stats messages are printed after
+            // the job's line, under the console lock.
+            MessageCapture messages;
+            size_t inputBytes = fileSize(job.input);
+
+            if (!hasTgaExtension(job.input) || !hasTgaExtension(job.output)) {
+                error = "invalid file name";
+            }
+            else if (inputBytes == 0) {
+                error = "file does not exist";
+            }
+            else {
+                size_t decodedBytes = decodedSize(job.input, inputBytes);
+                budget.acquire(decodedBytes);
+                if (planar) {
+                    PlanarPicture image;
+                    error = processImage(job, image, quiet, operands, outputType);
+                }
+                else {
+                    Picture image;
+                    error = processImage(job, image, quiet, operands, outputType);
+                    defaultBufferPool().release(image);
+                }
+                if (error.empty()) {
+                    bytesMoved += inputBytes + fileSize(job.output);
+                }
+                budget.release(decodedBytes);
+            }
+
+            lock_guard<mutex> guard(console);
+            if (error.empty()) {
+                cout << "OK " << job.input << " -> " << job.output << endl;
+            }
+            else {
+                failures++;
+                cout << "FAILED " << job.input << ": " << error << endl;
+            }
+            cout << messages.text;
+        }
+    });
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t done = jobs.size() - failures;
+    cout << "Batch: " << done << " of " << jobs.size() << " images in " << seconds << " s";
+    if (seconds > 0) {
+        cout << ", " << done / seconds << " images/s, "
+             << bytesMoved / seconds / (1024.0 * 1024.0) << " MB/s";
+    }
+    cout << endl;
+    return failures;
+}
@@ -0,0 +1,38 @@
+#ifndef batch_h
+#define batch_h
+
+#include <string>
+#include <vector>
+#include "pipeline.h"
+using namespace std;
+
+class BatchJob{
+    public:
+        string input;
+        string output;
+};
+
+// Runs one pipeline over many images. Operand layers are loaded once and
+// shared; images are spread over the thread pool, with at most
+// memoryLimit bytes of decoded images in flight (0 = one per thread).
+class Batch{
+    public:
+        vector<BatchJob> jobs;
+        size_t memoryLimit;
+        bool planar;
+        // TGA type for the outputs, or 0 to keep each input's type.
+        char outputType;
+
+        Batch();
+
+        // Manifest: one "input.tga output.tga" pair per line; blank lines
+        // and lines starting with '#' are skipped.
+        bool readManifest(const string& filePath);
+        // Every .tga file in inputDir, written under the same name to outputDir.
+        bool scanDirectory(const string& inputDir, const string& outputDir);
+
+        // Returns the number of failed images.
+        size_t run(const Pipeline& pipeline, OperandStore& operands) const;
+};
+
+#endif
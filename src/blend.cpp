@@ -0,0 +1,284 @@
+#include <cstddef>
+#include "blend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLEND_X86 1
+#endif
+
+using namespace std;
+
+// Scalar forms, used for the tail of each vector loop.
+
+static inline unsigned char div255(unsigned int x) {
+    unsigned int t = x + 128;
+    return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+static inline unsigned char multiplyByte(unsigned char a, unsigned char b) {
+    return div255(a * b);
+}
+
+static inline unsigned char subtractByte(unsigned char a, unsigned char b) {
+    return a > b ? a - b : 0;
+}
+
+static inline unsigned char overlayByte(unsigned char a, unsigned char b) {
+    if (b <= 127) {
+        return div255(2 * a * b);
+    }
+    return 255 - div255(2 * (255 - a) * (255 - b));
+}
+
+static inline unsigned char screenByte(unsigned char a, unsigned char b) {
+    return 255 - div255((255 - a) * (255 - b));
+}
+
+static void multiplyScalar(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = multiplyByte(top[i], bot[i]);
+    }
+}
+
+static void subtractScalar(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = subtractByte(top[i], bot[i]);
+    }
+}
+
+static void overlayScalar(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = overlayByte(top[i], bot[i]);
+    }
+}
+
+static void screenScalar(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = screenByte(top[i], bot[i]);
+    }
+}
+
+static const BlendKernels scalarKernels = {multiplyScalar, subtractScalar, overlayScalar, screenScalar};
+
+#ifdef BLEND_X86
+
+// SSE2
+
+static inline __m128i div255x8(__m128i x) {
+    __m128i t = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// Rounded a * b / 255 for 16 bytes, optionally doubling the product.
+static inline __m128i mulDiv255x16(__m128i a, __m128i b, int shift) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    lo = div255x8(_mm_slli_epi16(lo, shift));
+    hi = div255x8(_mm_slli_epi16(hi, shift));
+    return _mm_packus_epi16(lo, hi);
+}
+
+static void multiplySSE2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bot + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), mulDiv255x16(a, b, 0));
+    }
+    for (; i < bytes; i++) {
+        out[i] = multiplyByte(top[i], bot[i]);
+    }
+}
+
+static void subtractSSE2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bot + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_subs_epu8(a, b));
+    }
+    for (; i < bytes; i++) {
+        out[i] = subtractByte(top[i], bot[i]);
+    }
+}
+
+// Overlay: where b > 127 both inputs and the result are inverted, which
+// turns the upper branch into the lower one; the mask does it with XOR.
+static void overlaySSE2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bot + i));
+        __m128i upper = _mm_cmplt_epi8(b, zero);
+        __m128i r = mulDiv255x16(_mm_xor_si128(a, upper), _mm_xor_si128(b, upper), 1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(r, upper));
+    }
+    for (; i < bytes; i++) {
+        out[i] = overlayByte(top[i], bot[i]);
+    }
+}
+
+static void screenSSE2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    __m128i ones = _mm_set1_epi8((char)0xFF);
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i)), ones);
+        __m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bot + i)), ones);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(mulDiv255x16(a, b, 0), ones));
+    }
+    for (; i < bytes; i++) {
+        out[i] = screenByte(top[i], bot[i]);
+    }
+}
+
+// AVX2. Unpack and pack both work within 128-bit lanes, so byte order
+// comes back out unchanged.
+
+__attribute__((target("avx2")))
+static inline __m256i div255x16(__m256i x) {
+    __m256i t = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mulDiv255x32(__m256i a, __m256i b, int shift) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+    __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+    lo = div255x16(_mm256_slli_epi16(lo, shift));
+    hi = div255x16(_mm256_slli_epi16(hi, shift));
+    return _mm256_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void multiplyAVX2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bot + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), mulDiv255x32(a, b, 0));
+    }
+    multiplySSE2(top + i, bot + i, out + i, bytes - i);
+}
+
+__attribute__((target("avx2")))
+static void subtractAVX2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bot + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_subs_epu8(a, b));
+    }
+    subtractSSE2(top + i, bot + i, out + i, bytes - i);
+}
+
+__attribute__((target("avx2")))
+static void overlayAVX2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bot + i));
+        __m256i upper = _mm256_cmpgt_epi8(zero, b);
+        __m256i r = mulDiv255x32(_mm256_xor_si256(a, upper), _mm256_xor_si256(b, upper), 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_xor_si256(r, upper));
+    }
+    overlaySSE2(top + i, bot + i, out + i, bytes - i);
+}
+
+__attribute__((target("avx2")))
+static void screenAVX2(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    __m256i ones = _mm256_set1_epi8((char)0xFF);
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i)), ones);
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bot + i)), ones);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_xor_si256(mulDiv255x32(a, b, 0), ones));
+    }
+    screenSSE2(top + i, bot + i, out + i, bytes - i);
+}
+
+// AVX-512 (BW for the byte/word instructions).
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i div255x32(__m512i x) {
+    __m512i t = _mm512_add_epi16(x, _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i mulDiv255x64(__m512i a, __m512i b, int shift) {
+    __m512i zero = _mm512_setzero_si512();
+    __m512i lo = _mm512_mullo_epi16(_mm512_unpacklo_epi8(a, zero), _mm512_unpacklo_epi8(b, zero));
+    __m512i hi = _mm512_mullo_epi16(_mm512_unpackhi_epi8(a, zero), _mm512_unpackhi_epi8(b, zero));
+    lo = div255x32(_mm512_slli_epi16(lo, shift));
+    hi = div255x32(_mm512_slli_epi16(hi, shift));
+    return _mm512_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void multiplyAVX512(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        __m512i a = _mm512_loadu_si512(top + i);
+        __m512i b = _mm512_loadu_si512(bot + i);
+        _mm512_storeu_si512(out + i, mulDiv255x64(a, b, 0));
+    }
+    multiplyAVX2(top + i, bot + i, out + i, bytes - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void subtractAVX512(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        __m512i a = _mm512_loadu_si512(top + i);
+        __m512i b = _mm512_loadu_si512(bot + i);
+        _mm512_storeu_si512(out + i, _mm512_subs_epu8(a, b));
+    }
+    subtractAVX2(top + i, bot + i, out + i, bytes - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void overlayAVX512(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        __m512i a = _mm512_loadu_si512(top + i);
+        __m512i b = _mm512_loadu_si512(bot + i);
+        __m512i upper = _mm512_movm_epi8(_mm512_movepi8_mask(b));
+        __m512i r = mulDiv255x64(_mm512_xor_si512(a, upper), _mm512_xor_si512(b, upper), 1);
+        _mm512_storeu_si512(out + i, _mm512_xor_si512(r, upper));
+    }
+    overlayAVX2(top + i, bot + i, out + i, bytes - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void screenAVX512(const unsigned char* top, const unsigned char* bot, unsigned char* out, size_t bytes) {
+    size_t i = 0;
+    __m512i ones = _mm512_set1_epi8((char)0xFF);
+    for (; i + 64 <= bytes; i += 64) {
+        __m512i a = _mm512_xor_si512(_mm512_loadu_si512(top + i), ones);
+        __m512i b = _mm512_xor_si512(_mm512_loadu_si512(bot + i), ones);
+        _mm512_storeu_si512(out + i, _mm512_xor_si512(mulDiv255x64(a, b, 0), ones));
+    }
+    screenAVX2(top + i, bot + i, out + i, bytes - i);
+}
+
+static const BlendKernels sse2Kernels = {multiplySSE2, subtractSSE2, overlaySSE2, screenSSE2};
+static const BlendKernels avx2Kernels = {multiplyAVX2, subtractAVX2, overlayAVX2, screenAVX2};
+static const BlendKernels avx512Kernels = {multiplyAVX512, subtractAVX512, overlayAVX512, screenAVX512};
+
+#endif
+
+const BlendKernels* blendKernels(IsaLevel level) {
+#ifdef BLEND_X86
+    switch (level) {
+        case ISA_SSE2: return &sse2Kernels;
+        case ISA_AVX2: return &avx2Kernels;
+        case ISA_AVX512: return &avx512Kernels;
+        default: break;
+    }
+#endif
+    return &scalarKernels;
+}
@@ -0,0 +1,25 @@
+#ifndef blend_h
+#define blend_h
+
+#include <cstddef>
+#include "cpu.h"
+
+// Vectorized blend kernels. Every blend treats the three channels the same
+// way, so they run over the interleaved BGR data as a flat byte array. The
+// integer rounding ((x + 128) + ((x + 128) >> 8)) >> 8 reproduces the
+// float (x / 255 + 0.5f) results of the scalar kernels for every input.
+typedef void (*BlendKernel)(const unsigned char* top, const unsigned char* bot,
+                            unsigned char* out, size_t bytes);
+
+struct BlendKernels {
+    BlendKernel multiply;
+    BlendKernel subtract;
+    BlendKernel overlay;
+    BlendKernel screen;
+};
+
+// Kernels for the given level. The ISA_SCALAR set works byte by byte with
+// the same integer rounding.
+const BlendKernels* blendKernels(IsaLevel level);
+
+#endif
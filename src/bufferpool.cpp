@@ -0,0 +1,90 @@
+#include "bufferpool.h"
+
+using namespace std;
+
+static const size_t DEFAULT_POOL_BYTES = (size_t)256 * 1024 * 1024;
+
+// Room for this many buffers of each layout is reserved up front so that
+// releasing one never allocates.
+static const size_t POOL_SLOTS = 64;
+
+BufferPool::BufferPool() {
+    limit = DEFAULT_POOL_BYTES;
+    bytes = 0;
+    buffers.reserve(POOL_SLOTS);
+    grayBuffers.reserve(POOL_SLOTS);
+    alphaBuffers.reserve(POOL_SLOTS);
+}
+
+template <class T>
+void BufferPool::take(vector<vector<T> >& pooled, vector<T>& buffer, size_t count) {
+    if (buffer.capacity() < count) {
+        lock_guard<mutex> guard(lock);
+        size_t best = pooled.size();
+        for (size_t i = 0; i < pooled.size(); i++) {
+            if (pooled[i].capacity() >= count &&
+                (best == pooled.size() || pooled[i].capacity() < pooled[best].capacity())) {
+                best = i;
+            }
+        }
+        if (best < pooled.size()) {
+            bytes -= pooled[best].capacity() * sizeof(T);
+            buffer.swap(pooled[best]);
+            pooled[best].swap(pooled.back());
+            pooled.pop_back();
+        }
+    }
+    buffer.resize(count);
+}
+
+template <class T>
+void BufferPool::keep(vector<vector<T> >& pooled, vector<T>& buffer) {
+    size_t size = buffer.capacity() * sizeof(T);
+    {
+        lock_guard<mutex> guard(lock);
+        if (size > 0 && bytes + size <= limit && pooled.size() < POOL_SLOTS) {
+            bytes += size;
+            pooled.push_back(vector<T>());
+            pooled.back().swap(buffer);
+            return;
+        }
+    }
+    vector<T>().swap(buffer);
+}
+
+void BufferPool::acquire(vector<Pixel>& buffer, size_t count) {
+    take(buffers, buffer, count);
+}
+
+void BufferPool::acquire(vector<unsigned char>& buffer, size_t count) {
+    take(grayBuffers, buffer, count);
+}
+
+void BufferPool::acquire(vector<AlphaPixel>& buffer, size_t count) {
+    take(alphaBuffers, buffer, count);
+}
+
+void BufferPool::release(vector<Pixel>& buffer) {
+    keep(buffers, buffer);
+}
+
+void BufferPool::release(vector<unsigned char>& buffer) {
+    keep(grayBuffers, buffer);
+}
+
+void BufferPool::release(vector<AlphaPixel>& buffer) {
+    keep(alphaBuffers, buffer);
+}
+
+void BufferPool::release(Picture& image) {
+    release(image.pixels);
+    release(image.grayPixels);
+    release(image.alphaPixels);
+}
+
+BufferPool& defaultBufferPool() {
+    // Never destroyed, so images released during static destruction
+    // still find it.
+    static BufferPool* pool = new BufferPool;
+    return *pool;
+}
@@ -0,0 +1,51 @@
+#ifndef buffer_pool_h
+#define buffer_pool_h
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "tgaimage.h"
+using namespace std;
+
+// Recycled pixel buffers. release() keeps the buffer of an image that is
+// done (up to limit bytes in total) and acquire() hands the smallest one
+// that fits to the next image, so a steady stream of images stops
+// allocating once the pool has warmed up. Each layout has its own buffers.
+class BufferPool{
+    public:
+        size_t limit;
+
+        BufferPool();
+
+        // Resizes buffer to count pixels, taking a pooled buffer first if
+        // its own capacity is too small.
+        void acquire(vector<Pixel>& buffer, size_t count);
+        void acquire(vector<unsigned char>& buffer, size_t count);
+        void acquire(vector<AlphaPixel>& buffer, size_t count);
+        // Moves buffer into the pool (or frees it past limit); it is left empty.
+        void release(vector<Pixel>& buffer);
+        void release(vector<unsigned char>& buffer);
+        void release(vector<AlphaPixel>& buffer);
+        // Releases all three buffers of an image that is done.
+        void release(Picture& image);
+
+    private:
+        vector<vector<Pixel> > buffers;
+        vector<vector<unsigned char> > grayBuffers;
+        vector<vector<AlphaPixel> > alphaBuffers;
+        size_t bytes;
+        mutex lock;
+
+        template <class T>
+        void take(vector<vector<T> >& pooled, vector<T>& buffer, size_t count);
+        template <class T>
+        void keep(vector<vector<T> >& pooled, vector<T>& buffer);
+
+        BufferPool(const BufferPool&);
+        BufferPool& operator=(const BufferPool&);
+};
+
+// Process-wide pool behind Picture::readData and Picture::allocate.
+BufferPool& defaultBufferPool();
+
+#endif
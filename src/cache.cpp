@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "tgaio.h"
+#include "profile.h"
+
+using namespace std;
+
+// Entry file: EntryHeader, the key, then the pixels from ENTRY_DATA_OFFSET
+// (page aligned). Interleaved entries hold count BGR pixels; planar ones
+// hold three planes planeStride bytes apart. Entries are only meant for
+// the machine that wrote them, so fields are stored in native order.
+static const char ENTRY_MAGIC[8] = {'P', '2', 'D', 'C', 'A', 'C', 'H', '1'};
+static const size_t ENTRY_DATA_OFFSET = 4096;
+static const char* ENTRY_SUFFIX = ".p2c";
+
+// Temporary files older than this were left by a writer that died.
+static const time_t STALE_TEMPORARY_SECONDS = 600;
+
+struct EntryHeader {
+    char magic[8];
+    unsigned int planar;
+    unsigned int keyLength;
+    unsigned long long count;
+    unsigned long long planeStride;
+    unsigned char tga[TGA_HEADER_SIZE];
+};
+
+static size_t planeStrideFor(size_t count) {
+    return (count + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+}
+
+static bool hasSuffix(const string& name, const string& suffix) {
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// CachedImage
+
+CachedImage::CachedImage() {
+    base = 0;
+    length = 0;
+    count = 0;
+    planeStride = 0;
+}
+
+CachedImage::~CachedImage() {
+    close();
+}
+
+bool CachedImage::open(const string& entryPath, const string& key, bool planar) {
+    close();
+
+    int fd = ::open(entryPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < ENTRY_DATA_OFFSET) {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // A hit makes the entry the most recently used one.
+    futimens(fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const EntryHeader* entry = static_cast<const EntryHeader*>(mapping);
+    const char* storedKey = static_cast<const char*>(mapping) + sizeof(EntryHeader);
+    size_t dataBytes = planar ? 3 * entry->planeStride : entry->count * sizeof(Pixel);
+    bool valid = memcmp(entry->magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) == 0 &&
+                 entry->planar == (planar ? 1u : 0u) &&
+                 entry->keyLength == key.size() &&
+                 sizeof(EntryHeader) + key.size() <= ENTRY_DATA_OFFSET &&
+                 memcmp(storedKey, key.data(), key.size()) == 0 &&
+                 ENTRY_DATA_OFFSET + dataBytes <= (size_t)info.st_size;
+    if (valid) {
+        decodeHeader(entry->tga, header);
+        valid = imagePixelCount(header) == entry->count;
+    }
+    if (!valid) {
+        munmap(mapping, info.st_size);
+        return false;
+    }
+
+    base = mapping;
+    length = info.st_size;
+    count = entry->count;
+    planeStride = entry->planeStride;
+    PROFILE_COUNT(PROFILE_BYTES_READ, ENTRY_DATA_OFFSET + dataBytes);
+    return true;
+}
+
+void CachedImage::close() {
+    if (base) {
+        munmap(base, length);
+    }
+    base = 0;
+    length = 0;
+    count = 0;
+    planeStride = 0;
+}
+
+bool CachedImage::isOpen() const {
+    return base != 0;
+}
+
+ImageView CachedImage::view() const {
+    const char* data = static_cast<const char*>(base) + ENTRY_DATA_OFFSET;
+    return ImageView(header.width, header.height, reinterpret_cast<const Pixel*>(data), count);
+}
+
+const unsigned char* CachedImage::plane(int channel) const {
+    return static_cast<const unsigned char*>(base) + ENTRY_DATA_OFFSET + channel * planeStride;
+}
+
+// DecodedCache
+
+DecodedCache::DecodedCache() {
+    limit = (size_t)1024 * 1024 * 1024;
+}
+
+bool DecodedCache::enabled() const {
+    return !directory.empty();
+}
+
+bool fileIdentity(const string& filePath, string& identity) {
+    struct stat info;
+    if (stat(filePath.c_str(), &info) != 0) {
+        return false;
+    }
+    identity = filePath + " " + to_string((long long)info.st_size) + " " +
+               to_string((long long)info.st_mtim.tv_sec) + "." + to_string((long long)info.st_mtim.tv_nsec) + " " +
+               to_string((unsigned long long)info.st_dev) + ":" + to_string((unsigned long long)info.st_ino);
+    return true;
+}
+
+// The key identifies one version of one source file in one layout.
+bool DecodedCache::sourceKey(const string& sourcePath, bool planar, string& key) const {
+    if (!enabled() || !fileIdentity(sourcePath, key)) {
+        return false;
+    }
+    key += planar ? " planar" : " interleaved";
+    return true;
+}
+
+// Entry files are named by the 64-bit FNV-1a hash of their key and store
+// the key itself to rule out collisions.
+string DecodedCache::entryPath(const string& key) const {
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < key.size(); i++) {
+        hash = (hash ^ (unsigned char)key[i]) * 1099511628211ull;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", hash);
+    return directory + "/" + name + ENTRY_SUFFIX;
+}
+
+bool DecodedCache::find(const string& sourcePath, bool planar, CachedImage& image) const {
+    PROFILE_SCOPE("cache", sourcePath);
+    string key;
+    return sourceKey(sourcePath, planar, key) && image.open(entryPath(key), key, planar);
+}
+
+void DecodedCache::store(const string& sourcePath, const Picture& image) const {
+    string key;
+    if (image.layout() != LAYOUT_BGRA && sourceKey(sourcePath, false, key)) {
+        writeImage(key, image);
+    }
+}
+
+void DecodedCache::store(const string& sourcePath, const PlanarPicture& image) const {
+    const unsigned char* const planes[3] = {
+        image.channel(0), image.channel(1), image.channel(2)
+    };
+    string key;
+    if (!image.hasAlpha() && sourceKey(sourcePath, true, key)) {
+        write(key, true, image.header, planes, 0, image.size());
+    }
+}
+
+bool DecodedCache::findKey(const string& key, CachedImage& image) const {
+    return enabled() && image.open(entryPath(key), key, false);
+}
+
+void DecodedCache::storeKey(const string& key, const Picture& image) const {
+    if (enabled() && image.layout() != LAYOUT_BGRA) {
+        writeImage(key, image);
+    }
+}
+
+// Interleaved entries hold BGR pixels, so a gray image is expanded first.
+void DecodedCache::writeImage(const string& key, const Picture& image) const {
+    if (image.layout() == LAYOUT_BGR) {
+        write(key, false, image, 0, image.pixels.data(), image.pixels.size());
+        return;
+    }
+    vector<Pixel> expanded(image.grayPixels.size());
+    unpackPixels(image.grayPixels.data(), 1, expanded.data(), 0, expanded.size());
+    write(key, false, image, 0, expanded.data(), expanded.size());
+}
+
+void DecodedCache::write(const string& key, bool planar, const Picture& header,
+                         const unsigned char* const planes[3], const Pixel* pixels, size_t count) const {
+    PROFILE_SCOPE("store", key.substr(0, key.find(' ')));
+    if (sizeof(EntryHeader) + key.size() > ENTRY_DATA_OFFSET) {
+        return;
+    }
+    string entryPath = this->entryPath(key);
+    mkdir(directory.c_str(), 0755);
+
+    // Unique per process and call, so concurrent writers never share a file.
+    static atomic<unsigned> sequence(0);
+    string temporary = entryPath + ".tmp." + to_string((long long)getpid()) + "." + to_string(sequence++);
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return;
+    }
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+
+    vector<unsigned char> prefix(ENTRY_DATA_OFFSET, 0);
+    EntryHeader entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    entry.planar = planar ? 1 : 0;
+    entry.keyLength = (unsigned int)key.size();
+    entry.count = count;
+    entry.planeStride = planar ? planeStrideFor(count) : 0;
+    encodeHeader(header, entry.tga);
+    memcpy(prefix.data(), &entry, sizeof(entry));
+    memcpy(prefix.data() + sizeof(entry), key.data(), key.size());
+
+    bool ok = writeFully(fd, prefix.data(), prefix.size());
+    if (planar) {
+        vector<unsigned char> padding(entry.planeStride - count, 0);
+        for (int c = 0; ok && c < 3; c++) {
+            ok = writeFully(fd, planes[c], count) && writeFully(fd, padding.data(), padding.size());
+        }
+    }
+    else {
+        ok = ok && writeFully(fd, pixels, count * sizeof(Pixel));
+    }
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), entryPath.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return;
+    }
+    evict();
+}
+
+// Removes least recently used entries (oldest modification time, which
+// every hit refreshes) until the directory fits in limit.
+void DecodedCache::evict() const {
+    string lockPath = directory + "/.lock";
+    int lockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (lockFd < 0) {
+        return;
+    }
+    flock(lockFd, LOCK_EX);
+
+    DIR* listing = opendir(directory.c_str());
+    if (listing) {
+        vector<pair<struct timespec, pair<size_t, string> > > entries;
+        size_t total = 0;
+        time_t now = time(0);
+        while (struct dirent* item = readdir(listing)) {
+            string name = item->d_name;
+            string path = directory + "/" + name;
+            struct stat info;
+            if (name[0] == '.' || stat(path.c_str(), &info) != 0) {
+                continue;
+            }
+            if (hasSuffix(name, ENTRY_SUFFIX)) {
+                entries.push_back(make_pair(info.st_mtim, make_pair((size_t)info.st_size, path)));
+                total += info.st_size;
+            }
+            else if (name.find(ENTRY_SUFFIX + string(".tmp.")) != string::npos &&
+                     now - info.st_mtim.tv_sec > STALE_TEMPORARY_SECONDS) {
+                unlink(path.c_str());
+            }
+        }
+        closedir(listing);
+
+        sort(entries.begin(), entries.end(), [](const pair<struct timespec, pair<size_t, string> >& a,
+                                                const pair<struct timespec, pair<size_t, string> >& b) {
+            return a.first.tv_sec != b.first.tv_sec ? a.first.tv_sec < b.first.tv_sec
+                                                    : a.first.tv_nsec < b.first.tv_nsec;
+        });
+        for (size_t i = 0; i < entries.size() && total > limit; i++) {
+            if (unlink(entries[i].second.second.c_str()) == 0) {
+                total -= entries[i].second.first;
+            }
+        }
+    }
+
+    flock(lockFd, LOCK_UN);
+    ::close(lockFd);
+}
@@ -0,0 +1,76 @@
+#ifndef cache_h
+#define cache_h
+
+#include <cstddef>
+#include <string>
+#include "tgaimage.h"
+#include "planar.h"
+using namespace std;
+
+// Read-only mapping of one cache entry: the decoded pixels of a source
+// file, interleaved or as three planes, ready to use without parsing.
+class CachedImage{
+    public:
+        Picture header;
+
+        CachedImage();
+        ~CachedImage();
+
+        // Maps entryPath if it is a complete entry for key in the given layout.
+        bool open(const string& entryPath, const string& key, bool planar);
+        void close();
+        bool isOpen() const;
+
+        ImageView view() const;
+        const unsigned char* plane(int channel) const;
+
+    private:
+        void* base;
+        size_t length;
+        size_t count;
+        size_t planeStride;
+
+        CachedImage(const CachedImage&);
+        CachedImage& operator=(const CachedImage&);
+};
+
+// Persistent cache of decoded operand images in directory, shared by every
+// process that points at it. Entries are keyed by source path, size,
+// modification time and inode, so an edited file is simply a miss.
+// Entries are written to a temporary file and renamed into place, so
+// readers never see a partial one. Once the directory holds more than
+// limit bytes the least recently used entries are removed, under an
+// exclusive flock on the directory's lock file. Readers keep their
+// mappings valid even if the entry is removed meanwhile. Entries hold no
+// alpha, so BGRA images are never stored; gray ones are stored expanded.
+class DecodedCache{
+    public:
+        string directory;
+        size_t limit;
+
+        DecodedCache();
+
+        bool enabled() const;
+        bool find(const string& sourcePath, bool planar, CachedImage& image) const;
+        void store(const string& sourcePath, const Picture& image) const;
+        void store(const string& sourcePath, const PlanarPicture& image) const;
+
+        // Interleaved images under a caller-built key instead of a source
+        // file, e.g. intermediate pipeline states.
+        bool findKey(const string& key, CachedImage& image) const;
+        void storeKey(const string& key, const Picture& image) const;
+
+    private:
+        bool sourceKey(const string& sourcePath, bool planar, string& key) const;
+        string entryPath(const string& key) const;
+        void writeImage(const string& key, const Picture& image) const;
+        void write(const string& key, bool planar, const Picture& header,
+                   const unsigned char* const planes[3], const Pixel* pixels, size_t count) const;
+        void evict() const;
+};
+
+// Identity of a file's current contents: path, size, mtime and inode.
+// Returns false if the file cannot be examined.
+bool fileIdentity(const string& filePath, string& identity);
+
+#endif
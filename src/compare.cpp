@@ -0,0 +1,603 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+#include "compare.h"
+#include "batch.h"
+#include "tgaio.h"
+#include "threadpool.h"
+#include "bufferpool.h"
+#include "cpu.h"
+
+using namespace std;
+
+// Pixels a chunk of rows covers at least, so narrow images still hand the
+// pool few large chunks.
+static const size_t COMPARE_MIN_CHUNK = 1 << 16;
+
+// Finds the first and last byte where a and b differ; false when the n
+// bytes are equal. Equal rows, the common case for golden outputs, cost
+// one vector compare per 16 or 32 bytes.
+typedef bool (*DifferenceKernel)(const unsigned char* a, const unsigned char* b, size_t n, size_t& first,
+                                 size_t& last);
+
+// The scalar scan of bytes [begin, end), left by the vector loops.
+static bool differenceScalar(const unsigned char* a, const unsigned char* b, size_t begin, size_t end,
+                             size_t& first, size_t& last) {
+    size_t j = begin;
+    while (j < end && a[j] == b[j]) {
+        j++;
+    }
+    if (j == end) {
+        return false;
+    }
+    first = j;
+    j = end;
+    while (a[j - 1] == b[j - 1]) {
+        j--;
+    }
+    last = j - 1;
+    return true;
+}
+
+static bool differenceSSE2(const unsigned char* a, const unsigned char* b, size_t n, size_t& first,
+                           size_t& last) {
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + j));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        unsigned equal = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xFFFF) {
+            break;
+        }
+    }
+    if (j + 16 > n) {
+        return differenceScalar(a, b, j, n, first, last);
+    }
+    size_t k = n;
+    for (; k >= j + 16; k -= 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k - 16));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k - 16));
+        unsigned equal = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xFFFF) {
+            break;
+        }
+    }
+    return differenceScalar(a, b, j, k, first, last);
+}
+
+__attribute__((target("avx2")))
+static bool differenceAVX2(const unsigned char* a, const unsigned char* b, size_t n, size_t& first,
+                           size_t& last) {
+    size_t j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + j));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xFFFFFFFFu) {
+            break;
+        }
+    }
+    if (j + 32 > n) {
+        if (!differenceSSE2(a + j, b + j, n - j, first, last)) {
+            return false;
+        }
+        first += j;
+        last += j;
+        return true;
+    }
+    size_t k = n;
+    for (; k >= j + 32; k -= 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k - 32));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k - 32));
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xFFFFFFFFu) {
+            break;
+        }
+    }
+    return differenceScalar(a, b, j, k, first, last);
+}
+
+static DifferenceKernel differenceKernel() {
+    return activeIsa() >= ISA_AVX2 ? differenceAVX2 : differenceSSE2;
+}
+
+CompareResult::CompareResult() {
+    pixels = 0;
+    mismatched = 0;
+    memset(maxDifference, 0, sizeof(maxDifference));
+    squaredError = 0;
+    left = top = right = bottom = 0;
+    alpha = false;
+    strict = false;
+}
+
+bool CompareResult::identical() const {
+    return mismatched == 0;
+}
+
+double CompareResult::psnr() const {
+    size_t samples = pixels * (alpha ? 4 : 3);
+    if (squaredError == 0 || samples == 0) {
+        return INFINITY;
+    }
+    double meanError = (double)squaredError / samples;
+    return 10.0 * log10(255.0 * 255.0 / meanError);
+}
+
+void CompareResult::merge(const CompareResult& other) {
+    if (other.mismatched) {
+        if (mismatched == 0) {
+            left = other.left;
+            top = other.top;
+            right = other.right;
+            bottom = other.bottom;
+        }
+        else {
+            left = min(left, other.left);
+            top = min(top, other.top);
+            right = max(right, other.right);
+            bottom = max(bottom, other.bottom);
+        }
+    }
+    mismatched += other.mismatched;
+    for (int c = 0; c < 4; c++) {
+        maxDifference[c] = max(maxDifference[c], other.maxDifference[c]);
+    }
+    squaredError += other.squaredError;
+}
+
+string CompareResult::summary() const {
+    if (identical()) {
+        return "identical";
+    }
+    char line[256];
+    int length;
+    if (strict) {
+        length = snprintf(line, sizeof(line), "first difference at x %zu, y %zu, blue %d green %d red %d",
+                          left, top, maxDifference[0], maxDifference[1], maxDifference[2]);
+    }
+    else {
+        length = snprintf(line, sizeof(line),
+                          "%zu of %zu pixels differ, max difference blue %d green %d red %d",
+                          mismatched, pixels, maxDifference[0], maxDifference[1], maxDifference[2]);
+    }
+    string out(line, length);
+    if (alpha) {
+        out += ", alpha " + to_string(maxDifference[3]);
+    }
+    if (!strict) {
+        snprintf(line, sizeof(line), ", PSNR %.2f dB, box x %zu..%zu y %zu..%zu", psnr(), left, right, top,
+                 bottom);
+        out += line;
+    }
+    return out;
+}
+
+static inline int absDifference(unsigned char a, unsigned char b) {
+    return a > b ? a - b : b - a;
+}
+
+// Accumulates pixels [begin, end] of one row; the alpha rows are null when
+// neither image has alpha, and diff may be null. Each combination has its
+// own branch free loop.
+template <bool Alpha, bool Diff>
+static void accumulateSpan(const unsigned char* a, const unsigned char* b, const unsigned char* alphaA,
+                           const unsigned char* alphaB, size_t begin, size_t end, unsigned char* diff,
+                           CompareResult& result) {
+    int max0 = result.maxDifference[0];
+    int max1 = result.maxDifference[1];
+    int max2 = result.maxDifference[2];
+    int max3 = result.maxDifference[3];
+    unsigned long long squared = 0;
+    size_t mismatched = 0;
+    for (size_t x = begin; x <= end; x++) {
+        int d0 = absDifference(a[x * 3], b[x * 3]);
+        int d1 = absDifference(a[x * 3 + 1], b[x * 3 + 1]);
+        int d2 = absDifference(a[x * 3 + 2], b[x * 3 + 2]);
+        int d3 = Alpha ? absDifference(alphaA[x], alphaB[x]) : 0;
+        max0 = max(max0, d0);
+        max1 = max(max1, d1);
+        max2 = max(max2, d2);
+        max3 = max(max3, d3);
+        squared += (unsigned)(d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3);
+        mismatched += (d0 | d1 | d2 | d3) != 0;
+        if (Diff) {
+            diff[x * 3] = (unsigned char)d0;
+            diff[x * 3 + 1] = (unsigned char)d1;
+            diff[x * 3 + 2] = (unsigned char)d2;
+        }
+    }
+    result.maxDifference[0] = max0;
+    result.maxDifference[1] = max1;
+    result.maxDifference[2] = max2;
+    result.maxDifference[3] = max3;
+    result.squaredError += squared;
+    result.mismatched += mismatched;
+}
+
+// Byte shuffles taking channel c of 16 pixels (48 bytes in three vectors)
+// out of vector v: entry [c][v] picks the bytes v holds, zero elsewhere.
+struct ChannelMasks {
+    unsigned char masks[3][3][16];
+
+    ChannelMasks() {
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < 3; v++) {
+                for (int p = 0; p < 16; p++) {
+                    int byte = p * 3 + c;
+                    masks[c][v][p] = byte / 16 == v ? (unsigned char)(byte % 16) : 0x80;
+                }
+            }
+        }
+    }
+};
+
+__attribute__((target("avx2")))
+static inline __m128i absDifferenceBytes(__m128i x, __m128i y) {
+    return _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+}
+
+// Sums of squares of 16 bytes as four 32-bit lanes.
+__attribute__((target("avx2")))
+static inline __m128i squareBytes(__m128i d) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_unpacklo_epi8(d, zero);
+    __m128i high = _mm_unpackhi_epi8(d, zero);
+    return _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high));
+}
+
+__attribute__((target("avx2")))
+static unsigned long long sumLanes(__m128i lanes) {
+    uint32_t values[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values), lanes);
+    return (unsigned long long)values[0] + values[1] + values[2] + values[3];
+}
+
+// accumulateSpan for the bulk of the span, 16 pixels at a time: the
+// differences are split into one vector per channel, where the maxima,
+// squares and the per-pixel "any channel differs" test are plain vector
+// operations. Returns how many pixels it took.
+__attribute__((target("avx2")))
+static size_t accumulateAVX2(const unsigned char* a, const unsigned char* b, const unsigned char* alphaA,
+                             const unsigned char* alphaB, size_t begin, size_t end, unsigned char* diff,
+                             CompareResult& result) {
+    static const ChannelMasks split;
+    __m128i masks[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 3; v++) {
+            masks[c][v] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(split.masks[c][v]));
+        }
+    }
+    __m128i maxima[4];
+    for (int c = 0; c < 4; c++) {
+        maxima[c] = _mm_setzero_si128();
+    }
+    __m128i zero = _mm_setzero_si128();
+    __m128i squares = zero;
+    unsigned long long squared = 0;
+    size_t mismatched = 0;
+    size_t count = (end + 1 - begin) / 16 * 16;
+    for (size_t i = 0; i < count; i += 16) {
+        size_t x = begin + i;
+        __m128i d[3];
+        for (int v = 0; v < 3; v++) {
+            __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x * 3 + v * 16));
+            __m128i y0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x * 3 + v * 16));
+            d[v] = absDifferenceBytes(x0, y0);
+            if (diff) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(diff + x * 3 + v * 16), d[v]);
+            }
+        }
+        __m128i any = zero;
+        for (int c = 0; c < 3; c++) {
+            __m128i channel = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(d[0], masks[c][0]),
+                                                        _mm_shuffle_epi8(d[1], masks[c][1])),
+                                           _mm_shuffle_epi8(d[2], masks[c][2]));
+            maxima[c] = _mm_max_epu8(maxima[c], channel);
+            squares = _mm_add_epi32(squares, squareBytes(channel));
+            any = _mm_or_si128(any, channel);
+        }
+        if (alphaA) {
+            __m128i channel = absDifferenceBytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(alphaA + x)),
+                                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(alphaB + x)));
+            maxima[3] = _mm_max_epu8(maxima[3], channel);
+            squares = _mm_add_epi32(squares, squareBytes(channel));
+            any = _mm_or_si128(any, channel);
+        }
+        mismatched += 16 - __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)));
+        // A lane gains at most 4 * 2 * 255^2 per step; flushed well before
+        // 32 bits overflow.
+        if ((i / 16) % 1024 == 1023) {
+            squared += sumLanes(squares);
+            squares = zero;
+        }
+    }
+    squared += sumLanes(squares);
+    for (int c = 0; c < 4; c++) {
+        unsigned char bytes[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), maxima[c]);
+        result.maxDifference[c] = max<int>(result.maxDifference[c], *max_element(bytes, bytes + 16));
+    }
+    result.squaredError += squared;
+    result.mismatched += mismatched;
+    return count;
+}
+
+static void accumulateRow(const unsigned char* a, const unsigned char* b, const unsigned char* alphaA,
+                          const unsigned char* alphaB, size_t begin, size_t end, unsigned char* diff,
+                          CompareResult& result) {
+    if (activeIsa() >= ISA_AVX2) {
+        begin += accumulateAVX2(a, b, alphaA, alphaB, begin, end, diff, result);
+        if (begin > end) {
+            return;
+        }
+    }
+    if (alphaA) {
+        if (diff) {
+            accumulateSpan<true, true>(a, b, alphaA, alphaB, begin, end, diff, result);
+        }
+        else {
+            accumulateSpan<true, false>(a, b, alphaA, alphaB, begin, end, diff, result);
+        }
+    }
+    else if (diff) {
+        accumulateSpan<false, true>(a, b, alphaA, alphaB, begin, end, diff, result);
+    }
+    else {
+        accumulateSpan<false, false>(a, b, alphaA, alphaB, begin, end, diff, result);
+    }
+}
+
+// An image's pixels as the comparison reads them: BGR bytes and, for a
+// BGRA image, an alpha plane. Other layouts than BGR are converted.
+struct ComparedPixels {
+    const unsigned char* bytes;
+    const unsigned char* alpha;
+    vector<Pixel> converted;
+    vector<unsigned char> alphaPlane;
+};
+
+static void comparedPixels(const Picture& image, ComparedPixels& pixels) {
+    pixels.alpha = 0;
+    if (image.layout() == LAYOUT_BGR) {
+        pixels.bytes = reinterpret_cast<const unsigned char*>(image.pixels.data());
+        return;
+    }
+    pixels.converted.resize(image.size());
+    if (image.layout() == LAYOUT_GRAY) {
+        unpackPixels(image.grayPixels.data(), 1, pixels.converted.data(), 0, image.size());
+    }
+    else {
+        pixels.alphaPlane.resize(image.size());
+        unpackPixels(reinterpret_cast<const unsigned char*>(image.alphaPixels.data()), sizeof(AlphaPixel),
+                     pixels.converted.data(), pixels.alphaPlane.data(), image.size());
+        pixels.alpha = pixels.alphaPlane.data();
+    }
+    pixels.bytes = reinterpret_cast<const unsigned char*>(pixels.converted.data());
+}
+
+void compareImages(const Picture& expected, const Picture& actual, bool strict, CompareResult& result,
+                   Picture* diff) {
+    ComparedPixels pixelsA;
+    ComparedPixels pixelsB;
+    comparedPixels(expected, pixelsA);
+    comparedPixels(actual, pixelsB);
+    result = CompareResult();
+    result.strict = strict;
+    result.pixels = expected.size();
+    result.alpha = pixelsA.alpha || pixelsB.alpha;
+    size_t width = (unsigned short)expected.width;
+    size_t height = result.pixels / max<size_t>(width, 1);
+    const unsigned char* bytesA = pixelsA.bytes;
+    const unsigned char* bytesB = pixelsB.bytes;
+    unsigned char* diffBytes = diff ? reinterpret_cast<unsigned char*>(diff->pixels.data()) : 0;
+    // A missing alpha plane compares as an opaque row.
+    vector<unsigned char> opaque(result.alpha ? width : 0, 255);
+    DifferenceKernel difference = differenceKernel();
+
+    mutex lock;
+    // Strict mode: rows from the first mismatch found so far on are skipped,
+    // and the earliest mismatch of any chunk wins.
+    atomic<size_t> firstRow(height);
+    size_t grain = max<size_t>(1, COMPARE_MIN_CHUNK / max<size_t>(width, 1));
+    defaultPool().parallelFor(height, grain, [&](size_t begin, size_t end) {
+        CompareResult local;
+        for (size_t y = begin; y < end; y++) {
+            if (strict && y >= firstRow.load()) {
+                break;
+            }
+            const unsigned char* a = bytesA + y * width * 3;
+            const unsigned char* b = bytesB + y * width * 3;
+            unsigned char* diffRow = diffBytes ? diffBytes + y * width * 3 : 0;
+            const unsigned char* alphaA = 0;
+            const unsigned char* alphaB = 0;
+            if (result.alpha) {
+                alphaA = pixelsA.alpha ? pixelsA.alpha + y * width : opaque.data();
+                alphaB = pixelsB.alpha ? pixelsB.alpha + y * width : opaque.data();
+            }
+            if (diffRow) {
+                memset(diffRow, 0, width * 3);
+            }
+            size_t first = width;
+            size_t last = 0;
+            size_t firstByte;
+            size_t lastByte;
+            if (difference(a, b, width * 3, firstByte, lastByte)) {
+                first = firstByte / 3;
+                last = lastByte / 3;
+            }
+            if (alphaA && difference(alphaA, alphaB, width, firstByte, lastByte)) {
+                first = min(first, firstByte);
+                last = max(last, lastByte);
+            }
+            if (first == width) {
+                continue;
+            }
+            if (strict) {
+                accumulateRow(a, b, alphaA, alphaB, first, first, 0, local);
+                local.left = local.right = first;
+                local.top = local.bottom = y;
+                size_t found = firstRow.load();
+                while (y < found && !firstRow.compare_exchange_weak(found, y)) {
+                }
+                break;
+            }
+            if (local.mismatched == 0) {
+                local.left = first;
+                local.right = last;
+                local.top = y;
+            }
+            local.left = min(local.left, first);
+            local.right = max(local.right, last);
+            local.bottom = y;
+            accumulateRow(a, b, alphaA, alphaB, first, last, diffRow, local);
+        }
+        if (local.mismatched == 0) {
+            return;
+        }
+        lock_guard<mutex> guard(lock);
+        if (!strict) {
+            result.merge(local);
+        }
+        else if (result.mismatched == 0 || local.top < result.top) {
+            local.strict = true;
+            local.pixels = result.pixels;
+            local.alpha = result.alpha;
+            result = local;
+        }
+    });
+}
+
+static size_t fileSize(const string& filePath) {
+    struct stat info;
+    if (stat(filePath.c_str(), &info) != 0) {
+        return 0;
+    }
+    return info.st_size;
+}
+
+Comparison::Comparison() {
+    strict = false;
+}
+
+bool Comparison::comparePair(const string& expectedPath, const string& actualPath, const string& diffFile,
+                             string& line) const {
+    if (fileSize(expectedPath) == 0 || fileSize(actualPath) == 0) {
+        line = "missing file";
+        return false;
+    }
+    // The two files are read at the same time. The reader's messages are
+    // passed on after the join, to whoever collects this thread's.
+    Picture expected;
+    Picture actual;
+    bool actualRead = false;
+    string readerMessages;
+    thread reader([&] {
+        MessageCapture messages;
+        actualRead = actual.readData(actualPath, actual);
+        readerMessages = messages.text;
+    });
+    bool expectedRead = expected.readData(expectedPath, expected);
+    reader.join();
+    if (!readerMessages.empty()) {
+        reportMessage(readerMessages.substr(0, readerMessages.size() - 1));
+    }
+
+    bool match = false;
+    if (!expectedRead || !actualRead) {
+        line = "could not read " + (expectedRead ? actualPath : expectedPath);
+    }
+    else if (expected.width != actual.width || expected.height != actual.height) {
+        line = "size differs, " + to_string((unsigned short)expected.width) + "x" +
+               to_string((unsigned short)expected.height) + " and " + to_string((unsigned short)actual.width) +
+               "x" + to_string((unsigned short)actual.height);
+    }
+    else {
+        bool writeDiff = !diffFile.empty() && !strict;
+        Picture diff;
+        if (writeDiff) {
+            diff.copyHeader(expected);
+            diff.allocate(LAYOUT_BGR, imagePixelCount(expected));
+            setGrayscale(diff, false);
+            setRunLength(diff, false);
+        }
+        CompareResult result;
+        compareImages(expected, actual, strict, result, writeDiff ? &diff : 0);
+        match = result.identical();
+        line = result.summary();
+        if (!match && writeDiff && !diff.writeData(diffFile, diff)) {
+            line += ", could not write " + diffFile;
+        }
+        defaultBufferPool().release(diff);
+    }
+    defaultBufferPool().release(expected);
+    defaultBufferPool().release(actual);
+    return match;
+}
+
+bool Comparison::compareFiles(const string& expectedPath, const string& actualPath) const {
+    string line;
+    bool match = comparePair(expectedPath, actualPath, diffPath, line);
+    cout << (match ? "OK " : "DIFFERENT ") << expectedPath << " " << actualPath << ": " << line << endl;
+    return match;
+}
+
+bool Comparison::compareDirectories(const string& expectedDir, const string& actualDir) const {
+    // The batch directory scan pairs every .tga of expectedDir with the
+    // same name under actualDir.
+    Batch pairs;
+    if (!pairs.scanDirectory(expectedDir, actualDir)) {
+        return false;
+    }
+    if (!diffPath.empty() && mkdir(diffPath.c_str(), 0755) != 0 && errno != EEXIST) {
+        cout << "Could not create " << diffPath << ": " << strerror(errno) << endl;
+        return false;
+    }
+    mutex console;
+    atomic<size_t> failures(0);
+    atomic<size_t> bytesRead(0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // One pair per chunk; the row bands of each comparison run inline on
+    // its worker.
+    defaultPool().parallelFor(pairs.jobs.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            const BatchJob& pair = pairs.jobs[i];
+            string diffFile;
+            if (!diffPath.empty()) {
+                diffFile = diffPath + pair.input.substr(expectedDir.size());
+            }
+            // The readers' and writer's messages follow the pair's line,
+            // under the console lock.
+            MessageCapture messages;
+            string line;
+            bool match = comparePair(pair.input, pair.output, diffFile, line);
+            bytesRead += fileSize(pair.input) + fileSize(pair.output);
+
+            lock_guard<mutex> guard(console);
+            if (!match) {
+                failures++;
+            }
+            cout << (match ? "OK " : "DIFFERENT ") << pair.input << " " << pair.output << ": " << line << endl;
+            cout << messages.text;
+        }
+    });
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t matched = pairs.jobs.size() - failures;
+    cout << "Compare: " << matched << " of " << pairs.jobs.size() << " images match in " << seconds << " s";
+    if (seconds > 0) {
+        cout << ", " << bytesRead / seconds / (1024.0 * 1024.0) << " MB/s";
+    }
+    cout << endl;
+    return failures == 0;
+}
@@ -0,0 +1,71 @@
+#ifndef compare_h
+#define compare_h
+
+#include <cstddef>
+#include <string>
+#include "tgaimage.h"
+using namespace std;
+
+// Differences between an expected and an actual image of the same size.
+// Channels are blue, green and red in pixel order and 3 for alpha, which
+// counts only when either image has it (a missing plane reads as opaque).
+// A strict result holds the first differing pixel only.
+class CompareResult{
+    public:
+        bool strict;
+        size_t pixels;
+        size_t mismatched;
+        int maxDifference[4];
+        unsigned long long squaredError;
+        // Bounding box of the differing pixels, inclusive, with rows in
+        // file order.
+        size_t left;
+        size_t top;
+        size_t right;
+        size_t bottom;
+        bool alpha;
+
+        CompareResult();
+
+        bool identical() const;
+        // Peak signal-to-noise ratio in dB over every channel sample,
+        // infinite for identical images.
+        double psnr() const;
+        void merge(const CompareResult& other);
+        // One line: "identical", or the counts, differences, PSNR and box.
+        string summary() const;
+};
+
+// Checks two images, or every .tga of expectedDir against the file of
+// the same name in actualDir (in parallel, one pair per worker). Strict
+// mode stops at the first differing pixel. Otherwise diffPath, when set,
+// receives an image of the per-channel absolute differences of a pair
+// that differs (a directory of them in directory mode, created if
+// missing). Both print one line per pair and return true when everything
+// matched.
+class Comparison{
+    public:
+        bool strict;
+        string diffPath;
+
+        Comparison();
+
+        bool compareFiles(const string& expectedPath, const string& actualPath) const;
+        bool compareDirectories(const string& expectedDir, const string& actualDir) const;
+
+    private:
+        // The pair's line, or an error; true when the images match.
+        bool comparePair(const string& expectedPath, const string& actualPath, const string& diffFile,
+                         string& line) const;
+
+        Comparison(const Comparison&);
+        Comparison& operator=(const Comparison&);
+};
+
+// Compares the pixels (and alpha) of two images of the same size, in any
+// layouts, on the thread pool. diff, a BGR image already sized, receives
+// the absolute differences when it is not null.
+void compareImages(const Picture& expected, const Picture& actual, bool strict, CompareResult& result,
+                   Picture* diff);
+
+#endif
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include "cpu.h"
+
+using namespace std;
+
+static const char* isaNames[] = {"scalar", "sse2", "avx2", "avx512"};
+
+static bool isaForced = false;
+static IsaLevel forcedIsa = ISA_SCALAR;
+
+IsaLevel detectIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return ISA_SSE2;
+    }
+#endif
+    return ISA_SCALAR;
+}
+
+static bool parseIsa(const string& name, IsaLevel& level) {
+    for (int i = ISA_SCALAR; i <= ISA_AVX512; i++) {
+        if (name == isaNames[i]) {
+            level = (IsaLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Clamps a requested level to what the CPU can run.
+static bool resolveIsa(const string& name, IsaLevel& level) {
+    if (!parseIsa(name, level)) {
+        cout << "Unknown instruction set " << name << ", expected scalar, sse2, avx2 or avx512." << endl;
+        return false;
+    }
+    IsaLevel supported = detectIsa();
+    if (level > supported) {
+        cout << "CPU does not support " << name << ", using " << isaNames[supported] << "." << endl;
+        level = supported;
+    }
+    return true;
+}
+
+static IsaLevel initialIsa() {
+    IsaLevel level = detectIsa();
+    const char* requested = getenv("PROJECT2_ISA");
+    if (requested) {
+        resolveIsa(requested, level);
+    }
+    return level;
+}
+
+bool forceIsa(const string& name) {
+    IsaLevel level;
+    if (!resolveIsa(name, level)) {
+        return false;
+    }
+    isaForced = true;
+    forcedIsa = level;
+    return true;
+}
+
+IsaLevel activeIsa() {
+    static const IsaLevel initial = initialIsa();
+    return isaForced ? forcedIsa : initial;
+}
+
+const char* isaName(IsaLevel level) {
+    return isaNames[level];
+}
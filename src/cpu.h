@@ -0,0 +1,25 @@
+#ifndef cpu_h
+#define cpu_h
+
+#include <string>
+using namespace std;
+
+// Instruction set levels the vector kernels are built for, lowest first.
+enum IsaLevel {
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2,
+    ISA_AVX512
+};
+
+// Best level the running CPU supports (via CPUID).
+IsaLevel detectIsa();
+
+// Level the kernels dispatch on: the detected one unless forced lower with
+// forceIsa() or the PROJECT2_ISA environment variable.
+IsaLevel activeIsa();
+bool forceIsa(const string& name);
+
+const char* isaName(IsaLevel level);
+
+#endif
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <immintrin.h>
+#include "filter.h"
+#include "threadpool.h"
+#include "cpu.h"
+
+using namespace std;
+
+// Output rows per band. Bands are at least twice the radius so the halo
+// rows filtered twice stay a fraction of the work. Scratch buffers are
+// kept per thread, so bands after the first do not allocate.
+static const size_t FILTER_BAND_ROWS = 32;
+
+// Row kernels of the two passes.
+//   convolve: out[i] = sum over k < taps of weights[k] * src[i + k * stride]
+//   slide: acc[i] += enter[i] - leave[i]
+//   toBytes: out[i] = in[i] clamped to [0, 255] and rounded
+//   scaleToBytes: the same for in[i] * scale
+// convolve keeps the sum of all taps in registers, so each output is
+// stored once. The vector versions add the taps in the same order with a
+// separate multiply and add, so every level produces the same floats.
+typedef void (*ConvolveKernel)(float* out, const float* src, size_t stride, const float* weights, size_t taps,
+                               size_t count);
+typedef void (*SlideKernel)(int32_t* acc, const int32_t* enter, const int32_t* leave, size_t count);
+typedef void (*ToBytesKernel)(const float* in, unsigned char* out, size_t count);
+typedef void (*ScaleToBytesKernel)(const int32_t* in, float scale, unsigned char* out, size_t count);
+
+struct FilterKernels {
+    ConvolveKernel convolve;
+    SlideKernel slide;
+    ToBytesKernel toBytes;
+    ScaleToBytesKernel scaleToBytes;
+};
+
+static unsigned char toByte(float value) {
+    value = value < 0 ? 0 : (value > 255 ? 255 : value);
+    return (unsigned char)(value + 0.5f);
+}
+
+static void convolveScalar(float* out, const float* src, size_t stride, const float* weights, size_t taps,
+                           size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float sum = 0;
+        for (size_t k = 0; k < taps; k++) {
+            sum += weights[k] * src[i + k * stride];
+        }
+        out[i] = sum;
+    }
+}
+
+static void slideScalar(int32_t* acc, const int32_t* enter, const int32_t* leave, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        acc[i] += enter[i] - leave[i];
+    }
+}
+
+static void toBytesScalar(const float* in, unsigned char* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = toByte(in[i]);
+    }
+}
+
+static void scaleToBytesScalar(const int32_t* in, float scale, unsigned char* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = toByte(in[i] * scale);
+    }
+}
+
+static void convolveSSE2(float* out, const float* src, size_t stride, const float* weights, size_t taps,
+                         size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (size_t k = 0; k < taps; k++) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(src + i + k * stride)));
+        }
+        _mm_storeu_ps(out + i, sum);
+    }
+    convolveScalar(out + i, src + i, stride, weights, taps, count - i);
+}
+
+static void slideSSE2(int32_t* acc, const int32_t* enter, const int32_t* leave, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(enter + i));
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(leave + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), _mm_add_epi32(a, _mm_sub_epi32(e, l)));
+    }
+    slideScalar(acc + i, enter + i, leave + i, count - i);
+}
+
+// Sixteen floats to sixteen bytes; truncating after adding 0.5 to values
+// clamped to [0, 255] matches toByte.
+static inline __m128i packBytesSSE2(__m128 a, __m128 b, __m128 c, __m128 d) {
+    __m128 low = _mm_setzero_ps();
+    __m128 high = _mm_set1_ps(255.0f);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128i ia = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(a, low), high), half));
+    __m128i ib = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(b, low), high), half));
+    __m128i ic = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(c, low), high), half));
+    __m128i id = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(d, low), high), half));
+    return _mm_packus_epi16(_mm_packs_epi32(ia, ib), _mm_packs_epi32(ic, id));
+}
+
+static void toBytesSSE2(const float* in, unsigned char* out, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = packBytesSSE2(_mm_loadu_ps(in + i), _mm_loadu_ps(in + i + 4), _mm_loadu_ps(in + i + 8),
+                                      _mm_loadu_ps(in + i + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+    }
+    toBytesScalar(in + i, out + i, count - i);
+}
+
+static void scaleToBytesSSE2(const int32_t* in, float scale, unsigned char* out, size_t count) {
+    __m128 s = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i* source = reinterpret_cast<const __m128i*>(in + i);
+        __m128i bytes = packBytesSSE2(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(source)), s),
+                                      _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(source + 1)), s),
+                                      _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(source + 2)), s),
+                                      _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(source + 3)), s));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+    }
+    scaleToBytesScalar(in + i, scale, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void convolveAVX2(float* out, const float* src, size_t stride, const float* weights, size_t taps,
+                         size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 first = _mm256_setzero_ps();
+        __m256 second = _mm256_setzero_ps();
+        for (size_t k = 0; k < taps; k++) {
+            __m256 w = _mm256_set1_ps(weights[k]);
+            const float* row = src + i + k * stride;
+            first = _mm256_add_ps(first, _mm256_mul_ps(w, _mm256_loadu_ps(row)));
+            second = _mm256_add_ps(second, _mm256_mul_ps(w, _mm256_loadu_ps(row + 8)));
+        }
+        _mm256_storeu_ps(out + i, first);
+        _mm256_storeu_ps(out + i + 8, second);
+    }
+    convolveScalar(out + i, src + i, stride, weights, taps, count - i);
+}
+
+__attribute__((target("avx2")))
+static void slideAVX2(int32_t* acc, const int32_t* enter, const int32_t* leave, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(enter + i));
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(leave + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_add_epi32(a, _mm256_sub_epi32(e, l)));
+    }
+    slideScalar(acc + i, enter + i, leave + i, count - i);
+}
+
+static const FilterKernels scalarKernels = {convolveScalar, slideScalar, toBytesScalar, scaleToBytesScalar};
+static const FilterKernels sse2Kernels = {convolveSSE2, slideSSE2, toBytesSSE2, scaleToBytesSSE2};
+static const FilterKernels avx2Kernels = {convolveAVX2, slideAVX2, toBytesSSE2, scaleToBytesSSE2};
+
+// AVX-512 runs the AVX2 kernels: the passes are bound by memory, not width.
+static const FilterKernels* filterKernels() {
+    switch (activeIsa()) {
+        case ISA_SSE2: return &sse2Kernels;
+        case ISA_AVX2:
+        case ISA_AVX512: return &avx2Kernels;
+        default: return &scalarKernels;
+    }
+}
+
+// Edges
+
+bool parseEdgeMode(const string& name, EdgeMode& edge) {
+    for (int mode = EDGE_CLAMP; mode <= EDGE_BLACK; mode++) {
+        if (name == edgeModeName(EdgeMode(mode))) {
+            edge = EdgeMode(mode);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* edgeModeName(EdgeMode edge) {
+    switch (edge) {
+        case EDGE_CLAMP: return "clamp";
+        case EDGE_MIRROR: return "mirror";
+        case EDGE_WRAP: return "wrap";
+        case EDGE_BLACK: return "black";
+    }
+    return "clamp";
+}
+
+// Row or column of a line of count samples that index i reads, or -1 for
+// black. mirror reflects about the edge sample without repeating it.
+static long edgeIndex(long i, long count, EdgeMode edge) {
+    if (i >= 0 && i < count) {
+        return i;
+    }
+    switch (edge) {
+        case EDGE_CLAMP: return i < 0 ? 0 : count - 1;
+        case EDGE_WRAP: return (i % count + count) % count;
+        case EDGE_BLACK: return -1;
+        case EDGE_MIRROR: {
+            if (count == 1) {
+                return 0;
+            }
+            long period = 2 * count - 2;
+            i = (i % period + period) % period;
+            return i < count ? i : period - i;
+        }
+    }
+    return -1;
+}
+
+// Widens row to padded with radius samples of each channel added at both
+// ends as the edge mode says.
+template <class T>
+static void padRow(const unsigned char* row, T* padded, size_t width, size_t channels, size_t radius,
+                   EdgeMode edge) {
+    for (size_t i = 0; i < width * channels; i++) {
+        padded[radius * channels + i] = row[i];
+    }
+    for (size_t k = 0; k < radius; k++) {
+        long left = edgeIndex(-(long)(radius - k), width, edge);
+        long right = edgeIndex(width + k, width, edge);
+        for (size_t c = 0; c < channels; c++) {
+            padded[k * channels + c] = left < 0 ? 0 : row[left * channels + c];
+            padded[(radius + width + k) * channels + c] = right < 0 ? 0 : row[right * channels + c];
+        }
+    }
+}
+
+static size_t bandRows(size_t radius) {
+    return max(FILTER_BAND_ROWS, 2 * radius);
+}
+
+// Weights of a window of taps samples starting at index start of a line of
+// count samples, added up on the samples the edge mode maps them to (black
+// ones are dropped). Windows wider than the line use this instead of a
+// padded copy, which would be larger than the line itself.
+static void foldWeights(const float* weights, size_t taps, long start, size_t count, EdgeMode edge,
+                        float* folded) {
+    fill(folded, folded + count, 0.0f);
+    for (size_t k = 0; k < taps; k++) {
+        long source = edgeIndex(start + (long)k, count, edge);
+        if (source >= 0) {
+            folded[source] += weights[k];
+        }
+    }
+}
+
+// Gaussian and unsharp mask
+
+static vector<float> gaussianWeights(double sigma) {
+    size_t radius = (size_t)ceil(3 * sigma);
+    vector<float> weights(2 * radius + 1);
+    double total = 0;
+    for (size_t k = 0; k < weights.size(); k++) {
+        double d = (double)k - radius;
+        total += weights[k] = (float)exp(-d * d / (2 * sigma * sigma));
+    }
+    for (size_t k = 0; k < weights.size(); k++) {
+        weights[k] = (float)(weights[k] / total);
+    }
+    return weights;
+}
+
+// Horizontal pass over one row.
+static void gaussianRow(const FilterKernels* kernels, const unsigned char* row, float* target, size_t width,
+                        size_t channels, const vector<float>& weights, EdgeMode edge) {
+    size_t radius = weights.size() / 2;
+    static thread_local vector<float> padded, folded;
+    if (radius < width) {
+        padded.resize((width + 2 * radius) * channels);
+        padRow(row, padded.data(), width, channels, radius, edge);
+        kernels->convolve(target, padded.data(), channels, weights.data(), weights.size(), width * channels);
+        return;
+    }
+    folded.resize(width);
+    for (size_t x = 0; x < width; x++) {
+        foldWeights(weights.data(), weights.size(), (long)x - (long)radius, width, edge, folded.data());
+        for (size_t c = 0; c < channels; c++) {
+            float total = 0;
+            for (size_t k = 0; k < width; k++) {
+                total += folded[k] * row[k * channels + c];
+            }
+            target[x * channels + c] = total;
+        }
+    }
+}
+
+// Filters output rows [first, last). With sharpen the blurred value is
+// only used to build the mask. When the window is taller than the image,
+// every image row is filtered once instead and the vertical pass folds its
+// weights onto them, which is also fewer taps; the halo otherwise stays
+// under the image height above and below the band.
+static void gaussianBand(const unsigned char* in, unsigned char* out, size_t width, size_t height,
+                         size_t channels, const vector<float>& weights, EdgeMode edge, bool sharpen,
+                         float amount, size_t first, size_t last) {
+    const FilterKernels* kernels = filterKernels();
+    size_t radius = weights.size() / 2;
+    size_t rowLength = width * channels;
+    size_t rows = last - first + 2 * radius;
+    bool foldRows = weights.size() > height;
+    size_t stored = foldRows ? height : rows;
+    static thread_local vector<float> blurred, sum, folded;
+    blurred.resize(stored * rowLength);
+    sum.resize(rowLength);
+
+    for (size_t j = 0; j < stored; j++) {
+        long source = foldRows ? (long)j : edgeIndex((long)(first + j) - (long)radius, height, edge);
+        float* target = blurred.data() + j * rowLength;
+        if (source < 0) {
+            fill(target, target + rowLength, 0.0f);
+            continue;
+        }
+        gaussianRow(kernels, in + source * rowLength, target, width, channels, weights, edge);
+    }
+
+    for (size_t y = first; y < last; y++) {
+        if (foldRows) {
+            folded.resize(height);
+            foldWeights(weights.data(), weights.size(), (long)y - (long)radius, height, edge, folded.data());
+            kernels->convolve(sum.data(), blurred.data(), rowLength, folded.data(), height, rowLength);
+        }
+        else {
+            kernels->convolve(sum.data(), blurred.data() + (y - first) * rowLength, rowLength, weights.data(),
+                              weights.size(), rowLength);
+        }
+        if (sharpen) {
+            const unsigned char* source = in + y * rowLength;
+            for (size_t i = 0; i < rowLength; i++) {
+                sum[i] = source[i] + amount * (source[i] - sum[i]);
+            }
+        }
+        kernels->toBytes(sum.data(), out + y * rowLength, rowLength);
+    }
+}
+
+static void gaussianFilter(const unsigned char* in, unsigned char* out, size_t width, size_t height,
+                           size_t channels, double sigma, EdgeMode edge, bool sharpen, double amount) {
+    vector<float> weights = gaussianWeights(sigma);
+    defaultPool().parallelFor(height, bandRows(weights.size() / 2), [&](size_t first, size_t last) {
+        gaussianBand(in, out, width, height, channels, weights, edge, sharpen, (float)amount, first, last);
+    });
+}
+
+void gaussianBlur(const unsigned char* in, unsigned char* out, size_t width, size_t height, size_t channels,
+                  double sigma, EdgeMode edge) {
+    gaussianFilter(in, out, width, height, channels, sigma, edge, false, 0);
+}
+
+void unsharpMask(const unsigned char* in, unsigned char* out, size_t width, size_t height, size_t channels,
+                 double amount, double sigma, EdgeMode edge) {
+    gaussianFilter(in, out, width, height, channels, sigma, edge, true, amount);
+}
+
+// Box blur. Each halo row holds running horizontal window sums; the
+// vertical window then slides down the band one row in, one row out.
+
+// Sum of samples [0, n) of a line extended past both ends by the edge
+// mode, taking it as 0 at n = 0 (so negative n counts backwards). prefix
+// holds the sums of the first i samples of one period of the extended
+// line: the line for wrap, the line and its reflection for mirror.
+static long long extendedSum(const long long* prefix, long n, size_t count, EdgeMode edge,
+                             const unsigned char* first, const unsigned char* last) {
+    long period = (long)count;
+    if (edge == EDGE_MIRROR && count > 1) {
+        period = 2 * (long)count - 2;
+    }
+    else if (edge != EDGE_WRAP) {
+        // Clamp (and mirror of a single sample) repeats the end samples,
+        // black adds nothing past them.
+        long long outside = edge == EDGE_BLACK ? 0 : 1;
+        if (n < 0) {
+            return n * outside * *first;
+        }
+        if (n > (long)count) {
+            return prefix[count] + (n - (long)count) * outside * *last;
+        }
+        return prefix[n];
+    }
+    long periods = n >= 0 ? n / period : -((-n + period - 1) / period);
+    return periods * prefix[period] + prefix[n - periods * period];
+}
+
+// target[x] = sum of the window of 2 * radius + 1 samples around x, per
+// channel. A window narrower than the row slides over a padded copy; a
+// wider one is a difference of extendedSum, which needs no padding.
+static void boxRow(const unsigned char* row, int32_t* target, size_t width, size_t channels, size_t radius,
+                   EdgeMode edge) {
+    size_t rowLength = width * channels;
+    size_t window = 2 * radius + 1;
+    if (radius < width) {
+        static thread_local vector<int32_t> padded;
+        padded.resize((width + 2 * radius) * channels);
+        padRow(row, padded.data(), width, channels, radius, edge);
+        // target[i] for i past the first pixel is target[i - channels]
+        // plus the sample entering the window minus the one leaving it.
+        for (size_t c = 0; c < channels; c++) {
+            int32_t running = 0;
+            for (size_t k = 0; k < window; k++) {
+                running += padded[k * channels + c];
+            }
+            target[c] = running;
+        }
+        const int32_t* entering = padded.data() + window * channels;
+        const int32_t* leaving = padded.data();
+        for (size_t i = channels; i < rowLength; i++) {
+            target[i] = target[i - channels] + entering[i - channels] - leaving[i - channels];
+        }
+        return;
+    }
+    static thread_local vector<long long> prefix;
+    size_t period = edge == EDGE_MIRROR && width > 1 ? 2 * width - 2 : width;
+    prefix.resize(max(period, width) + 1);
+    for (size_t c = 0; c < channels; c++) {
+        prefix[0] = 0;
+        for (size_t i = 0; i < prefix.size() - 1; i++) {
+            size_t x = i < width ? i : 2 * width - 2 - i;
+            prefix[i + 1] = prefix[i] + row[x * channels + c];
+        }
+        const unsigned char* first = row + c;
+        const unsigned char* last = row + (width - 1) * channels + c;
+        for (size_t x = 0; x < width; x++) {
+            long long high = extendedSum(prefix.data(), (long)(x + radius + 1), width, edge, first, last);
+            long long low = extendedSum(prefix.data(), (long)x - (long)radius, width, edge, first, last);
+            target[x * channels + c] = (int32_t)(high - low);
+        }
+    }
+}
+
+// Like the gaussian, a halo taller than the image holds each image row
+// once, and the halo rows point at the row they read.
+static void boxBand(const unsigned char* in, unsigned char* out, size_t width, size_t height, size_t channels,
+                    size_t radius, EdgeMode edge, size_t first, size_t last) {
+    const FilterKernels* kernels = filterKernels();
+    size_t rowLength = width * channels;
+    size_t rows = last - first + 2 * radius;
+    size_t window = 2 * radius + 1;
+    bool foldRows = rows > height;
+    size_t stored = foldRows ? height : rows;
+    static thread_local vector<int32_t> sums, zeros, sum;
+    static thread_local vector<const int32_t*> halo;
+    sums.resize(stored * rowLength);
+    zeros.assign(rowLength, 0);
+    sum.assign(rowLength, 0);
+    halo.resize(rows);
+
+    for (size_t j = 0; j < stored; j++) {
+        long source = foldRows ? (long)j : edgeIndex((long)(first + j) - (long)radius, height, edge);
+        int32_t* target = sums.data() + j * rowLength;
+        if (source < 0) {
+            fill(target, target + rowLength, 0);
+            continue;
+        }
+        boxRow(in + source * rowLength, target, width, channels, radius, edge);
+    }
+    for (size_t j = 0; j < rows; j++) {
+        long source = foldRows ? edgeIndex((long)(first + j) - (long)radius, height, edge) : (long)j;
+        halo[j] = source < 0 ? zeros.data() : sums.data() + source * rowLength;
+    }
+
+    for (size_t k = 0; k < window; k++) {
+        kernels->slide(sum.data(), halo[k], zeros.data(), rowLength);
+    }
+    float scale = 1.0f / (float)(window * window);
+    for (size_t y = first; y < last; y++) {
+        kernels->scaleToBytes(sum.data(), scale, out + y * rowLength, rowLength);
+        if (y + 1 < last) {
+            size_t j = y - first;
+            kernels->slide(sum.data(), halo[j + window], halo[j], rowLength);
+        }
+    }
+}
+
+void boxBlur(const unsigned char* in, unsigned char* out, size_t width, size_t height, size_t channels,
+             int radius, EdgeMode edge) {
+    size_t r = radius > 0 ? radius : 0;
+    defaultPool().parallelFor(height, bandRows(r), [&](size_t first, size_t last) {
+        boxBand(in, out, width, height, channels, r, edge, first, last);
+    });
+}
@@ -0,0 +1,39 @@
+#ifndef filter_h
+#define filter_h
+
+#include <cstddef>
+#include <string>
+#include "tgaimage.h"
+using namespace std;
+
+// Neighbourhood filters over 8-bit rows of interleaved channels: 3 for
+// Pixel data, 1 for a single plane. out must not alias in.
+//
+// Output rows are split into bands on the thread pool. A band runs the
+// horizontal pass over its rows plus radius rows of halo above and below
+// into a scratch buffer, then the vertical pass over that buffer, so both
+// passes work on cache-resident data. The scratch never outgrows the
+// image: a halo taller than the image keeps each image row once, and a
+// window wider than a row folds the edge mode into the weights instead of
+// padding the row. Rows past the top and bottom and
+// columns past the sides are read as the edge mode says.
+
+// Mean of the (2 * radius + 1)^2 square around each pixel, from running
+// sums: the cost per pixel does not depend on the radius. The sums are 32
+// bits, which holds a whole window up to MAX_BOX_RADIUS.
+const int MAX_BOX_RADIUS = 1450;
+void boxBlur(const unsigned char* in, unsigned char* out, size_t width, size_t height, size_t channels,
+             int radius, EdgeMode edge);
+// Gaussian of the given standard deviation, truncated at 3 sigma, which
+// the callers keep within MAX_IMAGE_SIDE.
+void gaussianBlur(const unsigned char* in, unsigned char* out, size_t width, size_t height, size_t channels,
+                  double sigma, EdgeMode edge);
+// Unsharp mask: in + amount * (in - gaussian(in)).
+void unsharpMask(const unsigned char* in, unsigned char* out, size_t width, size_t height, size_t channels,
+                 double amount, double sigma, EdgeMode edge);
+
+// clamp, mirror, wrap or black.
+bool parseEdgeMode(const string& name, EdgeMode& edge);
+const char* edgeModeName(EdgeMode edge);
+
+#endif
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#include "histogram.h"
+#include "lut.h"
+#include "threadpool.h"
+
+using namespace std;
+
+// Pixels a chunk counts before merging. Chunks are few and large so the
+// merges stay negligible; the thread count sets how many there are.
+static const size_t STATS_MIN_CHUNK = 1 << 16;
+
+// Consecutive values land in different copies of the bins, so a run of
+// equal bytes does not serialize on one counter's load and store.
+static const int STATS_LANES = 4;
+
+typedef uint32_t LaneBins[STATS_LANES][256];
+
+ImageStats::ImageStats() {
+    clear();
+}
+
+void ImageStats::clear() {
+    memset(counts, 0, sizeof(counts));
+    pixels = 0;
+}
+
+static void countInterleaved(const unsigned char* bytes, size_t count, LaneBins* bins) {
+    size_t i = 0;
+    // Four pixels are two overlapping words, read before any bin is
+    // written: the bins could otherwise alias the bytes and force a reload
+    // per count.
+    for (; i + STATS_LANES <= count; i += STATS_LANES) {
+        uint64_t low;
+        uint64_t high;
+        memcpy(&low, bytes + i * 3, sizeof(low));
+        memcpy(&high, bytes + i * 3 + 4, sizeof(high));
+        high >>= 16;
+        bins[0][0][low & 0xff]++;
+        bins[1][0][(low >> 8) & 0xff]++;
+        bins[2][0][(low >> 16) & 0xff]++;
+        bins[0][1][(low >> 24) & 0xff]++;
+        bins[1][1][(low >> 32) & 0xff]++;
+        bins[2][1][(low >> 40) & 0xff]++;
+        bins[0][2][high & 0xff]++;
+        bins[1][2][(high >> 8) & 0xff]++;
+        bins[2][2][(high >> 16) & 0xff]++;
+        bins[0][3][(high >> 24) & 0xff]++;
+        bins[1][3][(high >> 32) & 0xff]++;
+        bins[2][3][(high >> 40) & 0xff]++;
+    }
+    for (; i < count; i++) {
+        for (int c = 0; c < 3; c++) {
+            bins[c][0][bytes[i * 3 + c]]++;
+        }
+    }
+}
+
+// A BGRA pixel is one word; its alpha byte is not counted.
+static void countAlphaPixels(const unsigned char* bytes, size_t count, LaneBins* bins) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t word;
+        memcpy(&word, bytes + i * 4, sizeof(word));
+        int lane = (int)(i % STATS_LANES);
+        bins[0][lane][word & 0xff]++;
+        bins[1][lane][(word >> 8) & 0xff]++;
+        bins[2][lane][(word >> 16) & 0xff]++;
+    }
+}
+
+static void countPlane(const unsigned char* bytes, size_t count, LaneBins& bins) {
+    size_t i = 0;
+    for (; i + STATS_LANES <= count; i += STATS_LANES) {
+        uint32_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        bins[0][word & 0xff]++;
+        bins[1][(word >> 8) & 0xff]++;
+        bins[2][(word >> 16) & 0xff]++;
+        bins[3][word >> 24]++;
+    }
+    for (; i < count; i++) {
+        bins[0][bytes[i]]++;
+    }
+}
+
+static void addLanes(size_t* counts, const LaneBins& bins) {
+    for (int v = 0; v < 256; v++) {
+        size_t total = 0;
+        for (int lane = 0; lane < STATS_LANES; lane++) {
+            total += bins[lane][v];
+        }
+        counts[v] += total;
+    }
+}
+
+typedef void (*CountKernel)(const unsigned char* bytes, size_t count, LaneBins* bins);
+
+static void addInterleaved(ImageStats& stats, const unsigned char* bytes, size_t pixelBytes, size_t count,
+                           CountKernel kernel) {
+    // Bounded so no 32-bit lane counter can overflow.
+    const size_t limit = (size_t)1 << 30;
+    for (size_t begin = 0; begin < count; begin += limit) {
+        LaneBins bins[3];
+        memset(bins, 0, sizeof(bins));
+        size_t n = min(limit, count - begin);
+        kernel(bytes + begin * pixelBytes, n, bins);
+        for (int c = 0; c < 3; c++) {
+            addLanes(stats.counts[c], bins[c]);
+        }
+        stats.pixels += n;
+    }
+}
+
+void ImageStats::add(const Pixel* data, size_t count) {
+    addInterleaved(*this, reinterpret_cast<const unsigned char*>(data), sizeof(Pixel), count, countInterleaved);
+}
+
+void ImageStats::add(const AlphaPixel* data, size_t count) {
+    addInterleaved(*this, reinterpret_cast<const unsigned char*>(data), sizeof(AlphaPixel), count,
+                   countAlphaPixels);
+}
+
+void ImageStats::addPlane(int channel, const unsigned char* data, size_t count) {
+    const size_t limit = (size_t)1 << 30;
+    for (size_t begin = 0; begin < count; begin += limit) {
+        LaneBins bins;
+        memset(bins, 0, sizeof(bins));
+        countPlane(data + begin, min(limit, count - begin), bins);
+        addLanes(counts[channel], bins);
+    }
+}
+
+void ImageStats::merge(const ImageStats& other) {
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            counts[c][v] += other.counts[c][v];
+        }
+    }
+    pixels += other.pixels;
+}
+
+int ImageStats::minimum(int channel) const {
+    for (int v = 0; v < 256; v++) {
+        if (counts[channel][v]) {
+            return v;
+        }
+    }
+    return 0;
+}
+
+int ImageStats::maximum(int channel) const {
+    for (int v = 255; v >= 0; v--) {
+        if (counts[channel][v]) {
+            return v;
+        }
+    }
+    return 0;
+}
+
+double ImageStats::mean(int channel) const {
+    if (pixels == 0) {
+        return 0;
+    }
+    double sum = 0;
+    for (int v = 0; v < 256; v++) {
+        sum += (double)v * counts[channel][v];
+    }
+    return sum / pixels;
+}
+
+static void identityTable(unsigned char* function) {
+    for (int v = 0; v < 256; v++) {
+        function[v] = (unsigned char)v;
+    }
+}
+
+void ImageStats::autolevelsTable(int channel, unsigned char* function) const {
+    const size_t* count = counts[channel];
+    size_t clip = (size_t)(pixels * AUTOLEVELS_CLIP);
+    int low = 0;
+    size_t below = 0;
+    while (low < 255 && below + count[low] <= clip) {
+        below += count[low];
+        low++;
+    }
+    int high = 255;
+    size_t above = 0;
+    while (high > 0 && above + count[high] <= clip) {
+        above += count[high];
+        high--;
+    }
+    if (high <= low) {
+        identityTable(function);
+        return;
+    }
+    int span = high - low;
+    for (int v = 0; v < 256; v++) {
+        int temp = v <= low ? 0 : v >= high ? 255 : ((v - low) * 510 + span) / (2 * span);
+        function[v] = (unsigned char)temp;
+    }
+}
+
+void ImageStats::equalizeTable(int channel, unsigned char* function) const {
+    const size_t* count = counts[channel];
+    size_t first = count[minimum(channel)];
+    if (pixels <= first) {
+        identityTable(function);
+        return;
+    }
+    unsigned long long range = pixels - first;
+    size_t cumulative = 0;
+    for (int v = 0; v < 256; v++) {
+        cumulative += count[v];
+        if (cumulative <= first) {
+            function[v] = 0;
+            continue;
+        }
+        unsigned long long above = cumulative - first;
+        function[v] = (unsigned char)((above * 510 + range) / (2 * range));
+    }
+}
+
+string ImageStats::json(size_t width, size_t height) const {
+    static const char* names[3] = {"red", "green", "blue"};
+    static const int channels[3] = {CHANNEL_RED, CHANNEL_GREEN, CHANNEL_BLUE};
+    char number[128];
+    snprintf(number, sizeof(number), "{\"width\": %zu, \"height\": %zu, \"pixels\": %zu, \"channels\": {\n",
+             width, height, pixels);
+    string out = number;
+    for (int i = 0; i < 3; i++) {
+        int c = channels[i];
+        snprintf(number, sizeof(number), "  \"%s\": {\"min\": %d, \"max\": %d, \"mean\": %.4f, \"histogram\": [",
+                 names[i], minimum(c), maximum(c), mean(c));
+        out += number;
+        for (int v = 0; v < 256; v++) {
+            snprintf(number, sizeof(number), v ? ", %zu" : "%zu", counts[c][v]);
+            out += number;
+        }
+        out += i < 2 ? "]},\n" : "]}\n";
+    }
+    out += "}}";
+    return out;
+}
+
+static size_t statsGrain(size_t count) {
+    return max(STATS_MIN_CHUNK, count / (threadCount() * 4) + 1);
+}
+
+// A gray image counts its one plane and copies the bins to the others.
+void imageStats(const ImageView& image, ImageStats& stats) {
+    stats.clear();
+    size_t count = image.size();
+    mutex lock;
+    defaultPool().parallelFor(count, statsGrain(count), [&](size_t begin, size_t end) {
+        ImageStats local;
+        if (image.grayPixels) {
+            local.addPlane(CHANNEL_BLUE, image.grayPixels + begin, end - begin);
+        }
+        else if (image.alphaPixels) {
+            local.add(image.alphaPixels + begin, end - begin);
+        }
+        else {
+            local.add(image.pixels + begin, end - begin);
+        }
+        lock_guard<mutex> guard(lock);
+        stats.merge(local);
+    });
+    if (image.grayPixels) {
+        for (int c = 1; c < 3; c++) {
+            memcpy(stats.counts[c], stats.counts[0], sizeof(stats.counts[c]));
+        }
+        stats.pixels = count;
+    }
+}
+
+void imageStats(const PlanarPicture& image, ImageStats& stats) {
+    stats.clear();
+    size_t count = image.size();
+    size_t grain = statsGrain(count);
+    size_t chunks = (count + grain - 1) / grain;
+    mutex lock;
+    // One task per channel chunk, all planes in the same loop. A gray
+    // image counts its one plane and copies the bins to the others.
+    int channels = image.gray ? 1 : 3;
+    defaultPool().parallelFor(chunks * channels, 1, [&](size_t first, size_t last) {
+        for (size_t task = first; task < last; task++) {
+            int c = (int)(task % channels);
+            size_t begin = task / channels * grain;
+            size_t end = min(count, begin + grain);
+            ImageStats local;
+            local.addPlane(c, image.planes[c].data() + begin, end - begin);
+            lock_guard<mutex> guard(lock);
+            stats.merge(local);
+        }
+    });
+    for (int c = channels; c < 3; c++) {
+        memcpy(stats.counts[c], stats.counts[0], sizeof(stats.counts[c]));
+    }
+    stats.pixels = count;
+}
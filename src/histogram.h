@@ -0,0 +1,50 @@
+#ifndef histogram_h
+#define histogram_h
+
+#include <cstddef>
+#include <string>
+#include "tgaimage.h"
+#include "planar.h"
+using namespace std;
+
+// Per-channel 256-bin histograms of an image (CHANNEL_BLUE/GREEN/RED
+// order) and the statistics derived from them.
+class ImageStats{
+    public:
+        size_t counts[3][256];
+        size_t pixels;
+
+        ImageStats();
+
+        void clear();
+        // Adds interleaved pixels (not counting alpha), or one channel's
+        // bytes from a plane (the caller then adds the plane's pixel count
+        // to pixels once).
+        void add(const Pixel* data, size_t count);
+        void add(const AlphaPixel* data, size_t count);
+        void addPlane(int channel, const unsigned char* data, size_t count);
+        void merge(const ImageStats& other);
+
+        int minimum(int channel) const;
+        int maximum(int channel) const;
+        double mean(int channel) const;
+
+        // Stretches the channel so the values left after clipping
+        // AUTOLEVELS_CLIP of the pixels at each end span 0..255.
+        void autolevelsTable(int channel, unsigned char* function) const;
+        // Maps each value through the channel's cumulative distribution, so
+        // the output values are as close to evenly used as the input allows.
+        void equalizeTable(int channel, unsigned char* function) const;
+
+        // {"width", "height", "pixels", "channels": {red, green, blue}}.
+        string json(size_t width, size_t height) const;
+};
+
+const double AUTOLEVELS_CLIP = 0.001;
+
+// One pass over the image on the thread pool: every chunk counts into its
+// own bins and the chunks are merged at the end.
+void imageStats(const ImageView& image, ImageStats& stats);
+void imageStats(const PlanarPicture& image, ImageStats& stats);
+
+#endif
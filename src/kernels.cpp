@@ -0,0 +1,768 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "kernels.h"
+#include "blend.h"
+#include "tgaio.h"
+
+using namespace std;
+
+// Blend modes. These run the vector kernels for the active instruction set
+// and keep the float loops below as the scalar reference.
+
+static inline const unsigned char* bytesOf(const Pixel* pixels) {
+    return reinterpret_cast<const unsigned char*>(pixels);
+}
+
+static inline unsigned char* bytesOf(Pixel* pixels) {
+    return reinterpret_cast<unsigned char*>(pixels);
+}
+
+static inline const unsigned char* bytesOf(const AlphaPixel* pixels) {
+    return reinterpret_cast<const unsigned char*>(pixels);
+}
+
+static inline unsigned char* bytesOf(AlphaPixel* pixels) {
+    return reinterpret_cast<unsigned char*>(pixels);
+}
+
+void multiplyPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count) {
+    IsaLevel isa = activeIsa();
+    if (isa != ISA_SCALAR) {
+        blendKernels(isa)->multiply(bytesOf(top), bytesOf(bot), bytesOf(out), count * sizeof(Pixel));
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float normalizedTopBlue = static_cast<float>(top[i].blue) / 255.0f;
+        float normalizedBotBlue = static_cast<float>(bot[i].blue) / 255.0f;
+        float outcomeBlue = normalizedTopBlue * normalizedBotBlue * 255.0f;
+        out[i].blue = (unsigned char)(outcomeBlue + 0.5f);
+
+        float normalizedTopGreen = static_cast<float>(top[i].green) / 255.0f;
+        float normalizedBotGreen = static_cast<float>(bot[i].green) / 255.0f;
+        float outcomeGreen = normalizedTopGreen * normalizedBotGreen * 255.0f;
+        out[i].green = (unsigned char)(outcomeGreen + 0.5f);
+
+        float normalizedTopRed = static_cast<float>(top[i].red) / 255.0f;
+        float normalizedBotRed = static_cast<float>(bot[i].red) / 255.0f;
+        float outcomeRed = normalizedTopRed * normalizedBotRed * 255.0f;
+        out[i].red = (unsigned char)(outcomeRed + 0.5f);
+    }
+}
+
+void subtractPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count) {
+    IsaLevel isa = activeIsa();
+    if (isa != ISA_SCALAR) {
+        blendKernels(isa)->subtract(bytesOf(top), bytesOf(bot), bytesOf(out), count * sizeof(Pixel));
+        return;
+    }
+
+    int temp;
+
+    for (size_t i = 0; i < count; i++) {
+        temp = (int) top[i].blue - (int) bot[i].blue;
+        if (temp < 0) {
+            temp = 0;
+        }
+        out[i].blue = (unsigned char) temp;
+
+        temp = (int) top[i].green - (int) bot[i].green;
+        if (temp < 0) {
+            temp = 0;
+        }
+        out[i].green = (unsigned char) temp;
+
+        temp = (int) top[i].red - (int) bot[i].red;
+        if (temp < 0) {
+            temp = 0;
+        }
+        out[i].red = (unsigned char) temp;
+    }
+}
+
+void overlayPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count) {
+    IsaLevel isa = activeIsa();
+    if (isa != ISA_SCALAR) {
+        blendKernels(isa)->overlay(bytesOf(top), bytesOf(bot), bytesOf(out), count * sizeof(Pixel));
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float normalizedTopBlue = (float)top[i].blue / 255;
+        float normalizedBotBlue = (float)bot[i].blue / 255;
+        if(normalizedBotBlue <= 0.5) {
+            float outcomeBlue = 2 * normalizedTopBlue * normalizedBotBlue * 255;
+            out[i].blue = (unsigned char)(outcomeBlue + 0.5f);
+        }
+        else {
+            float outcomeBlue = (1 - (2 * (1 - normalizedTopBlue) * (1 - normalizedBotBlue))) * 255;
+            out[i].blue = (unsigned char)(outcomeBlue + 0.5f);
+        }
+
+        float normalizedTopGreen = (float)top[i].green / 255;
+        float normalizedBotGreen = (float)bot[i].green / 255;
+        if(normalizedBotGreen <= 0.5) {
+            float outcomeGreen = 2 * normalizedTopGreen * normalizedBotGreen * 255;
+            out[i].green = (unsigned char)(outcomeGreen + 0.5f);
+        }
+        else {
+            float outcomeGreen = (1 - (2 * (1 - normalizedTopGreen) * (1 - normalizedBotGreen))) * 255;
+            out[i].green = (unsigned char)(outcomeGreen + 0.5f);
+        }
+
+        float normalizedTopRed = (float)top[i].red / 255;
+        float normalizedBotRed = (float)bot[i].red / 255;
+        if(normalizedBotRed <= 0.5) {
+            float outcomeRed = 2 * normalizedTopRed * normalizedBotRed * 255;
+            out[i].red = (unsigned char)(outcomeRed + 0.5f);
+        }
+        else {
+            float outcomeRed = (1 - (2 * (1 - normalizedTopRed) * (1 - normalizedBotRed))) * 255;
+            out[i].red = (unsigned char)(outcomeRed + 0.5f);
+        }
+
+    }
+
+}
+
+void screenPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count) {
+    IsaLevel isa = activeIsa();
+    if (isa != ISA_SCALAR) {
+        blendKernels(isa)->screen(bytesOf(top), bytesOf(bot), bytesOf(out), count * sizeof(Pixel));
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float normalizedTopBlue = (float) top[i].blue / 255;
+        float normalizedBotBlue = (float) bot[i].blue / 255;
+        float outcomeBlue = (1 - ((1 - normalizedTopBlue) * (1 - normalizedBotBlue))) * 255;
+        out[i].blue = (unsigned char) (outcomeBlue + 0.5f);
+
+        float normalizedTopGreen = (float) top[i].green / 255;
+        float normalizedBotGreen = (float) bot[i].green / 255;
+        float outcomeGreen = (1 - ((1 - normalizedTopGreen) * (1 - normalizedBotGreen))) * 255;
+        out[i].green = (unsigned char) (outcomeGreen + 0.5f);
+
+        float normalizedTopRed = (float) top[i].red / 255;
+        float normalizedBotRed = (float) bot[i].red / 255;
+        float outcomeRed = (1 - ((1 - normalizedTopRed) * (1 - normalizedBotRed))) * 255;
+        out[i].red = (unsigned char) (outcomeRed + 0.5f);
+    }
+
+}
+
+
+void combinePixels(const Pixel* red, const Pixel* green, const Pixel* blue, Pixel* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i].red = red[i].red;
+        out[i].green = green[i].green;
+        out[i].blue = blue[i].blue;
+    }
+}
+
+// Coverage
+
+static inline unsigned char cover(unsigned char blended, unsigned char top, unsigned int alpha) {
+    unsigned int x = blended * alpha + top * (255 - alpha) + 128;
+    return (unsigned char)((x + (x >> 8)) >> 8);
+}
+
+void coverPixels(const Pixel* blended, const unsigned char* alpha, Pixel* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        unsigned int a = alpha[i];
+        out[i].blue = cover(blended[i].blue, out[i].blue, a);
+        out[i].green = cover(blended[i].green, out[i].green, a);
+        out[i].red = cover(blended[i].red, out[i].red, a);
+    }
+}
+
+void coverBytes(const unsigned char* blended, const unsigned char* alpha, unsigned char* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = cover(blended[i], out[i], alpha[i]);
+    }
+}
+
+// Pixels blended per scratch block, which stays on the stack.
+static const size_t COVER_BLOCK = 256;
+
+void blendCovered(PixelBlend blend, const Pixel* top, const Pixel* bot, const unsigned char* alpha,
+                  Pixel* out, size_t count) {
+    Pixel blended[COVER_BLOCK];
+    for (size_t begin = 0; begin < count; begin += COVER_BLOCK) {
+        size_t n = min(COVER_BLOCK, count - begin);
+        blend(top + begin, bot + begin, blended, n);
+        if (out != top) {
+            memcpy(out + begin, top + begin, n * sizeof(Pixel));
+        }
+        coverPixels(blended, alpha + begin, out + begin, n);
+    }
+}
+
+// Blends against a layer in any layout. The bottom pixels are brought to
+// the top's layout a scratch block at a time.
+
+static PixelBlend pixelBlend(BlendMode mode) {
+    switch (mode) {
+        case BLEND_MULTIPLY: return multiplyPixels;
+        case BLEND_SUBTRACT: return subtractPixels;
+        case BLEND_OVERLAY: return overlayPixels;
+        default: return screenPixels;
+    }
+}
+
+static BlendKernel byteBlend(BlendMode mode) {
+    const BlendKernels* kernels = blendKernels(activeIsa());
+    switch (mode) {
+        case BLEND_MULTIPLY: return kernels->multiply;
+        case BLEND_SUBTRACT: return kernels->subtract;
+        case BLEND_OVERLAY: return kernels->overlay;
+        default: return kernels->screen;
+    }
+}
+
+void blendPixels(BlendMode mode, const Pixel* top, const ImageView& bot, size_t begin, Pixel* out, size_t count) {
+    PixelBlend blend = pixelBlend(mode);
+    if (bot.pixels) {
+        blend(top, bot.pixels + begin, out, count);
+        return;
+    }
+    Pixel lower[COVER_BLOCK];
+    unsigned char alpha[COVER_BLOCK];
+    for (size_t i = 0; i < count; i += COVER_BLOCK) {
+        size_t n = min(COVER_BLOCK, count - i);
+        if (bot.grayPixels) {
+            unpackPixels(bot.grayPixels + begin + i, 1, lower, 0, n);
+            blend(top + i, lower, out + i, n);
+        }
+        else {
+            unpackPixels(bytesOf(bot.alphaPixels + begin + i), sizeof(AlphaPixel), lower, alpha, n);
+            blendCovered(blend, top + i, lower, alpha, out + i, n);
+        }
+    }
+}
+
+void blendPixels(BlendMode mode, const AlphaPixel* top, const ImageView& bot, size_t begin, AlphaPixel* out,
+                 size_t count) {
+    BlendKernel blend = byteBlend(mode);
+    AlphaPixel lower[COVER_BLOCK];
+    AlphaPixel blended[COVER_BLOCK];
+    for (size_t i = 0; i < count; i += COVER_BLOCK) {
+        size_t n = min(COVER_BLOCK, count - i);
+        const AlphaPixel* from = lower;
+        if (bot.alphaPixels) {
+            from = bot.alphaPixels + begin + i;
+        }
+        else if (bot.pixels) {
+            packPixels(bot.pixels + begin + i, 0, sizeof(AlphaPixel), bytesOf(lower), n);
+        }
+        else {
+            for (size_t j = 0; j < n; j++) {
+                unsigned char gray = bot.grayPixels[begin + i + j];
+                lower[j] = AlphaPixel(gray, gray, gray, (char)255);
+            }
+        }
+        blend(bytesOf(top + i), bytesOf(from), bytesOf(blended), n * sizeof(AlphaPixel));
+        for (size_t j = 0; j < n; j++) {
+            AlphaPixel pixel = top[i + j];
+            unsigned int a = from[j].alpha;
+            pixel.blue = cover(blended[j].blue, pixel.blue, a);
+            pixel.green = cover(blended[j].green, pixel.green, a);
+            pixel.red = cover(blended[j].red, pixel.red, a);
+            out[i + j] = pixel;
+        }
+    }
+}
+
+void blendPixels(BlendMode mode, const unsigned char* top, const ImageView& bot, size_t begin, unsigned char* out,
+                 size_t count) {
+    byteBlend(mode)(top, bot.grayPixels + begin, out, count);
+}
+
+// One channel (CHANNEL_* order) of pixels [begin, begin + count) of a
+// layer in any layout.
+static void channelOf(const ImageView& layer, int channel, size_t begin, unsigned char* out, size_t count) {
+    if (layer.grayPixels) {
+        memcpy(out, layer.grayPixels + begin, count);
+        return;
+    }
+    size_t stride = layer.pixels ? sizeof(Pixel) : sizeof(AlphaPixel);
+    const unsigned char* in = layer.pixels ? bytesOf(layer.pixels) : bytesOf(layer.alphaPixels);
+    in += begin * stride + channel;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = in[i * stride];
+    }
+}
+
+template <class T>
+static void combineLayers(const T* red, const ImageView& green, const ImageView& blue, size_t begin, T* out,
+                          size_t count) {
+    unsigned char greens[COVER_BLOCK];
+    unsigned char blues[COVER_BLOCK];
+    for (size_t i = 0; i < count; i += COVER_BLOCK) {
+        size_t n = min(COVER_BLOCK, count - i);
+        channelOf(green, 1, begin + i, greens, n);
+        channelOf(blue, 0, begin + i, blues, n);
+        for (size_t j = 0; j < n; j++) {
+            T pixel = red[i + j];
+            pixel.green = greens[j];
+            pixel.blue = blues[j];
+            out[i + j] = pixel;
+        }
+    }
+}
+
+void combinePixels(const Pixel* red, const ImageView& green, const ImageView& blue, size_t begin, Pixel* out,
+                   size_t count) {
+    combineLayers(red, green, blue, begin, out, count);
+}
+
+void combinePixels(const AlphaPixel* red, const ImageView& green, const ImageView& blue, size_t begin,
+                   AlphaPixel* out, size_t count) {
+    combineLayers(red, green, blue, begin, out, count);
+}
+
+// Geometry
+
+void flipPixels(Pixel* pixels, size_t count) {
+    swapMirrored(pixels, count, 0, count / 2);
+}
+
+template <class T>
+static void swapMirroredRange(T* pixels, size_t count, size_t begin, size_t end) {
+    T* low = pixels + begin;
+    T* high = pixels + count - 1 - begin;
+    for (size_t i = begin; i < end; i++) {
+        T temp = *low;
+        *low++ = *high;
+        *high-- = temp;
+    }
+}
+
+template <class T>
+static void copyMirroredRange(const T* in, T* out, size_t count, size_t begin, size_t end) {
+    const T* source = in + count - 1 - begin;
+    for (size_t i = begin; i < end; i++) {
+        out[i] = *source--;
+    }
+}
+
+void swapMirrored(Pixel* pixels, size_t count, size_t begin, size_t end) {
+    swapMirroredRange(pixels, count, begin, end);
+}
+
+void swapMirrored(AlphaPixel* pixels, size_t count, size_t begin, size_t end) {
+    swapMirroredRange(pixels, count, begin, end);
+}
+
+void swapMirrored(unsigned char* pixels, size_t count, size_t begin, size_t end) {
+    swapMirroredRange(pixels, count, begin, end);
+}
+
+void copyMirrored(const Pixel* in, Pixel* out, size_t count, size_t begin, size_t end) {
+    copyMirroredRange(in, out, count, begin, end);
+}
+
+void copyMirrored(const AlphaPixel* in, AlphaPixel* out, size_t count, size_t begin, size_t end) {
+    copyMirroredRange(in, out, count, begin, end);
+}
+
+void copyMirrored(const unsigned char* in, unsigned char* out, size_t count, size_t begin, size_t end) {
+    copyMirroredRange(in, out, count, begin, end);
+}
+
+// Square tiles of 64 rows by 64 columns: the source rows of a tile stay in
+// cache while its columns are written out as contiguous output rows.
+static const size_t REMAP_TILE = 64;
+
+// Copies count elements read stride elements apart (stride may be
+// negative) to consecutive out.
+template <class T>
+struct Gather {
+    static void run(const T* in, ptrdiff_t stride, T* out, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = in[(ptrdiff_t)i * stride];
+        }
+    }
+};
+
+// Pixels move as little-endian 4-byte words, each store's spare byte
+// overwritten by the next one and the last pixel copied on its own. The
+// word read stays inside the image: it starts at the pixel going up and
+// one byte before it going down, where the first image pixel comes last.
+template <>
+struct Gather<Pixel> {
+    static void run(const Pixel* in, ptrdiff_t stride, Pixel* out, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        const unsigned char* source = bytesOf(in);
+        unsigned char* target = bytesOf(out);
+        ptrdiff_t step = stride * (ptrdiff_t)sizeof(Pixel);
+        if (stride > 0) {
+            for (size_t i = 0; i + 1 < count; i++, source += step, target += sizeof(Pixel)) {
+                uint32_t word;
+                memcpy(&word, source, sizeof(word));
+                memcpy(target, &word, sizeof(word));
+            }
+        }
+        else {
+            for (size_t i = 0; i + 1 < count; i++, source += step, target += sizeof(Pixel)) {
+                uint32_t word;
+                memcpy(&word, source - 1, sizeof(word));
+                word >>= 8;
+                memcpy(target, &word, sizeof(word));
+            }
+        }
+        out[count - 1] = in[(ptrdiff_t)(count - 1) * stride];
+    }
+};
+
+// Output row that input column x becomes, and whether the input rows run
+// backwards along it.
+struct Transposed {
+    size_t width;
+    static const bool reversed = false;
+    size_t row(size_t x) const {
+        return x;
+    }
+};
+
+struct Rotated90 {
+    size_t width;
+    static const bool reversed = false;
+    size_t row(size_t x) const {
+        return width - 1 - x;
+    }
+};
+
+struct Rotated270 {
+    size_t width;
+    static const bool reversed = true;
+    size_t row(size_t x) const {
+        return x;
+    }
+};
+
+template <class T, class Target>
+static void remapTiles(const T* in, size_t width, size_t height, T* out, size_t rowBegin, size_t rowEnd,
+                       Target target) {
+    ptrdiff_t stride = (ptrdiff_t)width;
+    for (size_t y0 = rowBegin; y0 < rowEnd; y0 += REMAP_TILE) {
+        size_t y1 = min(y0 + REMAP_TILE, rowEnd);
+        for (size_t x0 = 0; x0 < width; x0 += REMAP_TILE) {
+            size_t x1 = min(x0 + REMAP_TILE, width);
+            for (size_t x = x0; x < x1; x++) {
+                T* row = out + target.row(x) * height;
+                if (Target::reversed) {
+                    Gather<T>::run(in + (y1 - 1) * width + x, -stride, row + height - y1, y1 - y0);
+                }
+                else {
+                    Gather<T>::run(in + y0 * width + x, stride, row + y0, y1 - y0);
+                }
+            }
+        }
+    }
+}
+
+template <class T>
+static void mirrorRowRange(const T* in, T* out, size_t width, size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+        if (in == out) {
+            reverse(out + y * width, out + (y + 1) * width);
+        }
+        else {
+            reverse_copy(in + y * width, in + (y + 1) * width, out + y * width);
+        }
+    }
+}
+
+template <class T>
+static void flipRowRange(const T* in, T* out, size_t width, size_t height, size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+        if (in == out) {
+            swap_ranges(out + y * width, out + (y + 1) * width, out + (height - 1 - y) * width);
+        }
+        else {
+            memcpy(out + y * width, in + (height - 1 - y) * width, width * sizeof(T));
+        }
+    }
+}
+
+template <class T>
+static void cropRowRange(const T* in, size_t inWidth, T* out, size_t x, size_t y, size_t width,
+                         size_t rowBegin, size_t rowEnd) {
+    for (size_t r = rowBegin; r < rowEnd; r++) {
+        memmove(out + r * width, in + (y + r) * inWidth + x, width * sizeof(T));
+    }
+}
+
+void transposePixels(const Pixel* in, size_t width, size_t height, Pixel* out, size_t rowBegin, size_t rowEnd) {
+    Transposed target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void rotate90Pixels(const Pixel* in, size_t width, size_t height, Pixel* out, size_t rowBegin, size_t rowEnd) {
+    Rotated90 target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void rotate270Pixels(const Pixel* in, size_t width, size_t height, Pixel* out, size_t rowBegin, size_t rowEnd) {
+    Rotated270 target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void transposePixels(const AlphaPixel* in, size_t width, size_t height, AlphaPixel* out,
+                     size_t rowBegin, size_t rowEnd) {
+    Transposed target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void rotate90Pixels(const AlphaPixel* in, size_t width, size_t height, AlphaPixel* out,
+                    size_t rowBegin, size_t rowEnd) {
+    Rotated90 target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void rotate270Pixels(const AlphaPixel* in, size_t width, size_t height, AlphaPixel* out,
+                     size_t rowBegin, size_t rowEnd) {
+    Rotated270 target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void transposePixels(const unsigned char* in, size_t width, size_t height, unsigned char* out,
+                     size_t rowBegin, size_t rowEnd) {
+    Transposed target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void rotate90Pixels(const unsigned char* in, size_t width, size_t height, unsigned char* out,
+                    size_t rowBegin, size_t rowEnd) {
+    Rotated90 target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void rotate270Pixels(const unsigned char* in, size_t width, size_t height, unsigned char* out,
+                     size_t rowBegin, size_t rowEnd) {
+    Rotated270 target = {width};
+    remapTiles(in, width, height, out, rowBegin, rowEnd, target);
+}
+
+void mirrorRows(const Pixel* in, Pixel* out, size_t width, size_t rowBegin, size_t rowEnd) {
+    mirrorRowRange(in, out, width, rowBegin, rowEnd);
+}
+
+void mirrorRows(const AlphaPixel* in, AlphaPixel* out, size_t width, size_t rowBegin, size_t rowEnd) {
+    mirrorRowRange(in, out, width, rowBegin, rowEnd);
+}
+
+void mirrorRows(const unsigned char* in, unsigned char* out, size_t width, size_t rowBegin, size_t rowEnd) {
+    mirrorRowRange(in, out, width, rowBegin, rowEnd);
+}
+
+void flipRows(const Pixel* in, Pixel* out, size_t width, size_t height, size_t rowBegin, size_t rowEnd) {
+    flipRowRange(in, out, width, height, rowBegin, rowEnd);
+}
+
+void flipRows(const AlphaPixel* in, AlphaPixel* out, size_t width, size_t height, size_t rowBegin, size_t rowEnd) {
+    flipRowRange(in, out, width, height, rowBegin, rowEnd);
+}
+
+void flipRows(const unsigned char* in, unsigned char* out, size_t width, size_t height,
+              size_t rowBegin, size_t rowEnd) {
+    flipRowRange(in, out, width, height, rowBegin, rowEnd);
+}
+
+void cropRows(const Pixel* in, size_t inWidth, Pixel* out, size_t x, size_t y, size_t width,
+              size_t rowBegin, size_t rowEnd) {
+    cropRowRange(in, inWidth, out, x, y, width, rowBegin, rowEnd);
+}
+
+void cropRows(const AlphaPixel* in, size_t inWidth, AlphaPixel* out, size_t x, size_t y, size_t width,
+              size_t rowBegin, size_t rowEnd) {
+    cropRowRange(in, inWidth, out, x, y, width, rowBegin, rowEnd);
+}
+
+void cropRows(const unsigned char* in, size_t inWidth, unsigned char* out, size_t x, size_t y, size_t width,
+              size_t rowBegin, size_t rowEnd) {
+    cropRowRange(in, inWidth, out, x, y, width, rowBegin, rowEnd);
+}
+
+// Channel operations. One template per kind of operation, with the
+// channel a pointer-to-member and the per-value arithmetic a small functor,
+// so every combination compiles to its own branchless loop. The add and
+// scale entry points pick a functor from the value: values whose result
+// does not depend on the pixel become a fill, identities a plain copy and
+// power-of-two scales a shift. Both copy the other two channels through,
+// so out holds the whole result even when it is a separate image.
+
+struct SaturatingAdd {
+    int value;
+    unsigned char operator()(unsigned char in) const {
+        int temp = int(in) + value;
+        temp = temp < 0 ? 0 : temp;
+        return (unsigned char)(temp > 255 ? 255 : temp);
+    }
+};
+
+// Same wrap-around as the original int conversion for huge factors.
+struct SaturatingScale {
+    unsigned int value;
+    unsigned char operator()(unsigned char in) const {
+        int temp = in * value;
+        return (unsigned char)(temp > 255 ? 255 : temp);
+    }
+};
+
+struct SaturatingShift {
+    unsigned int shift;
+    unsigned char operator()(unsigned char in) const {
+        unsigned int temp = (unsigned int)in << shift;
+        return (unsigned char)(temp > 255 ? 255 : temp);
+    }
+};
+
+struct Constant {
+    unsigned char value;
+    unsigned char operator()(unsigned char) const {
+        return value;
+    }
+};
+
+template <class T, unsigned char T::*Channel, class Operation>
+static void mapChannel(const T* in, T* out, size_t count, Operation operation) {
+    for (size_t i = 0; i < count; i++) {
+        T pixel = in[i];
+        pixel.*Channel = operation(pixel.*Channel);
+        out[i] = pixel;
+    }
+}
+
+template <class T, unsigned char T::*Channel>
+static void broadcastChannel(const T* in, T* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        T pixel = in[i];
+        unsigned char value = pixel.*Channel;
+        pixel.blue = value;
+        pixel.green = value;
+        pixel.red = value;
+        out[i] = pixel;
+    }
+}
+
+template <class T>
+static void copyPixels(const T* in, T* out, size_t count) {
+    if (in != out) {
+        memcpy(out, in, count * sizeof(T));
+    }
+}
+
+template <class T, unsigned char T::*Channel>
+static void addChannel(const T* in, int value, T* out, size_t count) {
+    if (value == 0) {
+        copyPixels(in, out, count);
+    }
+    else if (value >= 255 || value <= -255) {
+        Constant fill = {(unsigned char)(value > 0 ? 255 : 0)};
+        mapChannel<T, Channel>(in, out, count, fill);
+    }
+    else {
+        SaturatingAdd add = {value};
+        mapChannel<T, Channel>(in, out, count, add);
+    }
+}
+
+template <class T, unsigned char T::*Channel>
+static void scaleChannel(const T* in, unsigned int value, T* out, size_t count) {
+    if (value == 1) {
+        copyPixels(in, out, count);
+    }
+    else if (value == 0) {
+        Constant fill = {0};
+        mapChannel<T, Channel>(in, out, count, fill);
+    }
+    else if (value <= 128 && (value & (value - 1)) == 0) {
+        unsigned int shift = 0;
+        while ((1u << shift) < value) {
+            shift++;
+        }
+        SaturatingShift scale = {shift};
+        mapChannel<T, Channel>(in, out, count, scale);
+    }
+    else {
+        SaturatingScale scale = {value};
+        mapChannel<T, Channel>(in, out, count, scale);
+    }
+}
+
+void onlyredPixels(const Pixel* in, Pixel* out, size_t count) {
+    broadcastChannel<Pixel, &Pixel::red>(in, out, count);
+}
+
+void onlygreenPixels(const Pixel* in, Pixel* out, size_t count) {
+    broadcastChannel<Pixel, &Pixel::green>(in, out, count);
+}
+
+void onlybluePixels(const Pixel* in, Pixel* out, size_t count) {
+    broadcastChannel<Pixel, &Pixel::blue>(in, out, count);
+}
+
+void addredPixels(const Pixel* in, int value, Pixel* out, size_t count) {
+    addChannel<Pixel, &Pixel::red>(in, value, out, count);
+}
+
+void addgreenPixels(const Pixel* in, int value, Pixel* out, size_t count) {
+    addChannel<Pixel, &Pixel::green>(in, value, out, count);
+}
+
+void addbluePixels(const Pixel* in, int value, Pixel* out, size_t count) {
+    addChannel<Pixel, &Pixel::blue>(in, value, out, count);
+}
+
+void scaleredPixels(const Pixel* in, unsigned int value, Pixel* out, size_t count) {
+    scaleChannel<Pixel, &Pixel::red>(in, value, out, count);
+}
+
+void scalegreenPixels(const Pixel* in, unsigned int value, Pixel* out, size_t count) {
+    scaleChannel<Pixel, &Pixel::green>(in, value, out, count);
+}
+
+void scalebluePixels(const Pixel* in, unsigned int value, Pixel* out, size_t count) {
+    scaleChannel<Pixel, &Pixel::blue>(in, value, out, count);
+}
+
+void onlyredPixels(const AlphaPixel* in, AlphaPixel* out, size_t count) {
+    broadcastChannel<AlphaPixel, &AlphaPixel::red>(in, out, count);
+}
+
+void onlygreenPixels(const AlphaPixel* in, AlphaPixel* out, size_t count) {
+    broadcastChannel<AlphaPixel, &AlphaPixel::green>(in, out, count);
+}
+
+void onlybluePixels(const AlphaPixel* in, AlphaPixel* out, size_t count) {
+    broadcastChannel<AlphaPixel, &AlphaPixel::blue>(in, out, count);
+}
+
+void addredPixels(const AlphaPixel* in, int value, AlphaPixel* out, size_t count) {
+    addChannel<AlphaPixel, &AlphaPixel::red>(in, value, out, count);
+}
+
+void addgreenPixels(const AlphaPixel* in, int value, AlphaPixel* out, size_t count) {
+    addChannel<AlphaPixel, &AlphaPixel::green>(in, value, out, count);
+}
+
+void addbluePixels(const AlphaPixel* in, int value, AlphaPixel* out, size_t count) {
+    addChannel<AlphaPixel, &AlphaPixel::blue>(in, value, out, count);
+}
+
+void scaleredPixels(const AlphaPixel* in, unsigned int value, AlphaPixel* out, size_t count) {
+    scaleChannel<AlphaPixel, &AlphaPixel::red>(in, value, out, count);
+}
+
+void scalegreenPixels(const AlphaPixel* in, unsigned int value, AlphaPixel* out, size_t count) {
+    scaleChannel<AlphaPixel, &AlphaPixel::green>(in, value, out, count);
+}
+
+void scalebluePixels(const AlphaPixel* in, unsigned int value, AlphaPixel* out, size_t count) {
+    scaleChannel<AlphaPixel, &AlphaPixel::blue>(in, value, out, count);
+}
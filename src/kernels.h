@@ -0,0 +1,133 @@
+#ifndef kernels_h
+#define kernels_h
+
+#include <cstddef>
+#include "tgaimage.h"
+
+// Per-range pixel kernels behind the Picture methods. Each one works on
+// [0, count) of plain pixel arrays so callers can run them over a whole
+// image or over one block at a time; out may alias the first input.
+// Kernels that move or edit whole pixels come in the three layouts:
+// Pixel, AlphaPixel (alpha carried along) and bytes of a gray image.
+
+// Blend modes
+void multiplyPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count);
+void subtractPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count);
+void overlayPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count);
+void screenPixels(const Pixel* top, const Pixel* bot, Pixel* out, size_t count);
+void combinePixels(const Pixel* red, const Pixel* green, const Pixel* blue, Pixel* out, size_t count);
+
+// Coverage of a bottom layer with alpha. Where its alpha is a, the result
+// is a/255 of the way from the top pixel to the plain blend, rounded like
+// the blend kernels: cover* take the top in out and the plain blend in
+// blended (bytes for a single plane), blendCovered runs blend into a
+// scratch block first. out may alias top.
+typedef void (*PixelBlend)(const Pixel* top, const Pixel* bot, Pixel* out, size_t count);
+void coverPixels(const Pixel* blended, const unsigned char* alpha, Pixel* out, size_t count);
+void coverBytes(const unsigned char* blended, const unsigned char* alpha, unsigned char* out, size_t count);
+void blendCovered(PixelBlend blend, const Pixel* top, const Pixel* bot, const unsigned char* alpha,
+                  Pixel* out, size_t count);
+
+// Blends against pixels [begin, begin + count) of a bottom layer in any
+// layout: a gray one stands for three equal channels and a BGRA one
+// covers the top by its alpha. AlphaPixel and gray tops run the byte
+// kernels over whole pixels; the outcome keeps the top's alpha. The gray
+// overload needs a gray bottom.
+enum BlendMode {
+    BLEND_MULTIPLY,
+    BLEND_SUBTRACT,
+    BLEND_OVERLAY,
+    BLEND_SCREEN
+};
+void blendPixels(BlendMode mode, const Pixel* top, const ImageView& bot, size_t begin, Pixel* out, size_t count);
+void blendPixels(BlendMode mode, const AlphaPixel* top, const ImageView& bot, size_t begin, AlphaPixel* out,
+                 size_t count);
+void blendPixels(BlendMode mode, const unsigned char* top, const ImageView& bot, size_t begin, unsigned char* out,
+                 size_t count);
+// combine with the green and blue layers in any layout; the outcome keeps
+// the red layer's alpha.
+void combinePixels(const Pixel* red, const ImageView& green, const ImageView& blue, size_t begin, Pixel* out,
+                   size_t count);
+void combinePixels(const AlphaPixel* red, const ImageView& green, const ImageView& blue, size_t begin,
+                   AlphaPixel* out, size_t count);
+
+// Geometry. flip is a 180 degree rotation: pixel i swaps with count-1-i.
+// swapMirrored does the pairs whose lower index is in [begin, end), so
+// disjoint ranges of [0, count / 2) can be flipped in parallel.
+void flipPixels(Pixel* pixels, size_t count);
+void swapMirrored(Pixel* pixels, size_t count, size_t begin, size_t end);
+void swapMirrored(AlphaPixel* pixels, size_t count, size_t begin, size_t end);
+void swapMirrored(unsigned char* pixels, size_t count, size_t begin, size_t end);
+// Out-of-place flip of out[begin, end): out[i] = in[count - 1 - i].
+void copyMirrored(const Pixel* in, Pixel* out, size_t count, size_t begin, size_t end);
+void copyMirrored(const AlphaPixel* in, AlphaPixel* out, size_t count, size_t begin, size_t end);
+void copyMirrored(const unsigned char* in, unsigned char* out, size_t count, size_t begin, size_t end);
+
+// Shape-changing geometry, for each layout (a single plane being bytes).
+// Each call covers rows [rowBegin, rowEnd) of a width x height input, so
+// disjoint row ranges can run in parallel. Rows are stored bottom first,
+// as in the file.
+//
+// transpose, rotate90 (clockwise) and rotate270 (counterclockwise) write
+// a height x width image to out, which must not alias in. They go through
+// the input in square tiles so that the column-order writes of a tile
+// stay in cache.
+void transposePixels(const Pixel* in, size_t width, size_t height, Pixel* out, size_t rowBegin, size_t rowEnd);
+void rotate90Pixels(const Pixel* in, size_t width, size_t height, Pixel* out, size_t rowBegin, size_t rowEnd);
+void rotate270Pixels(const Pixel* in, size_t width, size_t height, Pixel* out, size_t rowBegin, size_t rowEnd);
+void transposePixels(const AlphaPixel* in, size_t width, size_t height, AlphaPixel* out,
+                     size_t rowBegin, size_t rowEnd);
+void rotate90Pixels(const AlphaPixel* in, size_t width, size_t height, AlphaPixel* out,
+                    size_t rowBegin, size_t rowEnd);
+void rotate270Pixels(const AlphaPixel* in, size_t width, size_t height, AlphaPixel* out,
+                     size_t rowBegin, size_t rowEnd);
+void transposePixels(const unsigned char* in, size_t width, size_t height, unsigned char* out,
+                     size_t rowBegin, size_t rowEnd);
+void rotate90Pixels(const unsigned char* in, size_t width, size_t height, unsigned char* out,
+                    size_t rowBegin, size_t rowEnd);
+void rotate270Pixels(const unsigned char* in, size_t width, size_t height, unsigned char* out,
+                     size_t rowBegin, size_t rowEnd);
+// Left-right mirror: each row reversed. out may alias in.
+void mirrorRows(const Pixel* in, Pixel* out, size_t width, size_t rowBegin, size_t rowEnd);
+void mirrorRows(const AlphaPixel* in, AlphaPixel* out, size_t width, size_t rowBegin, size_t rowEnd);
+void mirrorRows(const unsigned char* in, unsigned char* out, size_t width, size_t rowBegin, size_t rowEnd);
+// Top-bottom mirror: out row r is in row height - 1 - r. In place (out ==
+// in) rows are swapped pairwise and [rowBegin, rowEnd) must lie in
+// [0, height / 2).
+void flipRows(const Pixel* in, Pixel* out, size_t width, size_t height, size_t rowBegin, size_t rowEnd);
+void flipRows(const AlphaPixel* in, AlphaPixel* out, size_t width, size_t height, size_t rowBegin, size_t rowEnd);
+void flipRows(const unsigned char* in, unsigned char* out, size_t width, size_t height,
+              size_t rowBegin, size_t rowEnd);
+// Copies the width-wide window at column x of input rows y + rowBegin to
+// y + rowEnd into out, which is packed at that width. Rows are moved with
+// memmove in ascending order, so cropping in place (out == in) is safe
+// when the whole range runs in one call.
+void cropRows(const Pixel* in, size_t inWidth, Pixel* out, size_t x, size_t y, size_t width,
+              size_t rowBegin, size_t rowEnd);
+void cropRows(const AlphaPixel* in, size_t inWidth, AlphaPixel* out, size_t x, size_t y, size_t width,
+              size_t rowBegin, size_t rowEnd);
+void cropRows(const unsigned char* in, size_t inWidth, unsigned char* out, size_t x, size_t y, size_t width,
+              size_t rowBegin, size_t rowEnd);
+
+// Channel operations. The AlphaPixel versions leave alpha as it is.
+void onlyredPixels(const Pixel* in, Pixel* out, size_t count);
+void onlygreenPixels(const Pixel* in, Pixel* out, size_t count);
+void onlybluePixels(const Pixel* in, Pixel* out, size_t count);
+void addredPixels(const Pixel* in, int value, Pixel* out, size_t count);
+void addgreenPixels(const Pixel* in, int value, Pixel* out, size_t count);
+void addbluePixels(const Pixel* in, int value, Pixel* out, size_t count);
+void scaleredPixels(const Pixel* in, unsigned int value, Pixel* out, size_t count);
+void scalegreenPixels(const Pixel* in, unsigned int value, Pixel* out, size_t count);
+void scalebluePixels(const Pixel* in, unsigned int value, Pixel* out, size_t count);
+
+void onlyredPixels(const AlphaPixel* in, AlphaPixel* out, size_t count);
+void onlygreenPixels(const AlphaPixel* in, AlphaPixel* out, size_t count);
+void onlybluePixels(const AlphaPixel* in, AlphaPixel* out, size_t count);
+void addredPixels(const AlphaPixel* in, int value, AlphaPixel* out, size_t count);
+void addgreenPixels(const AlphaPixel* in, int value, AlphaPixel* out, size_t count);
+void addbluePixels(const AlphaPixel* in, int value, AlphaPixel* out, size_t count);
+void scaleredPixels(const AlphaPixel* in, unsigned int value, AlphaPixel* out, size_t count);
+void scalegreenPixels(const AlphaPixel* in, unsigned int value, AlphaPixel* out, size_t count);
+void scalebluePixels(const AlphaPixel* in, unsigned int value, AlphaPixel* out, size_t count);
+
+#endif
@@ -0,0 +1,280 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "lut.h"
+
+using namespace std;
+
+ChannelLut::ChannelLut() {
+    for (int c = 0; c < 3; c++) {
+        source[c] = c;
+        identity[c] = true;
+        for (int v = 0; v < 256; v++) {
+            table[c][v] = (unsigned char)v;
+        }
+    }
+}
+
+static bool tableIsIdentity(const unsigned char* table) {
+    for (int v = 0; v < 256; v++) {
+        if (table[v] != v) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChannelLut::isIdentity() const {
+    for (int c = 0; c < 3; c++) {
+        if (source[c] != c || !identity[c]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChannelLut::isUniform() const {
+    return memcmp(table[0], table[1], 256) == 0 && memcmp(table[0], table[2], 256) == 0;
+}
+
+void ChannelLut::map(int channel, const unsigned char* function) {
+    for (int v = 0; v < 256; v++) {
+        table[channel][v] = function[table[channel][v]];
+    }
+    identity[channel] = tableIsIdentity(table[channel]);
+}
+
+void ChannelLut::mapAll(const unsigned char* function) {
+    for (int c = 0; c < 3; c++) {
+        map(c, function);
+    }
+}
+
+// The per-value functions below match the scalar kernels exactly,
+// including how they clamp.
+
+void ChannelLut::add(int channel, int value) {
+    unsigned char function[256];
+    for (int v = 0; v < 256; v++) {
+        int temp = v + value;
+        if (temp > 255) {
+            temp = 255;
+        }
+        else if (temp < 0) {
+            temp = 0;
+        }
+        function[v] = (unsigned char)temp;
+    }
+    map(channel, function);
+}
+
+void ChannelLut::scale(int channel, unsigned int value) {
+    unsigned char function[256];
+    for (int v = 0; v < 256; v++) {
+        int temp = v * value;
+        if (temp > 255) {
+            temp = 255;
+        }
+        function[v] = (unsigned char)temp;
+    }
+    map(channel, function);
+}
+
+void ChannelLut::only(int channel) {
+    int from = source[channel];
+    bool routedIdentity = identity[channel];
+    unsigned char routed[256];
+    memcpy(routed, table[channel], sizeof(routed));
+    for (int c = 0; c < 3; c++) {
+        source[c] = from;
+        identity[c] = routedIdentity;
+        memcpy(table[c], routed, sizeof(routed));
+    }
+}
+
+void ChannelLut::gamma(double value) {
+    unsigned char function[256];
+    for (int v = 0; v < 256; v++) {
+        double corrected = 255.0 * pow(v / 255.0, 1.0 / value);
+        function[v] = (unsigned char)(corrected + 0.5);
+    }
+    mapAll(function);
+}
+
+void ChannelLut::levels(int black, int white) {
+    unsigned char function[256];
+    for (int v = 0; v < 256; v++) {
+        double stretched = (double)(v - black) * 255.0 / (white - black);
+        if (stretched < 0) {
+            stretched = 0;
+        }
+        else if (stretched > 255) {
+            stretched = 255;
+        }
+        function[v] = (unsigned char)(stretched + 0.5);
+    }
+    mapAll(function);
+}
+
+// Piecewise-linear curve through "in:out" control points separated by
+// commas, e.g. "0:0,64:40,255:255". Inputs outside the first and last
+// point hold their value.
+bool ChannelLut::curves(const string& points) {
+    vector<int> xs;
+    vector<int> ys;
+    size_t start = 0;
+    while (start <= points.size()) {
+        size_t end = points.find(',', start);
+        if (end == string::npos) {
+            end = points.size();
+        }
+        string point = points.substr(start, end - start);
+        size_t colon = point.find(':');
+        if (colon == string::npos) {
+            return false;
+        }
+        char* rest;
+        long x = strtol(point.c_str(), &rest, 10);
+        if (rest != point.c_str() + colon) {
+            return false;
+        }
+        long y = strtol(point.c_str() + colon + 1, &rest, 10);
+        if (*rest != '\0' || colon + 1 == point.size()) {
+            return false;
+        }
+        if (x < 0 || x > 255 || y < 0 || y > 255 || (!xs.empty() && x <= xs.back())) {
+            return false;
+        }
+        xs.push_back((int)x);
+        ys.push_back((int)y);
+        start = end + 1;
+    }
+
+    unsigned char function[256];
+    size_t segment = 0;
+    for (int v = 0; v < 256; v++) {
+        while (segment + 1 < xs.size() && v > xs[segment + 1]) {
+            segment++;
+        }
+        double y;
+        if (v <= xs.front()) {
+            y = ys.front();
+        }
+        else if (v >= xs.back()) {
+            y = ys.back();
+        }
+        else {
+            double t = (double)(v - xs[segment]) / (xs[segment + 1] - xs[segment]);
+            y = ys[segment] + t * (ys[segment + 1] - ys[segment]);
+        }
+        function[v] = (unsigned char)(y + 0.5);
+    }
+    mapAll(function);
+    return true;
+}
+
+// Interleaved pixels of stride bytes, the channels first; any bytes after
+// them (alpha) are copied through.
+template <size_t Stride>
+static void applyInterleaved(const ChannelLut& lut, const unsigned char* src, unsigned char* dst, size_t count) {
+    const unsigned char* blue = lut.table[CHANNEL_BLUE];
+    const unsigned char* green = lut.table[CHANNEL_GREEN];
+    const unsigned char* red = lut.table[CHANNEL_RED];
+
+    for (size_t c = 3; c < Stride && src != dst; c++) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i * Stride + c] = src[i * Stride + c];
+        }
+    }
+
+    if (lut.source[0] == 0 && lut.source[1] == 1 && lut.source[2] == 2) {
+        // Unrouted: channels the run never touched are skipped entirely.
+        for (int c = 0; c < 3; c++) {
+            if (lut.identity[c]) {
+                if (src != dst) {
+                    for (size_t i = 0; i < count; i++) {
+                        dst[i * Stride + c] = src[i * Stride + c];
+                    }
+                }
+                continue;
+            }
+            const unsigned char* t = lut.table[c];
+            for (size_t i = 0; i < count; i++) {
+                dst[i * Stride + c] = t[src[i * Stride + c]];
+            }
+        }
+        return;
+    }
+
+    int sb = lut.source[0];
+    int sg = lut.source[1];
+    int sr = lut.source[2];
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* p = src + i * Stride;
+        unsigned char b = blue[p[sb]];
+        unsigned char g = green[p[sg]];
+        unsigned char r = red[p[sr]];
+        dst[i * Stride] = b;
+        dst[i * Stride + 1] = g;
+        dst[i * Stride + 2] = r;
+    }
+}
+
+void ChannelLut::apply(const Pixel* in, Pixel* out, size_t count) const {
+    applyInterleaved<3>(*this, reinterpret_cast<const unsigned char*>(in), reinterpret_cast<unsigned char*>(out),
+                        count);
+}
+
+void ChannelLut::apply(const AlphaPixel* in, AlphaPixel* out, size_t count) const {
+    applyInterleaved<4>(*this, reinterpret_cast<const unsigned char*>(in), reinterpret_cast<unsigned char*>(out),
+                        count);
+}
+
+void ChannelLut::applyPlanar(unsigned char* const planes[3], size_t count) const {
+    // Routed planes go first, while the plane they read still holds its
+    // input values. Routing only ever comes from only*, which points every
+    // output at one channel that reads itself, so that order is enough.
+    for (int c = 0; c < 3; c++) {
+        if (source[c] == c) {
+            continue;
+        }
+        const unsigned char* from = planes[source[c]];
+        const unsigned char* t = table[c];
+        if (identity[c]) {
+            memcpy(planes[c], from, count);
+            continue;
+        }
+        for (size_t i = 0; i < count; i++) {
+            planes[c][i] = t[from[i]];
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        if (source[c] != c || identity[c]) {
+            continue;
+        }
+        unsigned char* plane = planes[c];
+        const unsigned char* t = table[c];
+        for (size_t i = 0; i < count; i++) {
+            plane[i] = t[plane[i]];
+        }
+    }
+}
+
+void ChannelLut::applyGray(unsigned char* plane, size_t count) const {
+    applyGray(plane, plane, count);
+}
+
+void ChannelLut::applyGray(const unsigned char* in, unsigned char* out, size_t count) const {
+    if (identity[0]) {
+        if (in != out) {
+            memcpy(out, in, count);
+        }
+        return;
+    }
+    const unsigned char* t = table[0];
+    for (size_t i = 0; i < count; i++) {
+        out[i] = t[in[i]];
+    }
+}
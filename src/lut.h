@@ -0,0 +1,58 @@
+#ifndef lut_h
+#define lut_h
+
+#include <cstddef>
+#include <string>
+#include "tgaimage.h"
+using namespace std;
+
+// Channel indices in Pixel byte order.
+const int CHANNEL_BLUE = 0;
+const int CHANNEL_GREEN = 1;
+const int CHANNEL_RED = 2;
+
+// Composable per-channel lookup tables. Output channel c of a pixel is
+// table[c][in[source[c]]]: source is the channel routing (only* points
+// every output at one input channel) and each table is the composition of
+// every point operation applied to that channel so far. Any run of add*,
+// scale*, only*, gamma, levels and curves collapses into one ChannelLut and
+// costs one lookup per byte however long the run is.
+class ChannelLut{
+    public:
+        unsigned char table[3][256];
+        int source[3];
+        // Whether table[c] maps every value to itself, kept up to date by
+        // map and only so apply does not rescan the tables per block.
+        bool identity[3];
+
+        ChannelLut();
+
+        bool isIdentity() const;
+        // Whether every channel goes through the same table. On a pixel
+        // whose channels are equal the routing then makes no difference,
+        // so one gray plane stands for all three.
+        bool isUniform() const;
+
+        // Compose a function of one channel value after the current table.
+        void map(int channel, const unsigned char* function);
+        void mapAll(const unsigned char* function);
+
+        void add(int channel, int value);
+        void scale(int channel, unsigned int value);
+        void only(int channel);
+        void gamma(double value);
+        void levels(int black, int white);
+        bool curves(const string& points);
+
+        // Interleaved pixels; AlphaPixel keeps its alpha.
+        void apply(const Pixel* in, Pixel* out, size_t count) const;
+        void apply(const AlphaPixel* in, AlphaPixel* out, size_t count) const;
+        // In place over three channel planes (blue, green, red).
+        void applyPlanar(unsigned char* const planes[3], size_t count) const;
+        // Over the one plane of a gray image, in place or into out; needs
+        // isUniform.
+        void applyGray(unsigned char* plane, size_t count) const;
+        void applyGray(const unsigned char* in, unsigned char* out, size_t count) const;
+};
+
+#endif
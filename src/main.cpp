@@ -3,47 +3,58 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
+#include <sys/stat.h>
 #include "tgaimage.h"
+#include "tgaio.h"
+#include "pipeline.h"
+#include "cpu.h"
+#include "threadpool.h"
+#include "batch.h"
+#include "stream.h"
+#include "profile.h"
+#include "memo.h"
+#include "server.h"
+#include "filter.h"
+#include "resize.h"
+#include "compare.h"
 using namespace std;
 
 void helpMessage() {
     cout << "Project 2: Image Processing, Fall 2024\n" << endl;
     cout << "Usage:" << endl;
-    cout << "\t./project2.out [output] [firstImage] [method] [...]" << endl;
+    cout << "\t./project2.out [options] [output] [firstImage] [method] [...]" << endl;
+    cout << "\t./project2.out [options] --batch [manifest] [method] [...]" << endl;
+    cout << "\t./project2.out [options] --batch-dir [inputDir] [outputDir] [method] [...]" << endl;
+    cout << "\t./project2.out [options] --serve [socket]" << endl;
+    cout << "\t./project2.out [options] --client [socket] [output] [firstImage] [method] [...]" << endl;
+    cout << "\t./project2.out [options] --compare [expected] [actual]  (two images or two directories)" << endl;
+    cout << "Options:" << endl;
+    cout << "\t--mmap\t\tuse operand images straight from a read-only file mapping" << endl;
+    cout << "\t--rle, --raw\t\twrite run-length encoded (type 10 or 11) or uncompressed output" << endl;
+    cout << "\t--gray\t\twrite the results of onlyred, onlygreen and onlyblue as 8-bit grayscale" << endl;
+    cout << "\t--stream\t\tprocess in row bands with constant memory (point methods and flip)" << endl;
+    cout << "\t--band-rows N\trows per band for --stream" << endl;
+    cout << "\t--cache DIR\t\tkeep decoded operand images in DIR for later runs" << endl;
+    cout << "\t--cache-size MB\tlimit the cache directory, least recently used go first (default 1024)" << endl;
+    cout << "\t--memo\t\tstore intermediate results in the --cache directory and resume from the longest shared prefix" << endl;
+    cout << "\t--planar\t\tprocess images as separate blue/green/red planes" << endl;
+    cout << "\t--edge MODE\tborder handling of boxblur, gaussian and sharpen: clamp, mirror, wrap or black" << endl;
+    cout << "\t--batch-memory MB\tlimit decoded images in flight during a batch" << endl;
+    cout << "\t--strict\t\tcompare stops at the first differing pixel" << endl;
+    cout << "\t--diff-image PATH\twrite the differences found by --compare (a directory for directories)" << endl;
+    cout << "\t--profile\t\tprint time, I/O and allocations per stage (build with make profile)" << endl;
+    cout << "\t--profile-json FILE\talso write the profile as JSON" << endl;
+    cout << "\t--resident-memory MB\tdecoded operand layers a server keeps between requests (default 512)" << endl;
+    cout << "\t--requests N\tsend the client request N times and report latency" << endl;
+    cout << "\t--fork\t\tclient runs a new process per request instead, for comparison" << endl;
+    cout << "\t--threads N\twork on N threads (default: hardware concurrency)" << endl;
+    cout << "\t--isa LEVEL\tforce the blend kernels to scalar, sse2, avx2 or avx512 (also PROJECT2_ISA)" << endl;
 }
 
-bool validOutputFileName(const string& name) {
-    if (name.size() < 4 || name.substr(name.size() - 4) != ".tga") {
-        cout << "Invalid file name." << endl;
-        return false;
-    }
-    return true;
-}
-
-bool validFileName(const string& name) {
-    if (name.size() < 4 || name.substr(name.size() - 4) != ".tga") {
-        cout << "Invalid argument, invalid file name." << endl;
-        return false;
-    }
-    ifstream file(name, ios::binary);
-    if (!file.is_open()) {
-        cout << "Invalid argument, file does not exist." << endl;
-        return false;
-    }
-    return true;
-}
-
-bool isInt(const string& value) {
-    try {
-        stoi(value);
-        return true;
-    } catch (invalid_argument&) {
-        return false;
-    }
-}
-
-bool readInitialImage(const string& fileName, Picture& image) {
+bool initialImageExists(const string& fileName) {
+    PROFILE_SCOPE("validate", fileName);
     // Check file extension
     if (fileName.size() < 4 || fileName.substr(fileName.size() - 4) != ".tga") {
         cout << "Invalid file name." << endl;
@@ -52,29 +63,194 @@ bool readInitialImage(const string& fileName, Picture& image) {
 
     // Check if file exists
     ifstream file(fileName, ios::binary);
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
     if (!file.is_open()) {
         cout << "File does not exist." << endl;
         return false;
     }
     file.close();  // Close file after checking
-
-    // Attempt to read image data
-    image.readData(fileName, image);
     return true;
 }
 
-// Assuming Picture and tgaimage functionalities are defined elsewhere
 Picture trackingImage;
-Picture top;
-Picture bot;
-Picture outcome;
-Picture red;
-Picture blue;
-Picture green;
-Picture first;
-int value;
+PlanarPicture planarImage;
+OperandStore operands;
+Batch batch;
+bool batchMode = false;
+bool planarLayout = false;
+bool streamMode = false;
+bool memoMode = false;
+PrefixMemo memo;
+Server server;
+string clientSocket;
+size_t clientRequests = 1;
+bool clientFork = false;
+StreamRunner streamRunner;
+char outputType = 0;
+EdgeMode edgeMode = EDGE_CLAMP;
+bool grayOutput = false;
+Comparison comparison;
+string compareExpected;
+string compareActual;
 
 int main(int argc, char* argv[]) {
+    int argStart = 1;
+    while (argStart < argc) {
+        string option = argv[argStart];
+        if (option == "--mmap") {
+            operands.mapFiles = true;
+        }
+        else if (option == "--rle" || option == "--raw") {
+            outputType = option == "--rle" ? TGA_TRUECOLOR_RLE : TGA_TRUECOLOR;
+            batch.outputType = outputType;
+        }
+        else if (option == "--gray") {
+            grayOutput = true;
+            server.grayOutput = true;
+        }
+        else if (option == "--stream") {
+            streamMode = true;
+        }
+        else if (option == "--band-rows" && argStart + 1 < argc) {
+            string rows = argv[++argStart];
+            if (!isInt(rows) || stoi(rows) < 1) {
+                cout << "Invalid argument, --band-rows expects a positive number." << endl;
+                return 1;
+            }
+            streamRunner.bandRows = stoi(rows);
+        }
+        else if (option == "--cache" && argStart + 1 < argc) {
+            operands.cache.directory = argv[++argStart];
+        }
+        else if (option == "--cache-size" && argStart + 1 < argc) {
+            string megabytes = argv[++argStart];
+            if (!isInt(megabytes) || stoi(megabytes) < 1) {
+                cout << "Invalid argument, --cache-size expects a positive number." << endl;
+                return 1;
+            }
+            operands.cache.limit = (size_t)stoi(megabytes) * 1024 * 1024;
+        }
+        else if (option == "--serve" && argStart + 1 < argc) {
+            server.socketPath = argv[++argStart];
+        }
+        else if (option == "--client" && argStart + 1 < argc) {
+            clientSocket = argv[++argStart];
+        }
+        else if ((option == "--requests" || option == "--resident-memory") && argStart + 1 < argc) {
+            string count = argv[++argStart];
+            if (!isInt(count) || stoi(count) < 1) {
+                cout << "Invalid argument, " << option << " expects a positive number." << endl;
+                return 1;
+            }
+            if (option == "--requests") {
+                clientRequests = stoi(count);
+            }
+            else {
+                server.operands.limit = (size_t)stoi(count) * 1024 * 1024;
+            }
+        }
+        else if (option == "--fork") {
+            clientFork = true;
+        }
+        else if (option == "--memo") {
+            memoMode = true;
+        }
+        else if (option == "--planar") {
+            planarLayout = true;
+            batch.planar = true;
+        }
+        else if (option == "--edge" && argStart + 1 < argc) {
+            if (!parseEdgeMode(argv[++argStart], edgeMode)) {
+                cout << "Invalid argument, --edge expects clamp, mirror, wrap or black." << endl;
+                return 1;
+            }
+            server.edge = edgeMode;
+        }
+        else if (option == "--batch" && argStart + 1 < argc) {
+            if (!batch.readManifest(argv[++argStart])) {
+                return 1;
+            }
+            batchMode = true;
+        }
+        else if (option == "--batch-dir" && argStart + 2 < argc) {
+            if (!batch.scanDirectory(argv[argStart + 1], argv[argStart + 2])) {
+                return 1;
+            }
+            argStart += 2;
+            batchMode = true;
+        }
+        else if (option == "--compare" && argStart + 2 < argc) {
+            compareExpected = argv[argStart + 1];
+            compareActual = argv[argStart + 2];
+            argStart += 2;
+        }
+        else if (option == "--strict") {
+            comparison.strict = true;
+        }
+        else if (option == "--diff-image" && argStart + 1 < argc) {
+            comparison.diffPath = argv[++argStart];
+        }
+        else if (option == "--batch-memory" && argStart + 1 < argc) {
+            string megabytes = argv[++argStart];
+            if (!isInt(megabytes) || stoi(megabytes) < 1) {
+                cout << "Invalid argument, --batch-memory expects a positive number." << endl;
+                return 1;
+            }
+            batch.memoryLimit = (size_t)stoi(megabytes) * 1024 * 1024;
+        }
+        else if (option == "--profile" || (option == "--profile-json" && argStart + 1 < argc)) {
+            if (!enableProfile(option == "--profile" ? "" : argv[++argStart])) {
+                return 1;
+            }
+        }
+        else if (option == "--threads" && argStart + 1 < argc) {
+            string count = argv[++argStart];
+            if (!isInt(count) || stoi(count) < 1) {
+                cout << "Invalid argument, --threads expects a positive number." << endl;
+                return 1;
+            }
+            setThreadCount(stoi(count));
+        }
+        else if (option == "--isa" && argStart + 1 < argc) {
+            if (!forceIsa(argv[++argStart])) {
+                return 1;
+            }
+        }
+        else {
+            break;
+        }
+        argStart++;
+    }
+    argc -= argStart - 1;
+    argv += argStart - 1;
+    PROFILE_SCOPE("run", "total");
+
+    if (!compareExpected.empty()) {
+        struct stat info;
+        if (stat(compareExpected.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+            return comparison.compareDirectories(compareExpected, compareActual) ? 0 : 1;
+        }
+        return comparison.compareFiles(compareExpected, compareActual) ? 0 : 1;
+    }
+    if (!server.socketPath.empty()) {
+        server.outputType = outputType;
+        return server.run() ? 0 : 1;
+    }
+    if (!clientSocket.empty() || clientFork) {
+        vector<string> args(argv + 1, argv + argc);
+        return runClient(clientSocket, args, clientRequests, clientFork) ? 0 : 1;
+    }
+
+    if (batchMode) {
+        Pipeline pipeline;
+        pipeline.edge = edgeMode;
+        pipeline.grayOutput = grayOutput;
+        if (!pipeline.parse(argc, argv, 1)) {
+            return 1;
+        }
+        return batch.run(pipeline, operands) == 0 ? 0 : 1;
+    }
+
     if (argc <= 1 || string(argv[1]) == "--help") {
         helpMessage();
         return 0;
@@ -86,87 +262,86 @@ int main(int argc, char* argv[]) {
     }
 
     // Validate and read initial tracking image
-    if (argc < 3 || !readInitialImage(argv[2], trackingImage)) {
+    if (argc < 3) {
         return 0;
     }
-    
-    int index = 3;
-    while (index < argc) {
-        string method = argv[index];
-
-        if (method.size() >= 5 && !validFileName(argv[index]) &&
-            method != "multiply" && method != "subtract" && method != "overlay" &&
-            method != "screen" && method != "combine" && method != "flip" &&
-            method != "onlyred" && method != "onlygreen" && method != "onlyblue" &&
-            method != "addred" && method != "addgreen" && method != "addblue" &&
-            method != "scalered" && method != "scalegreen" && method != "scaleblue") {
-            cout << "Invalid method name." << endl;
-            return 0;
+    if (streamMode) {
+        Pipeline pipeline;
+        pipeline.edge = edgeMode;
+        pipeline.grayOutput = grayOutput;
+        if (!initialImageExists(argv[2]) || !pipeline.parse(argc, argv, 3)) {
+            return 1;
         }
-
-        if (method == "multiply" || method == "subtract" || method == "overlay" || method == "screen") {
-            if (index + 1 >= argc) {
-                cout << "Missing argument." << endl;
-                return 0;
-            }
-            if (!validFileName(argv[index + 1])) {
-                return 0;
-            }
-            bot.readData(argv[index + 1], bot);
-            if (method == "multiply") trackingImage.multiply(trackingImage, bot, trackingImage);
-            else if (method == "subtract") trackingImage.subtract(trackingImage, bot, trackingImage);
-            else if (method == "overlay") trackingImage.overlay(trackingImage, bot, trackingImage);
-            else if (method == "screen") trackingImage.screen(trackingImage, bot, trackingImage);
-            cout << "Processing " << method << "..." << endl;
-            index++;
+        streamRunner.outputType = outputType;
+        return streamRunner.run(pipeline, argv[2], argv[1]) ? 0 : 1;
+    }
+    if (memoMode) {
+        if (!operands.cache.enabled() || planarLayout) {
+            cout << "--memo needs --cache DIR and the interleaved layout." << endl;
+            return 1;
         }
-
-        if (method == "combine") {
-            if (index + 2 >= argc) {
-                cout << "Missing argument." << endl;
-                return 0;
-            }
-            if (!validFileName(argv[index + 1]) || !validFileName(argv[index + 2])) {
-                return 0;
-            }
-            green.readData(argv[index + 1], green);
-            blue.readData(argv[index + 2], blue);
-            trackingImage.combine(trackingImage, green, blue, trackingImage);
-            cout << "Combining channels..." << endl;
-            index += 2;
+        Pipeline pipeline;
+        pipeline.edge = edgeMode;
+        pipeline.grayOutput = grayOutput;
+        memo.cache = &operands.cache;
+        if (!initialImageExists(argv[2]) || !pipeline.parse(argc, argv, 3) ||
+            !memo.run(pipeline, argv[2], trackingImage, operands)) {
+            return 1;
+        }
+        if (outputType) {
+            setRunLength(trackingImage, outputType == TGA_TRUECOLOR_RLE);
         }
+        cout << "write" << endl;
+        trackingImage.writeData(argv[1], trackingImage);
+        writePyramid(trackingImage, pipeline.pyramidLevels(), argv[1]);
+        return 0;
+    }
+    if (!initialImageExists(argv[2])) {
+        return 0;
+    }
+    Pipeline pipeline;
+    pipeline.edge = edgeMode;
+    pipeline.grayOutput = grayOutput;
+    if (!pipeline.parse(argc, argv, 3)) {
+        return 1;
+    }
+
+    // Operand layers are read on a background thread while the input image
+    // is read and the stages before them run.
+    // argv[2] was validated before parsing, so it is decoded straight away.
+    pipeline.prefetchOperands(operands, planarLayout);
+    if (planarLayout ? !planarImage.readData(argv[2]) : !trackingImage.readData(argv[2], trackingImage)) {
+        return 0;
+    }
 
-        if (method == "flip" || method == "onlyred" || method == "onlygreen" || method == "onlyblue") {
-            if (method == "flip") trackingImage.flip(trackingImage, trackingImage);
-            else if (method == "onlyred") trackingImage.onlyred(trackingImage, trackingImage);
-            else if (method == "onlygreen") trackingImage.onlygreen(trackingImage, trackingImage);
-            else if (method == "onlyblue") trackingImage.onlyblue(trackingImage, trackingImage);
-            cout << "Processing " << method << "..." << endl;
+    if (planarLayout) {
+        if (!pipeline.execute(planarImage, operands)) {
+            return 1;
+        }
+        if (outputType) {
+            setRunLength(planarImage.header, outputType == TGA_TRUECOLOR_RLE);
         }
+        cout << "write" << endl;
+        thread writer([&] { planarImage.writeData(argv[1]); });
+        operands.clear();
+        writePyramid(planarImage, pipeline.pyramidLevels(), argv[1]);
+        writer.join();
+        return 0;
+    }
 
-        if (method == "addred" || method == "addgreen" || method == "addblue" || method == "scalered" || method == "scalegreen" || method == "scaleblue") {
-            if (index + 1 >= argc) {
-                cout << "Missing argument." << endl;
-                return 1;
-            }
-            if (!isInt(argv[index + 1])) {
-                cout << "Invalid argument, expected number." << endl;
-                return 1;
-            }
-            int value = stoi(argv[index + 1]);
-            if (method == "addred") trackingImage.addred(trackingImage, value, trackingImage);
-            else if (method == "addgreen") trackingImage.addgreen(trackingImage, value, trackingImage);
-            else if (method == "addblue") trackingImage.addblue(trackingImage, value, trackingImage);
-            else if (method == "scalered") trackingImage.scalered(trackingImage, value, trackingImage);
-            else if (method == "scalegreen") trackingImage.scalegreen(trackingImage, value, trackingImage);
-            else if (method == "scaleblue") trackingImage.scaleblue(trackingImage, value, trackingImage);
-            cout << "Adjusting channel with " << method << " by " << value << "..." << endl;
-            index++;
-        }
-        index++;
+    if (!pipeline.execute(trackingImage, operands)) {
+        return 1;
     }
 
+    if (outputType) {
+        setRunLength(trackingImage, outputType == TGA_TRUECOLOR_RLE);
+    }
     cout << "write" << endl;
-    trackingImage.writeData(argv[1], trackingImage);
+    // The operand layers are released and the pyramid levels computed
+    // while the output is written.
+    thread writer([&] { trackingImage.writeData(argv[1], trackingImage); });
+    operands.clear();
+    writePyramid(trackingImage, pipeline.pyramidLevels(), argv[1]);
+    writer.join();
     return 0;
 }
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "memo.h"
+#include "cache.h"
+#include "filter.h"
+#include "profile.h"
+#include "tgaio.h"
+
+using namespace std;
+
+// 128-bit digest from two FNV-1a passes with different offset bases, long
+// enough that prefix keys of any chain length fit in a cache entry.
+static string digest(const string& text) {
+    unsigned long long first = 14695981039346656037ull;
+    unsigned long long second = 0x6c62272e07bb0142ull;
+    for (size_t i = 0; i < text.size(); i++) {
+        first = (first ^ (unsigned char)text[i]) * 1099511628211ull;
+        second = (second ^ (unsigned char)text[i]) * 1099511628211ull;
+        second ^= second >> 29;
+    }
+    char hex[40];
+    snprintf(hex, sizeof(hex), "%016llx%016llx", first, second);
+    return hex;
+}
+
+PrefixMemo::PrefixMemo() {
+    cache = 0;
+}
+
+// keys[i] names the image after the first i methods; keys[0] is the input.
+bool PrefixMemo::prefixKeys(const Pipeline& pipeline, const string& inputPath, vector<string>& keys) const {
+    string chain;
+    if (!fileIdentity(inputPath, chain)) {
+        return false;
+    }
+    keys.clear();
+    keys.push_back("state " + digest(chain));
+    for (size_t i = 0; i < pipeline.operations.size(); i++) {
+        const Operation& operation = pipeline.operations[i];
+        chain += "\n" + operation.name;
+        for (size_t j = 0; j < operation.parameters.size(); j++) {
+            char number[32];
+            snprintf(number, sizeof(number), " %.17g", operation.parameters[j]);
+            chain += number;
+        }
+        if (!operation.text.empty()) {
+            chain += " " + operation.text;
+        }
+        if (operation.type == OP_BOXBLUR || operation.type == OP_GAUSSIAN || operation.type == OP_SHARPEN) {
+            chain += string(" edge ") + edgeModeName(pipeline.edge);
+        }
+        if (pipeline.grayOutput && operation.type >= OP_ONLYRED && operation.type <= OP_ONLYBLUE) {
+            chain += " gray";
+        }
+        for (size_t j = 0; j < operation.operands.size(); j++) {
+            string identity;
+            if (!fileIdentity(operation.operands[j], identity)) {
+                return false;
+            }
+            chain += " [" + identity + "]";
+        }
+        keys.push_back("state " + digest(chain));
+    }
+    return true;
+}
+
+bool PrefixMemo::run(const Pipeline& pipeline, const string& inputPath, Picture& image,
+                     OperandStore& operands) const {
+    PROFILE_SCOPE("memo", inputPath);
+    size_t total = pipeline.operations.size();
+    vector<string> keys;
+    bool usable = cache && cache->enabled() && prefixKeys(pipeline, inputPath, keys);
+
+    // A stored state past a stats method would skip what it prints.
+    size_t latest = total;
+    for (size_t i = 0; i < total; i++) {
+        if (pipeline.operations[i].type == OP_STATS) {
+            latest = i;
+            break;
+        }
+    }
+
+    size_t start = 0;
+    for (size_t i = latest; usable && i > 0; i--) {
+        CachedImage state;
+        if (cache->findKey(keys[i], state)) {
+            ImageView view = state.view();
+            image.copyHeader(state.header);
+            image.allocate(LAYOUT_BGR, view.size());
+            copy(view.pixels, view.pixels + view.size(), image.pixels.begin());
+            if (isGrayscale(image)) {
+                image.reduceGray();
+            }
+            start = i;
+            break;
+        }
+    }
+    if (start == 0 && !image.readData(inputPath, image)) {
+        return false;
+    }
+    // Stored states have no alpha, so a BGRA input is not memoized.
+    usable = usable && image.layout() != LAYOUT_BGRA;
+    if (usable) {
+        if (start > 0) {
+            cout << "Memo hit: resuming after " << start << " of " << total << " methods." << endl;
+        }
+        else {
+            cout << "Memo miss: no stored prefix." << endl;
+        }
+    }
+
+    // Each remaining method runs on its own so that every prefix can be
+    // stored; fusion across them is given up for reuse in later runs.
+    Pipeline step = pipeline;
+    for (size_t i = start; i < total; i++) {
+        step.operations.assign(1, pipeline.operations[i]);
+        if (!step.execute(image, operands)) {
+            return false;
+        }
+        if (usable) {
+            cache->storeKey(keys[i + 1], image);
+        }
+    }
+    if (usable && start < total) {
+        cout << "Memo stored the results of " << total - start << " more methods." << endl;
+    }
+    return true;
+}
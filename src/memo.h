@@ -0,0 +1,30 @@
+#ifndef memo_h
+#define memo_h
+
+#include <string>
+#include <vector>
+#include "pipeline.h"
+using namespace std;
+
+// Memoized pipeline prefixes. The image after the first i methods is
+// stored in the decoded-image cache under a hash of the input file's
+// identity and those i methods (with their arguments and operand files),
+// so a later run sharing that prefix resumes from it instead of starting
+// from the input.
+class PrefixMemo{
+    public:
+        const DecodedCache* cache;
+
+        PrefixMemo();
+
+        // Fills image with the result of pipeline on inputPath, resuming
+        // from the longest stored prefix and storing every prefix it
+        // computes. Reports hits and misses on cout.
+        bool run(const Pipeline& pipeline, const string& inputPath, Picture& image,
+                 OperandStore& operands) const;
+
+    private:
+        bool prefixKeys(const Pipeline& pipeline, const string& inputPath, vector<string>& keys) const;
+};
+
+#endif
@@ -0,0 +1,928 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include "pipeline.h"
+#include "kernels.h"
+#include "threadpool.h"
+#include "blend.h"
+#include "cpu.h"
+#include "profile.h"
+#include "histogram.h"
+#include "filter.h"
+#include "tgaio.h"
+
+using namespace std;
+
+// Pixels per fused block: the tracking block plus up to two operand blocks
+// stay within L1/L2 while every operation of the stage runs over them.
+// Row bands of the image are spread over the thread pool and each band is
+// swept block by block.
+static const size_t FUSED_BLOCK_PIXELS = 4096;
+
+// Arguments after the method name: fileArguments operand files, then one
+// entry per character of parameters ('i' integer, 'f' real, 's' word).
+struct MethodInfo {
+    const char* name;
+    OperationType type;
+    int fileArguments;
+    const char* parameters;
+};
+
+static const MethodInfo methods[] = {
+    {"multiply", OP_MULTIPLY, 1, ""},
+    {"subtract", OP_SUBTRACT, 1, ""},
+    {"overlay", OP_OVERLAY, 1, ""},
+    {"screen", OP_SCREEN, 1, ""},
+    {"combine", OP_COMBINE, 2, ""},
+    {"flip", OP_FLIP, 0, ""},
+    {"onlyred", OP_ONLYRED, 0, ""},
+    {"onlygreen", OP_ONLYGREEN, 0, ""},
+    {"onlyblue", OP_ONLYBLUE, 0, ""},
+    {"addred", OP_ADDRED, 0, "i"},
+    {"addgreen", OP_ADDGREEN, 0, "i"},
+    {"addblue", OP_ADDBLUE, 0, "i"},
+    {"scalered", OP_SCALERED, 0, "i"},
+    {"scalegreen", OP_SCALEGREEN, 0, "i"},
+    {"scaleblue", OP_SCALEBLUE, 0, "i"},
+    {"gamma", OP_GAMMA, 0, "f"},
+    {"levels", OP_LEVELS, 0, "ii"},
+    {"curves", OP_CURVES, 0, "s"},
+    {"mirrorh", OP_MIRRORH, 0, ""},
+    {"mirrorv", OP_MIRRORV, 0, ""},
+    {"transpose", OP_TRANSPOSE, 0, ""},
+    {"rotate90", OP_ROTATE90, 0, ""},
+    {"rotate270", OP_ROTATE270, 0, ""},
+    {"crop", OP_CROP, 0, "iiii"},
+    {"boxblur", OP_BOXBLUR, 0, "i"},
+    {"gaussian", OP_GAUSSIAN, 0, "f"},
+    {"sharpen", OP_SHARPEN, 0, "ff"},
+    {"stats", OP_STATS, 0, ""},
+    {"autolevels", OP_AUTOLEVELS, 0, ""},
+    {"equalize", OP_EQUALIZE, 0, ""},
+    {"resize", OP_RESIZE, 0, "ii"},
+    {"pyramid", OP_PYRAMID, 0, "i"},
+};
+
+static const MethodInfo* findMethod(const string& name) {
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (name == methods[i].name) {
+            return &methods[i];
+        }
+    }
+    return 0;
+}
+
+bool validFileName(const string& name) {
+    PROFILE_SCOPE("validate", name);
+    if (name.size() < 4 || name.substr(name.size() - 4) != ".tga") {
+        cout << "Invalid argument, invalid file name." << endl;
+        return false;
+    }
+    ifstream file(name, ios::binary);
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+    if (!file.is_open()) {
+        cout << "Invalid argument, file does not exist." << endl;
+        return false;
+    }
+    return true;
+}
+
+bool validOutputFileName(const string& name) {
+    if (name.size() < 4 || name.substr(name.size() - 4) != ".tga") {
+        reportMessage("Invalid file name.");
+        return false;
+    }
+    return true;
+}
+
+bool isNumber(const string& value) {
+    char* rest;
+    strtod(value.c_str(), &rest);
+    return !value.empty() && *rest == '\0';
+}
+
+bool isInt(const string& value) {
+    try {
+        stoi(value);
+        return true;
+    } catch (invalid_argument&) {
+        return false;
+    } catch (out_of_range&) {
+        return false;
+    }
+}
+
+// Operation
+
+Operation::Operation() {
+    type = OP_FLIP;
+    value = 0;
+}
+
+Operation::Operation(OperationType t, const string& n) {
+    type = t;
+    name = n;
+    value = 0;
+}
+
+// flip and the operations after curves move pixels around.
+bool Operation::isPointOperation() const {
+    return type != OP_FLIP && type <= OP_CURVES;
+}
+
+bool Operation::isTableOperation() const {
+    return type >= OP_ONLYRED && type <= OP_CURVES;
+}
+
+void Operation::addToTable(ChannelLut& lut) const {
+    switch (type) {
+        case OP_ONLYRED: lut.only(CHANNEL_RED); break;
+        case OP_ONLYGREEN: lut.only(CHANNEL_GREEN); break;
+        case OP_ONLYBLUE: lut.only(CHANNEL_BLUE); break;
+        case OP_ADDRED: lut.add(CHANNEL_RED, value); break;
+        case OP_ADDGREEN: lut.add(CHANNEL_GREEN, value); break;
+        case OP_ADDBLUE: lut.add(CHANNEL_BLUE, value); break;
+        case OP_SCALERED: lut.scale(CHANNEL_RED, value); break;
+        case OP_SCALEGREEN: lut.scale(CHANNEL_GREEN, value); break;
+        case OP_SCALEBLUE: lut.scale(CHANNEL_BLUE, value); break;
+        case OP_GAMMA: lut.gamma(parameters[0]); break;
+        case OP_LEVELS: lut.levels(value, (int)parameters[1]); break;
+        case OP_CURVES: lut.curves(text); break;
+        default: break;
+    }
+}
+
+// OperandStore
+
+OperandStore::OperandStore() {
+    mapFiles = false;
+}
+
+OperandStore::~OperandStore() {
+    clear();
+}
+
+OperandStore::Entry* OperandStore::entry(const string& filePath) {
+    Entry*& found = entries[filePath];
+    if (!found) {
+        found = new Entry;
+        found->interleavedLoaded = false;
+        found->planarLoaded = false;
+        found->pending = false;
+    }
+    return found;
+}
+
+bool OperandStore::load(const string& filePath) {
+    unique_lock<mutex> guard(lock);
+    Entry* found = entry(filePath);
+    loaded.wait(guard, [found] { return !found->pending; });
+    return loadEntry(found, filePath);
+}
+
+bool OperandStore::loadPlanar(const string& filePath) {
+    unique_lock<mutex> guard(lock);
+    Entry* found = entry(filePath);
+    loaded.wait(guard, [found] { return !found->pending; });
+    return loadPlanarEntry(found, filePath);
+}
+
+bool OperandStore::loadEntry(Entry* entry, const string& filePath) {
+    if (!entry->interleavedLoaded) {
+        entry->interleavedLoaded = (mapFiles && entry->mapping.open(filePath)) ||
+                                   cache.find(filePath, false, entry->cached);
+    }
+    if (!entry->interleavedLoaded) {
+        entry->interleavedLoaded = entry->picture.readData(filePath, entry->picture);
+        if (entry->interleavedLoaded) {
+            cache.store(filePath, entry->picture);
+        }
+    }
+    return entry->interleavedLoaded;
+}
+
+bool OperandStore::loadPlanarEntry(Entry* entry, const string& filePath) {
+    if (!entry->planarLoaded) {
+        // Cached planes are copied out once; the mapping is not kept.
+        CachedImage cached;
+        if (cache.find(filePath, true, cached)) {
+            PlanarPicture& planar = entry->planar;
+            planar.header.copyHeader(cached.header);
+            planar.resize(imagePixelCount(cached.header));
+            for (int c = 0; c < 3; c++) {
+                memcpy(planar.planes[c].data(), cached.plane(c), planar.size());
+            }
+            if (isGrayscale(planar.header)) {
+                planar.reduce();
+            }
+            entry->planarLoaded = true;
+        }
+    }
+    if (!entry->planarLoaded) {
+        entry->planarLoaded = entry->planar.readData(filePath);
+        if (entry->planarLoaded) {
+            cache.store(filePath, entry->planar);
+        }
+    }
+    return entry->planarLoaded;
+}
+
+// Entries in flight are marked pending up front, so the map itself is only
+// changed by the calling thread; the loader fills its entries outside the
+// lock and clears pending under it.
+void OperandStore::prefetch(const vector<string>& filePaths, bool planar) {
+    if (loader.joinable()) {
+        loader.join();
+    }
+    vector<pair<string, Entry*> > work;
+    {
+        lock_guard<mutex> guard(lock);
+        for (size_t i = 0; i < filePaths.size(); i++) {
+            Entry* found = entry(filePaths[i]);
+            if (!found->pending && !(planar ? found->planarLoaded : found->interleavedLoaded)) {
+                found->pending = true;
+                work.push_back(make_pair(filePaths[i], found));
+            }
+        }
+    }
+    loader = thread([this, work, planar] {
+        // The loader's reads are recorded here and in its own decode
+        // scopes, not in whatever the main thread has open meanwhile.
+        PROFILE_SCOPE("prefetch", "operands");
+        for (size_t i = 0; i < work.size(); i++) {
+            if (planar) {
+                loadPlanarEntry(work[i].second, work[i].first);
+            }
+            else {
+                loadEntry(work[i].second, work[i].first);
+            }
+            lock_guard<mutex> guard(lock);
+            work[i].second->pending = false;
+            loaded.notify_all();
+        }
+    });
+}
+
+void OperandStore::adopt(const string& filePath, const shared_ptr<const Picture>& picture) {
+    Entry* found = entry(filePath);
+    found->shared = picture;
+    found->interleavedLoaded = true;
+}
+
+ImageView OperandStore::get(const string& filePath) const {
+    map<string, Entry*>::const_iterator found = entries.find(filePath);
+    if (found == entries.end() || !found->second->interleavedLoaded) {
+        return ImageView();
+    }
+    if (found->second->mapping.isOpen()) {
+        return found->second->mapping.view();
+    }
+    if (found->second->cached.isOpen()) {
+        return found->second->cached.view();
+    }
+    if (found->second->shared) {
+        return ImageView(*found->second->shared);
+    }
+    return ImageView(found->second->picture);
+}
+
+const PlanarPicture* OperandStore::getPlanar(const string& filePath) const {
+    map<string, Entry*>::const_iterator found = entries.find(filePath);
+    if (found == entries.end() || !found->second->planarLoaded) {
+        return 0;
+    }
+    return &found->second->planar;
+}
+
+void OperandStore::clear() {
+    if (loader.joinable()) {
+        loader.join();
+    }
+    for (map<string, Entry*>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        delete it->second;
+    }
+    entries.clear();
+}
+
+// Pipeline
+
+static bool validParameters(const Operation& operation) {
+    if (operation.type == OP_GAMMA && !(operation.parameters[0] > 0)) {
+        cout << "Invalid argument, gamma must be positive." << endl;
+        return false;
+    }
+    if (operation.type == OP_LEVELS &&
+        (operation.parameters[0] < 0 || operation.parameters[1] > 255 ||
+         operation.parameters[0] >= operation.parameters[1])) {
+        cout << "Invalid argument, levels expects 0 <= black < white <= 255." << endl;
+        return false;
+    }
+    if (operation.type == OP_CROP &&
+        (operation.parameters[0] < 0 || operation.parameters[1] < 0 ||
+         operation.parameters[2] <= 0 || operation.parameters[3] <= 0)) {
+        cout << "Invalid argument, crop expects x y width height with a non-empty region." << endl;
+        return false;
+    }
+    if (operation.type == OP_BOXBLUR && (operation.parameters[0] < 0 || operation.parameters[0] > MAX_BOX_RADIUS)) {
+        cout << "Invalid argument, boxblur radius must be from 0 to " << MAX_BOX_RADIUS << "." << endl;
+        return false;
+    }
+    if (operation.type == OP_GAUSSIAN || operation.type == OP_SHARPEN) {
+        // Also rejects inf and nan, which strtod accepts.
+        double sigma = operation.parameters[operation.type == OP_SHARPEN ? 1 : 0];
+        if (!(sigma > 0 && 3 * sigma <= MAX_IMAGE_SIDE)) {
+            cout << "Invalid argument, sigma must be positive and at most " << MAX_IMAGE_SIDE / 3 << "." << endl;
+            return false;
+        }
+        if (operation.type == OP_SHARPEN && !isfinite(operation.parameters[0])) {
+            cout << "Invalid argument, sharpen amount must be a finite number." << endl;
+            return false;
+        }
+    }
+    if (operation.type == OP_RESIZE &&
+        (operation.parameters[0] < 1 || operation.parameters[0] > MAX_IMAGE_SIDE ||
+         operation.parameters[1] < 1 || operation.parameters[1] > MAX_IMAGE_SIDE)) {
+        cout << "Invalid argument, resize expects a width and height from 1 to " << MAX_IMAGE_SIDE << "." << endl;
+        return false;
+    }
+    if (operation.type == OP_PYRAMID && (operation.parameters[0] < 1 || operation.parameters[0] > 16)) {
+        cout << "Invalid argument, pyramid expects 1 to 16 levels." << endl;
+        return false;
+    }
+    if (operation.type == OP_CURVES) {
+        ChannelLut check;
+        if (!check.curves(operation.text)) {
+            cout << "Invalid argument, curves expects in:out points such as 0:0,128:160,255:255." << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+Pipeline::Pipeline() {
+    verbose = true;
+    edge = EDGE_CLAMP;
+    grayOutput = false;
+}
+
+bool Pipeline::parse(int argc, char* argv[], int start) {
+    PROFILE_SCOPE("parse", "methods");
+    operations.clear();
+
+    int index = start;
+    while (index < argc) {
+        string method = argv[index];
+        const MethodInfo* info = findMethod(method);
+
+        if (!info) {
+            // Stray operand files are tolerated (e.g. a third combine layer),
+            // anything else long enough to be a method name is an error.
+            if (method.size() >= 5 && !validFileName(method)) {
+                cout << "Invalid method name." << endl;
+                return false;
+            }
+            index++;
+            continue;
+        }
+
+        Operation operation(info->type, method);
+        int parameterCount = (int)string(info->parameters).size();
+        if (index + info->fileArguments + parameterCount >= argc) {
+            cout << "Missing argument." << endl;
+            return false;
+        }
+        for (int i = 1; i <= info->fileArguments; i++) {
+            if (!validFileName(argv[index + i])) {
+                return false;
+            }
+            operation.operands.push_back(argv[index + i]);
+        }
+        for (int i = 0; i < parameterCount; i++) {
+            string argument = argv[index + info->fileArguments + 1 + i];
+            char kind = info->parameters[i];
+            if (kind == 's') {
+                operation.text = argument;
+                continue;
+            }
+            if ((kind == 'i' && !isInt(argument)) || (kind == 'f' && !isNumber(argument))) {
+                cout << "Invalid argument, expected number." << endl;
+                return false;
+            }
+            operation.parameters.push_back(kind == 'i' ? stoi(argument) : strtod(argument.c_str(), 0));
+        }
+        if (!operation.parameters.empty()) {
+            operation.value = (int)operation.parameters[0];
+        }
+        if (!validParameters(operation)) {
+            return false;
+        }
+        index += info->fileArguments + parameterCount + 1;
+        operations.push_back(operation);
+    }
+    for (size_t i = 0; i + 1 < operations.size(); i++) {
+        if (operations[i].type == OP_PYRAMID) {
+            cout << "pyramid must be the last method." << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t Pipeline::pyramidLevels() const {
+    if (operations.empty() || operations.back().type != OP_PYRAMID) {
+        return 0;
+    }
+    return operations.back().value;
+}
+
+vector<Stage> Pipeline::plan() const {
+    vector<Stage> stages;
+    for (size_t i = 0; i < operations.size(); i++) {
+        bool point = operations[i].isPointOperation();
+        if (point && !stages.empty() && stages.back().fused) {
+            stages.back().last = i;
+            continue;
+        }
+        Stage stage;
+        stage.first = i;
+        stage.last = i;
+        stage.fused = point;
+        stages.push_back(stage);
+    }
+
+    // Collapse each run of table operations inside a fused stage into one
+    // lookup table.
+    for (size_t s = 0; s < stages.size(); s++) {
+        if (!stages[s].fused) {
+            continue;
+        }
+        for (size_t i = stages[s].first; i <= stages[s].last; i++) {
+            StageStep step;
+            step.operation = i;
+            step.last = i;
+            step.table = operations[i].isTableOperation();
+            if (step.table) {
+                while (step.last < stages[s].last && operations[step.last + 1].isTableOperation()) {
+                    step.last++;
+                }
+                for (size_t j = i; j <= step.last; j++) {
+                    operations[j].addToTable(step.lut);
+                }
+                i = step.last;
+            }
+            stages[s].steps.push_back(step);
+        }
+    }
+    return stages;
+}
+
+#ifdef PROJECT2_PROFILE
+// Method names of a stage joined with '+', the name its profile record
+// goes under.
+static string stageName(const vector<Operation>& operations, const Stage& stage) {
+    string name = operations[stage.first].name;
+    for (size_t i = stage.first + 1; i <= stage.last; i++) {
+        name += "+" + operations[i].name;
+    }
+    return name;
+}
+#endif
+
+static void describe(const Operation& operation) {
+    if (operation.type == OP_COMBINE) {
+        cout << "Combining channels..." << endl;
+    }
+    else if (operation.type >= OP_ADDRED && operation.type <= OP_SCALEBLUE) {
+        cout << "Adjusting channel with " << operation.name << " by " << operation.value << "..." << endl;
+    }
+    else {
+        cout << "Processing " << operation.name << "..." << endl;
+    }
+}
+
+bool Pipeline::loadOperands(OperandStore& operands, bool planar) const {
+    PROFILE_SCOPE("operands", planar ? "planar" : "interleaved");
+    for (size_t i = 0; i < operations.size(); i++) {
+        for (size_t j = 0; j < operations[i].operands.size(); j++) {
+            const string& path = operations[i].operands[j];
+            if (!(planar ? operands.loadPlanar(path) : operands.load(path))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Pipeline::prefetchOperands(OperandStore& operands, bool planar) const {
+    vector<string> paths;
+    for (size_t i = 0; i < operations.size(); i++) {
+        paths.insert(paths.end(), operations[i].operands.begin(), operations[i].operands.end());
+    }
+    if (!paths.empty()) {
+        operands.prefetch(paths, planar);
+    }
+}
+
+// Operands are loaded stage by stage, so with a prefetch under way a stage
+// only waits for its own layers while the later ones are still read.
+static bool stageInputs(const vector<Operation>& operations, const Stage& stage, size_t pixelCount,
+                        OperandStore& operands, vector<vector<ImageView> >& inputs) {
+    PROFILE_SCOPE("operands", "interleaved");
+    for (size_t i = stage.first; i <= stage.last; i++) {
+        for (size_t j = 0; j < operations[i].operands.size(); j++) {
+            const string& path = operations[i].operands[j];
+            if (!operands.load(path)) {
+                return false;
+            }
+            ImageView view = operands.get(path);
+            if (view.size() < pixelCount) {
+                reportMessage("Operand " + path + " is smaller than the image.");
+                return false;
+            }
+            inputs[i].push_back(view);
+        }
+    }
+    return true;
+}
+
+static bool stageInputs(const vector<Operation>& operations, const Stage& stage, size_t pixelCount,
+                        OperandStore& operands, vector<vector<const PlanarPicture*> >& inputs) {
+    PROFILE_SCOPE("operands", "planar");
+    for (size_t i = stage.first; i <= stage.last; i++) {
+        for (size_t j = 0; j < operations[i].operands.size(); j++) {
+            const string& path = operations[i].operands[j];
+            if (!operands.loadPlanar(path)) {
+                return false;
+            }
+            const PlanarPicture* operand = operands.getPlanar(path);
+            if (operand->size() < pixelCount) {
+                reportMessage("Operand " + path + " is smaller than the image.");
+                return false;
+            }
+            inputs[i].push_back(operand);
+        }
+    }
+    return true;
+}
+
+// Keeps the image's type in step with its channels: everything that treats
+// the three alike leaves it, changing one channel alone or mixing in
+// another layer makes a grayscale image true color, and with grayOutput
+// the only* methods make one grayscale.
+static void updateImageType(const Operation& operation, bool grayOutput, bool alpha, Picture& header) {
+    switch (operation.type) {
+        case OP_ONLYRED:
+        case OP_ONLYGREEN:
+        case OP_ONLYBLUE:
+            if (grayOutput && !alpha) {
+                setGrayscale(header, true);
+            }
+            break;
+        case OP_MULTIPLY:
+        case OP_SUBTRACT:
+        case OP_OVERLAY:
+        case OP_SCREEN:
+        case OP_COMBINE:
+        case OP_ADDRED:
+        case OP_ADDGREEN:
+        case OP_ADDBLUE:
+        case OP_SCALERED:
+        case OP_SCALEGREEN:
+        case OP_SCALEBLUE:
+            setGrayscale(header, false);
+            break;
+        default: break;
+    }
+}
+
+void Pipeline::updateType(Picture& header, bool alpha) const {
+    for (size_t i = 0; i < operations.size(); i++) {
+        updateImageType(operations[i], grayOutput, alpha, header);
+    }
+}
+
+// Whether a gray image can go through the stage in its one-byte layout:
+// every table treats the channels alike and every blend's layer is gray
+// as well.
+static bool keepsGray(const vector<Operation>& operations, const Stage& stage,
+                      const vector<vector<ImageView> >& inputs) {
+    for (size_t s = 0; s < stage.steps.size(); s++) {
+        const StageStep& step = stage.steps[s];
+        if (step.table ? !step.lut.isUniform()
+                       : operations[step.operation].type == OP_COMBINE ||
+                         inputs[step.operation][0].layout() != LAYOUT_GRAY) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The image keeps its layout through a stage but for a gray one about to
+// lose equal channels, which goes BGR first; a BGR image whose type has
+// become grayscale goes gray after it, so the stages after that move a
+// third of the bytes.
+bool Pipeline::execute(Picture& image, OperandStore& operands) const {
+    vector<vector<ImageView> > inputs(operations.size());
+    vector<Stage> stages = plan();
+    for (size_t s = 0; s < stages.size(); s++) {
+        if (!stageInputs(operations, stages[s], image.size(), operands, inputs)) {
+            return false;
+        }
+        for (size_t i = stages[s].first; verbose && i <= stages[s].last; i++) {
+            describe(operations[i]);
+        }
+        if (stages[s].fused) {
+            if (image.layout() == LAYOUT_GRAY && !keepsGray(operations, stages[s], inputs)) {
+                image.expandGray();
+            }
+            runFused(stages[s], image, inputs);
+        }
+        else if (!runBarrier(operations[stages[s].first], image)) {
+            return false;
+        }
+        for (size_t i = stages[s].first; i <= stages[s].last; i++) {
+            updateImageType(operations[i], grayOutput, image.layout() == LAYOUT_BGRA, image);
+        }
+        if (image.layout() == LAYOUT_BGR && isGrayscale(image)) {
+            image.reduceGray();
+        }
+    }
+    return true;
+}
+
+static BlendMode blendMode(OperationType type) {
+    switch (type) {
+        case OP_MULTIPLY: return BLEND_MULTIPLY;
+        case OP_SUBTRACT: return BLEND_SUBTRACT;
+        case OP_OVERLAY: return BLEND_OVERLAY;
+        default: return BLEND_SCREEN;
+    }
+}
+
+static void applyTable(const ChannelLut& lut, Pixel* block, size_t count) {
+    lut.apply(block, block, count);
+}
+
+static void applyTable(const ChannelLut& lut, AlphaPixel* block, size_t count) {
+    lut.apply(block, block, count);
+}
+
+static void applyTable(const ChannelLut& lut, unsigned char* block, size_t count) {
+    lut.applyGray(block, count);
+}
+
+static void combineBlock(Pixel* block, const vector<ImageView>& inputs, size_t begin, size_t count) {
+    combinePixels(block, inputs[0], inputs[1], begin, block, count);
+}
+
+static void combineBlock(AlphaPixel* block, const vector<ImageView>& inputs, size_t begin, size_t count) {
+    combinePixels(block, inputs[0], inputs[1], begin, block, count);
+}
+
+// A gray image is expanded before any stage with combine.
+static void combineBlock(unsigned char*, const vector<ImageView>&, size_t, size_t) {
+}
+
+// Operands may be in any layout; one with alpha covers the block only
+// where it is opaque.
+template <class T>
+static void applyPoint(const Operation& operation, const vector<ImageView>& inputs,
+                       T* block, size_t begin, size_t count) {
+    switch (operation.type) {
+        case OP_MULTIPLY:
+        case OP_SUBTRACT:
+        case OP_OVERLAY:
+        case OP_SCREEN:
+            blendPixels(blendMode(operation.type), block, inputs[0], begin, block, count);
+            break;
+        case OP_COMBINE:
+            combineBlock(block, inputs, begin, count);
+            break;
+        default: break;
+    }
+}
+
+template <class T>
+static void runBlocks(const vector<Operation>& operations, const Stage& stage, T* pixels, size_t count,
+                      size_t width, const vector<vector<ImageView> >& inputs) {
+    parallelRows(count, width, [&](size_t first, size_t last) {
+        for (size_t begin = first; begin < last; begin += FUSED_BLOCK_PIXELS) {
+            size_t blockCount = min(FUSED_BLOCK_PIXELS, last - begin);
+            T* block = pixels + begin;
+            for (size_t s = 0; s < stage.steps.size(); s++) {
+                const StageStep& step = stage.steps[s];
+                if (step.table) {
+                    applyTable(step.lut, block, blockCount);
+                }
+                else {
+                    applyPoint(operations[step.operation], inputs[step.operation], block, begin, blockCount);
+                }
+            }
+        }
+    });
+}
+
+void Pipeline::runFused(const Stage& stage, Picture& image, const vector<vector<ImageView> >& inputs) const {
+    PROFILE_SCOPE("stage", stageName(operations, stage));
+    PROFILE_PIXELS(image.size());
+    size_t width = (unsigned short)image.width;
+    switch (image.layout()) {
+        case LAYOUT_GRAY:
+            runBlocks(operations, stage, image.grayPixels.data(), image.size(), width, inputs);
+            break;
+        case LAYOUT_BGRA:
+            runBlocks(operations, stage, image.alphaPixels.data(), image.size(), width, inputs);
+            break;
+        default:
+            runBlocks(operations, stage, image.pixels.data(), image.size(), width, inputs);
+            break;
+    }
+}
+
+void Pipeline::runFused(const Stage& stage, Pixel* pixels, size_t count, size_t width,
+                        const vector<vector<ImageView> >& inputs) const {
+    PROFILE_SCOPE("stage", stageName(operations, stage));
+    PROFILE_PIXELS(count);
+    runBlocks(operations, stage, pixels, count, width, inputs);
+}
+
+static bool cropInside(bool inside) {
+    if (!inside) {
+        reportMessage("Crop region is outside the image.");
+    }
+    return inside;
+}
+
+// stats leaves the image alone and prints its histograms as JSON. Like
+// the readers' messages, a batch job or server request collects the line
+// to print with its own output.
+template <typename Image>
+static void printStats(const Image& image, size_t width, size_t height) {
+    ImageStats stats;
+    imageStats(image, stats);
+    reportMessage(stats.json(width, height));
+}
+
+bool Pipeline::runBarrier(const Operation& operation, Picture& image) const {
+    PROFILE_SCOPE("stage", operation.name);
+    PROFILE_PIXELS(image.size());
+    const vector<double>& p = operation.parameters;
+    switch (operation.type) {
+        case OP_FLIP: image.flip(image); break;
+        case OP_MIRRORH: image.mirrorh(image); break;
+        case OP_MIRRORV: image.mirrorv(image); break;
+        case OP_TRANSPOSE: image.transpose(image); break;
+        case OP_ROTATE90: image.rotate90(image); break;
+        case OP_ROTATE270: image.rotate270(image); break;
+        case OP_CROP: return cropInside(image.crop(image, p[0], p[1], p[2], p[3]));
+        case OP_BOXBLUR: image.boxblur(image, operation.value, edge); break;
+        case OP_GAUSSIAN: image.gaussian(image, p[0], edge); break;
+        case OP_SHARPEN: image.sharpen(image, p[0], p[1], edge); break;
+        case OP_STATS: printStats(image, (unsigned short)image.width, (unsigned short)image.height); break;
+        case OP_AUTOLEVELS: image.autolevels(image); break;
+        case OP_EQUALIZE: image.equalize(image); break;
+        case OP_RESIZE: image.resize(image, p[0], p[1]); break;
+        default: break;
+    }
+    return true;
+}
+
+// Planar layout. The same stages run plane by plane: blends apply the byte
+// kernels to each plane, tables only visit the planes they change and
+// combine is two plane copies. A gray image runs on its one plane until a
+// stage would make its channels differ.
+
+// Whether a gray image can go through the stage as one plane: every table
+// treats the channels alike and every blend's layer is gray as well.
+static bool keepsGray(const vector<Operation>& operations, const Stage& stage,
+                      const vector<vector<const PlanarPicture*> >& inputs) {
+    for (size_t s = 0; s < stage.steps.size(); s++) {
+        const StageStep& step = stage.steps[s];
+        if (step.table ? !step.lut.isUniform()
+                       : operations[step.operation].type == OP_COMBINE || !inputs[step.operation][0]->gray) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Pipeline::execute(PlanarPicture& image, OperandStore& operands) const {
+    vector<vector<const PlanarPicture*> > inputs(operations.size());
+    vector<Stage> stages = plan();
+    for (size_t s = 0; s < stages.size(); s++) {
+        if (!stageInputs(operations, stages[s], image.size(), operands, inputs)) {
+            return false;
+        }
+        for (size_t i = stages[s].first; verbose && i <= stages[s].last; i++) {
+            describe(operations[i]);
+        }
+        if (stages[s].fused) {
+            if (image.gray && !keepsGray(operations, stages[s], inputs)) {
+                image.expand();
+            }
+            runFused(stages[s], image, inputs);
+        }
+        else if (!runBarrier(operations[stages[s].first], image)) {
+            return false;
+        }
+        for (size_t i = stages[s].first; i <= stages[s].last; i++) {
+            updateImageType(operations[i], grayOutput, image.hasAlpha(), image.header);
+        }
+        if (!image.gray && !image.hasAlpha() && isGrayscale(image.header)) {
+            image.reduce();
+        }
+    }
+    return true;
+}
+
+static void applyPoint(const Operation& operation, const vector<const PlanarPicture*>& inputs,
+                       unsigned char* const planes[3], int channels, size_t begin, size_t count) {
+    if (operation.type == OP_COMBINE) {
+        memcpy(planes[CHANNEL_GREEN], inputs[0]->channel(CHANNEL_GREEN) + begin, count);
+        memcpy(planes[CHANNEL_BLUE], inputs[1]->channel(CHANNEL_BLUE) + begin, count);
+        return;
+    }
+
+    const BlendKernels* kernels = blendKernels(activeIsa());
+    BlendKernel kernel = 0;
+    switch (operation.type) {
+        case OP_MULTIPLY: kernel = kernels->multiply; break;
+        case OP_SUBTRACT: kernel = kernels->subtract; break;
+        case OP_OVERLAY: kernel = kernels->overlay; break;
+        case OP_SCREEN: kernel = kernels->screen; break;
+        default: return;
+    }
+    if (!inputs[0]->hasAlpha()) {
+        for (int c = 0; c < channels; c++) {
+            kernel(planes[c], inputs[0]->channel(c) + begin, planes[c], count);
+        }
+        return;
+    }
+    // Blocks are at most FUSED_BLOCK_PIXELS long.
+    unsigned char blended[FUSED_BLOCK_PIXELS];
+    const unsigned char* coverage = inputs[0]->planes[PLANE_ALPHA].data() + begin;
+    for (int c = 0; c < channels; c++) {
+        kernel(planes[c], inputs[0]->channel(c) + begin, blended, count);
+        coverBytes(blended, coverage, planes[c], count);
+    }
+}
+
+void Pipeline::runFused(const Stage& stage, PlanarPicture& image,
+                        const vector<vector<const PlanarPicture*> >& inputs) const {
+    PROFILE_SCOPE("stage", stageName(operations, stage));
+    PROFILE_PIXELS(image.size());
+    parallelRows(image.size(), (unsigned short)image.header.width, [&](size_t first, size_t last) {
+        for (size_t begin = first; begin < last; begin += FUSED_BLOCK_PIXELS) {
+            size_t count = min(FUSED_BLOCK_PIXELS, last - begin);
+            unsigned char* blue = image.planes[0].data() + begin;
+            unsigned char* const planes[3] = {
+                blue,
+                image.gray ? blue : image.planes[1].data() + begin,
+                image.gray ? blue : image.planes[2].data() + begin
+            };
+            for (size_t s = 0; s < stage.steps.size(); s++) {
+                const StageStep& step = stage.steps[s];
+                if (step.table && image.gray) {
+                    step.lut.applyGray(blue, count);
+                }
+                else if (step.table) {
+                    step.lut.applyPlanar(planes, count);
+                }
+                else {
+                    applyPoint(operations[step.operation], inputs[step.operation], planes, image.gray ? 1 : 3,
+                               begin, count);
+                }
+            }
+        }
+    });
+}
+
+bool Pipeline::runBarrier(const Operation& operation, PlanarPicture& image) const {
+    PROFILE_SCOPE("stage", operation.name);
+    PROFILE_PIXELS(image.size());
+    const vector<double>& p = operation.parameters;
+    switch (operation.type) {
+        case OP_FLIP: image.flip(); break;
+        case OP_MIRRORH: image.mirrorh(); break;
+        case OP_MIRRORV: image.mirrorv(); break;
+        case OP_TRANSPOSE: image.transpose(); break;
+        case OP_ROTATE90: image.rotate90(); break;
+        case OP_ROTATE270: image.rotate270(); break;
+        case OP_CROP: return cropInside(image.crop(p[0], p[1], p[2], p[3]));
+        case OP_BOXBLUR: image.boxblur(operation.value, edge); break;
+        case OP_GAUSSIAN: image.gaussian(p[0], edge); break;
+        case OP_SHARPEN: image.sharpen(p[0], p[1], edge); break;
+        case OP_STATS: printStats(image, (unsigned short)image.header.width, (unsigned short)image.header.height); break;
+        case OP_AUTOLEVELS: image.autolevels(); break;
+        case OP_EQUALIZE: image.equalize(); break;
+        case OP_RESIZE: image.resize(p[0], p[1]); break;
+        default: break;
+    }
+    return true;
+}
@@ -0,0 +1,200 @@
+#ifndef pipeline_h
+#define pipeline_h
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "tgaimage.h"
+#include "tgaio.h"
+#include "lut.h"
+#include "planar.h"
+#include "cache.h"
+using namespace std;
+
+enum OperationType {
+    OP_MULTIPLY,
+    OP_SUBTRACT,
+    OP_OVERLAY,
+    OP_SCREEN,
+    OP_COMBINE,
+    OP_FLIP,
+    OP_ONLYRED,
+    OP_ONLYGREEN,
+    OP_ONLYBLUE,
+    OP_ADDRED,
+    OP_ADDGREEN,
+    OP_ADDBLUE,
+    OP_SCALERED,
+    OP_SCALEGREEN,
+    OP_SCALEBLUE,
+    OP_GAMMA,
+    OP_LEVELS,
+    OP_CURVES,
+    OP_MIRRORH,
+    OP_MIRRORV,
+    OP_TRANSPOSE,
+    OP_ROTATE90,
+    OP_ROTATE270,
+    OP_CROP,
+    OP_BOXBLUR,
+    OP_GAUSSIAN,
+    OP_SHARPEN,
+    OP_STATS,
+    OP_AUTOLEVELS,
+    OP_EQUALIZE,
+    OP_RESIZE,
+    OP_PYRAMID
+};
+
+// One method from the command line, with its arguments and the operand
+// files it reads. value is the first numeric argument as an integer.
+class Operation{
+    public:
+        OperationType type;
+        string name;
+        int value;
+        vector<double> parameters;
+        string text;
+        vector<string> operands;
+
+        Operation();
+        Operation(OperationType t, const string& n);
+
+        // Point operations only look at pixel i of each input to produce
+        // pixel i, so any run of them can be fused into one pass.
+        bool isPointOperation() const;
+
+        // Operations that are a function of single channel values and fold
+        // into a ChannelLut.
+        bool isTableOperation() const;
+        void addToTable(ChannelLut& lut) const;
+};
+
+// Decoded or mapped operand layers, loaded once per path and layout.
+// With a cache directory set, decoded layers come from and go to the
+// persistent cache. prefetch() loads layers on a background thread; load()
+// of a layer still in flight waits for it instead of reading it again.
+class OperandStore{
+    public:
+        bool mapFiles;
+        DecodedCache cache;
+
+        OperandStore();
+        ~OperandStore();
+
+        bool load(const string& filePath);
+        bool loadPlanar(const string& filePath);
+        // Starts loading filePaths, in order, on the background thread.
+        void prefetch(const vector<string>& filePaths, bool planar);
+        // Uses an already decoded picture, shared with its owner, for
+        // filePath in the interleaved layout.
+        void adopt(const string& filePath, const shared_ptr<const Picture>& picture);
+        ImageView get(const string& filePath) const;
+        const PlanarPicture* getPlanar(const string& filePath) const;
+        void clear();
+
+    private:
+        struct Entry{
+            Picture picture;
+            MappedImage mapping;
+            CachedImage cached;
+            shared_ptr<const Picture> shared;
+            PlanarPicture planar;
+            bool interleavedLoaded;
+            bool planarLoaded;
+            bool pending;
+        };
+        map<string, Entry*> entries;
+        mutex lock;
+        condition_variable loaded;
+        thread loader;
+
+        Entry* entry(const string& filePath);
+        bool loadEntry(Entry* entry, const string& filePath);
+        bool loadPlanarEntry(Entry* entry, const string& filePath);
+
+        OperandStore(const OperandStore&);
+        OperandStore& operator=(const OperandStore&);
+};
+
+// Step of a fused stage: a single operation, or a run of table operations
+// [operation, last] collapsed into one lookup table.
+class StageStep{
+    public:
+        size_t operation;
+        size_t last;
+        bool table;
+        ChannelLut lut;
+};
+
+// Run of operations executed together: either a fused group of point
+// operations or a single barrier (e.g. flip) that needs the whole image.
+class Stage{
+    public:
+        size_t first;
+        size_t last;
+        bool fused;
+        vector<StageStep> steps;
+};
+
+// The argv method chain as an operation list. Nothing touches pixels until
+// execute(), which groups consecutive point operations into stages and
+// sweeps each fused stage over the image one cache-sized block at a time.
+class Pipeline{
+    public:
+        vector<Operation> operations;
+        bool verbose;
+        // Border handling of the blur and sharpen methods (--edge).
+        EdgeMode edge;
+        // Lets onlyred, onlygreen and onlyblue turn a true-color image
+        // without alpha grayscale, so it is written with one byte per pixel
+        // (--gray). Grayscale inputs stay grayscale either way while their
+        // channels stay equal.
+        bool grayOutput;
+
+        Pipeline();
+
+        bool parse(int argc, char* argv[], int start);
+        // Levels of the pyramid method that ends the chain, or 0. The
+        // pipeline leaves the image as it is; whoever writes the output
+        // writes the levels next to it (writePyramid).
+        size_t pyramidLevels() const;
+        vector<Stage> plan() const;
+
+        // Loads every operand up front in the layout execute() will use.
+        // Once it has succeeded the store is only read, so several images
+        // can execute against it at once.
+        bool loadOperands(OperandStore& operands, bool planar) const;
+        // Starts loading every operand in the background; execute() then
+        // waits for each one only before the first stage that reads it.
+        void prefetchOperands(OperandStore& operands, bool planar) const;
+        bool execute(Picture& image, OperandStore& operands) const;
+        bool execute(PlanarPicture& image, OperandStore& operands) const;
+        // Sets header's type to the one execute() leaves an image of that
+        // type with, for writers that never hold the whole image.
+        void updateType(Picture& header, bool alpha) const;
+
+        // Runs a fused stage over pixels[0, count) of an image with rows of
+        // the given width. Operand views are indexed like operations and
+        // must line up with pixels[0].
+        void runFused(const Stage& stage, Pixel* pixels, size_t count, size_t width,
+                      const vector<vector<ImageView> >& inputs) const;
+
+    private:
+        void runFused(const Stage& stage, Picture& image, const vector<vector<ImageView> >& inputs) const;
+        bool runBarrier(const Operation& operation, Picture& image) const;
+        void runFused(const Stage& stage, PlanarPicture& image,
+                      const vector<vector<const PlanarPicture*> >& inputs) const;
+        bool runBarrier(const Operation& operation, PlanarPicture& image) const;
+};
+
+bool validFileName(const string& name);
+bool validOutputFileName(const string& name);
+bool isInt(const string& value);
+bool isNumber(const string& value);
+
+#endif
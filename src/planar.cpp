@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "planar.h"
+#include "tgaio.h"
+#include "threadpool.h"
+#include "profile.h"
+#include "kernels.h"
+#include "filter.h"
+#include "histogram.h"
+#include "resize.h"
+#include "lut.h"
+
+using namespace std;
+
+// Pixels converted per chunk while reading, so the interleaved staging
+// buffer stays in cache.
+static const size_t CONVERT_CHUNK_PIXELS = 16384;
+
+// Plane
+
+Plane::Plane() {
+    bytes = 0;
+    count = 0;
+    capacity = 0;
+}
+
+Plane::~Plane() {
+    free(bytes);
+}
+
+void Plane::resize(size_t newCount) {
+    size_t padded = (newCount + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+    if (padded > capacity) {
+        void* memory = 0;
+        if (posix_memalign(&memory, PLANE_ALIGNMENT, max<size_t>(padded, PLANE_ALIGNMENT)) != 0) {
+            throw bad_alloc();
+        }
+        if (bytes) {
+            memcpy(memory, bytes, min(count, newCount));
+        }
+        free(bytes);
+        bytes = static_cast<unsigned char*>(memory);
+        capacity = padded;
+    }
+    if (newCount > count) {
+        memset(bytes + count, 0, newCount - count);
+    }
+    // Padding past the last pixel is kept zeroed.
+    memset(bytes + newCount, 0, capacity - newCount);
+    count = newCount;
+}
+
+void Plane::swap(Plane& other) {
+    std::swap(bytes, other.bytes);
+    std::swap(count, other.count);
+    std::swap(capacity, other.capacity);
+}
+
+unsigned char* Plane::data() {
+    return bytes;
+}
+
+const unsigned char* Plane::data() const {
+    return bytes;
+}
+
+size_t Plane::size() const {
+    return count;
+}
+
+// PlanarPicture
+
+PlanarPicture::PlanarPicture() {
+    gray = false;
+}
+
+size_t PlanarPicture::size() const {
+    return planes[0].size();
+}
+
+void PlanarPicture::resize(size_t count) {
+    for (int c = 0; c < planeCount(); c++) {
+        planes[c].resize(count);
+    }
+}
+
+bool PlanarPicture::hasAlpha() const {
+    return planes[PLANE_ALPHA].size() != 0;
+}
+
+int PlanarPicture::planeCount() const {
+    if (hasAlpha()) {
+        return 4;
+    }
+    return gray ? 1 : 3;
+}
+
+const unsigned char* PlanarPicture::channel(int c) const {
+    return planes[gray ? 0 : c].data();
+}
+
+// Green is the plane kept, as it is the channel a grayscale file is
+// written from.
+void PlanarPicture::reduce() {
+    if (!gray) {
+        planes[0].swap(planes[CHANNEL_GREEN]);
+    }
+    for (int c = 1; c < 3; c++) {
+        Plane released;
+        planes[c].swap(released);
+    }
+    gray = true;
+}
+
+void PlanarPicture::expand() {
+    if (!gray) {
+        return;
+    }
+    gray = false;
+    size_t count = size();
+    resize(count);
+    const unsigned char* luma = planes[0].data();
+    unsigned char* green = planes[1].data();
+    unsigned char* red = planes[2].data();
+    parallelRows(count, (unsigned short)header.width, [=](size_t begin, size_t end) {
+        memcpy(green + begin, luma + begin, end - begin);
+        memcpy(red + begin, luma + begin, end - begin);
+    });
+}
+
+static void splitPixels(const Pixel* in, unsigned char* blue, unsigned char* green,
+                        unsigned char* red, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        blue[i] = in[i].blue;
+        green[i] = in[i].green;
+        red[i] = in[i].red;
+    }
+}
+
+static void mergePixels(const unsigned char* blue, const unsigned char* green,
+                        const unsigned char* red, Pixel* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i].blue = blue[i];
+        out[i].green = green[i];
+        out[i].red = red[i];
+    }
+}
+
+bool PlanarPicture::readData(const string& filePath) {
+    PROFILE_SCOPE("decode", filePath);
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        reportMessage("File not found");
+        return false;
+    }
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+
+    unsigned char buffer[TGA_HEADER_SIZE];
+    if (!readFully(fd, buffer, sizeof(buffer))) {
+        reportMessage("Invalid file, header is truncated.");
+        close(fd);
+        return false;
+    }
+    decodeHeader(buffer, header);
+    header.pixels.clear();
+
+    size_t pixelBytes = filePixelBytes(header);
+    if (pixelBytes == 0) {
+        reportMessage("Unsupported TGA format in " + filePath + ".");
+        close(fd);
+        return false;
+    }
+
+    size_t total = imagePixelCount(header);
+    planes[PLANE_ALPHA].resize(pixelBytes == 4 ? total : 0);
+    if (pixelBytes == 1) {
+        reduce();
+    }
+    else {
+        gray = false;
+    }
+    resize(total);
+    PROFILE_PIXELS(total);
+
+    // Grayscale bytes are the plane itself, as stored or after decoding.
+    if (gray && isRunLength(header)) {
+        if (!readRle(fd, header, 1, planes[0].data(), total)) {
+            reportMessage("Image data in " + filePath + " ends early.");
+        }
+        close(fd);
+        return true;
+    }
+    if (gray) {
+        lseek(fd, pixelDataOffset(header), SEEK_SET);
+        size_t got = readAvailable(fd, planes[0].data(), total);
+        memset(planes[0].data() + got, 0, total - got);
+        if (got < total) {
+            reportMessage("Image data in " + filePath + " ends early.");
+        }
+        close(fd);
+        return true;
+    }
+
+    if (isRunLength(header) || pixelBytes != sizeof(Pixel)) {
+        vector<Pixel> decoded(total);
+        if (!readPixels(fd, header, decoded.data(), hasAlpha() ? planes[PLANE_ALPHA].data() : 0, total)) {
+            reportMessage("Image data in " + filePath + " ends early.");
+        }
+        splitPixels(decoded.data(), planes[0].data(), planes[1].data(), planes[2].data(), total);
+        close(fd);
+        return true;
+    }
+
+    lseek(fd, pixelDataOffset(header), SEEK_SET);
+
+    // Split chunk by chunk; a short file leaves the rest black.
+    vector<Pixel> staging(min(total, CONVERT_CHUNK_PIXELS));
+    size_t done = 0;
+    while (done < total) {
+        size_t count = min(CONVERT_CHUNK_PIXELS, total - done);
+        size_t wanted = count * sizeof(Pixel);
+        size_t got = readAvailable(fd, staging.data(), wanted);
+        size_t whole = got / sizeof(Pixel);
+        splitPixels(staging.data(), planes[0].data() + done, planes[1].data() + done,
+                    planes[2].data() + done, whole);
+        if (got < wanted) {
+            for (int c = 0; c < 3; c++) {
+                memset(planes[c].data() + done + whole, 0, total - done - whole);
+            }
+            reportMessage("Image data in " + filePath + " ends early.");
+            break;
+        }
+        done += count;
+    }
+
+    close(fd);
+    return true;
+}
+
+bool PlanarPicture::writeData(const string& filePath) const {
+    PROFILE_SCOPE("encode", filePath);
+    int fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        reportMessage("File not found");
+        return false;
+    }
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+
+    size_t total = size();
+    PROFILE_PIXELS(total);
+    const unsigned char* alpha = hasAlpha() ? planes[PLANE_ALPHA].data() : 0;
+    if (gray && storedPixelBytes(header, false) == 1) {
+        bool ok;
+        if (isRunLength(header)) {
+            ok = writeRle(fd, header, 1, planes[0].data());
+        }
+        else {
+            unsigned char buffer[TGA_HEADER_SIZE];
+            encodeHeader(header, 1, buffer);
+            ok = writeFully(fd, buffer, sizeof(buffer)) && writeFully(fd, planes[0].data(), total);
+        }
+        close(fd);
+        if (!ok) {
+            reportMessage("Failed to write " + filePath);
+        }
+        return ok;
+    }
+    if (isRunLength(header) || storedPixelBytes(header, alpha != 0) != sizeof(Pixel)) {
+        vector<Pixel> merged(total);
+        mergePixels(channel(0), channel(1), channel(2), merged.data(), total);
+        bool ok = writePixels(fd, header, merged.data(), alpha, total);
+        close(fd);
+        if (!ok) {
+            reportMessage("Failed to write " + filePath);
+        }
+        return ok;
+    }
+
+    // The whole file is assembled in one buffer and written at once.
+    vector<unsigned char> file(TGA_HEADER_SIZE + total * sizeof(Pixel));
+    encodeHeader(header, sizeof(Pixel), file.data());
+    mergePixels(channel(0), channel(1), channel(2), reinterpret_cast<Pixel*>(file.data() + TGA_HEADER_SIZE), total);
+
+    bool ok = writeFully(fd, file.data(), file.size());
+    close(fd);
+    if (!ok) {
+        reportMessage("Failed to write " + filePath);
+    }
+    return ok;
+}
+
+void PlanarPicture::fromInterleaved(const Picture& image) {
+    header.copyHeader(image);
+    PixelLayout layout = image.layout();
+    size_t count = image.size();
+    gray = false;
+    planes[PLANE_ALPHA].resize(layout == LAYOUT_BGRA ? count : 0);
+    if (layout == LAYOUT_GRAY) {
+        reduce();
+        planes[0].resize(count);
+        memcpy(planes[0].data(), image.grayPixels.data(), count);
+        return;
+    }
+    resize(count);
+    if (layout == LAYOUT_BGR) {
+        splitPixels(image.pixels.data(), planes[0].data(), planes[1].data(), planes[2].data(), count);
+        return;
+    }
+    const AlphaPixel* in = image.alphaPixels.data();
+    for (size_t i = 0; i < count; i++) {
+        planes[0].data()[i] = in[i].blue;
+        planes[1].data()[i] = in[i].green;
+        planes[2].data()[i] = in[i].red;
+        planes[PLANE_ALPHA].data()[i] = in[i].alpha;
+    }
+}
+
+void PlanarPicture::toInterleaved(Picture& image) const {
+    image.copyHeader(header);
+    size_t count = size();
+    if (gray && !hasAlpha()) {
+        image.allocate(LAYOUT_GRAY, count);
+        memcpy(image.grayPixels.data(), planes[0].data(), count);
+        return;
+    }
+    if (!hasAlpha()) {
+        image.allocate(LAYOUT_BGR, count);
+        mergePixels(channel(0), channel(1), channel(2), image.pixels.data(), count);
+        return;
+    }
+    image.allocate(LAYOUT_BGRA, count);
+    const unsigned char* blue = channel(0);
+    const unsigned char* green = channel(1);
+    const unsigned char* red = channel(2);
+    const unsigned char* alpha = planes[PLANE_ALPHA].data();
+    AlphaPixel* out = image.alphaPixels.data();
+    for (size_t i = 0; i < count; i++) {
+        out[i] = AlphaPixel(blue[i], green[i], red[i], alpha[i]);
+    }
+}
+
+void PlanarPicture::flip() {
+    size_t count = size();
+    for (int c = 0; c < planeCount(); c++) {
+        unsigned char* plane = planes[c].data();
+        parallelRows(count / 2, (unsigned short)header.width, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                std::swap(plane[i], plane[count - 1 - i]);
+            }
+        });
+    }
+}
+
+void PlanarPicture::mirrorh() {
+    size_t width = (unsigned short)header.width;
+    for (int c = 0; c < planeCount(); c++) {
+        unsigned char* plane = planes[c].data();
+        parallelRows(size(), width, [=](size_t begin, size_t end) {
+            mirrorRows(plane, plane, width, begin / width, end / width);
+        });
+    }
+}
+
+void PlanarPicture::mirrorv() {
+    size_t width = (unsigned short)header.width;
+    size_t height = (unsigned short)header.height;
+    for (int c = 0; c < planeCount(); c++) {
+        unsigned char* plane = planes[c].data();
+        parallelRows(height / 2 * width, width, [=](size_t begin, size_t end) {
+            flipRows(plane, plane, width, height, begin / width, end / width);
+        });
+    }
+}
+
+// Rows of a plane handed to each task of a tiled remap.
+static const size_t REMAP_ROWS = 64;
+
+typedef void (*PlaneRemapKernel)(const unsigned char*, size_t, size_t, unsigned char*, size_t, size_t);
+
+static void remapPlanes(PlanarPicture& image, PlaneRemapKernel kernel) {
+    size_t width = (unsigned short)image.header.width;
+    size_t height = (unsigned short)image.header.height;
+    Plane rotated;
+    rotated.resize(image.size());
+    for (int c = 0; c < image.planeCount(); c++) {
+        const unsigned char* in = image.planes[c].data();
+        unsigned char* out = rotated.data();
+        defaultPool().parallelFor(height, REMAP_ROWS, [=](size_t begin, size_t end) {
+            kernel(in, width, height, out, begin, end);
+        });
+        image.planes[c].swap(rotated);
+    }
+    std::swap(image.header.width, image.header.height);
+}
+
+void PlanarPicture::transpose() {
+    remapPlanes(*this, transposePixels);
+}
+
+void PlanarPicture::rotate90() {
+    remapPlanes(*this, rotate90Pixels);
+}
+
+void PlanarPicture::rotate270() {
+    remapPlanes(*this, rotate270Pixels);
+}
+
+bool PlanarPicture::crop(int x, int y, int w, int h) {
+    size_t inWidth = (unsigned short)header.width;
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || (size_t)x + w > inWidth ||
+        (size_t)y + h > (size_t)(unsigned short)header.height) {
+        return false;
+    }
+    for (int c = 0; c < planeCount(); c++) {
+        unsigned char* plane = planes[c].data();
+        cropRows(plane, inWidth, plane, x, y, w, 0, h);
+    }
+    resize((size_t)w * h);
+    header.width = (short)w;
+    header.height = (short)h;
+    return true;
+}
+
+void PlanarPicture::resize(int w, int h) {
+    size_t inWidth = (unsigned short)header.width;
+    size_t inHeight = (unsigned short)header.height;
+    Plane resized;
+    for (int c = 0; c < planeCount(); c++) {
+        resized.resize((size_t)w * h);
+        resizeImage(planes[c].data(), inWidth, inHeight, resized.data(), w, h, 1);
+        planes[c].swap(resized);
+    }
+    header.width = (short)w;
+    header.height = (short)h;
+}
+
+// Each plane is filtered into one spare plane, which then takes its place.
+static void filterPlanes(PlanarPicture& image, const function<void(const unsigned char*, unsigned char*)>& pass) {
+    Plane filtered;
+    filtered.resize(image.size());
+    for (int c = 0; c < image.planeCount(); c++) {
+        pass(image.planes[c].data(), filtered.data());
+        image.planes[c].swap(filtered);
+    }
+}
+
+void PlanarPicture::boxblur(int radius, EdgeMode edge) {
+    size_t width = (unsigned short)header.width;
+    size_t height = (unsigned short)header.height;
+    filterPlanes(*this, [=](const unsigned char* in, unsigned char* out) {
+        boxBlur(in, out, width, height, 1, radius, edge);
+    });
+}
+
+void PlanarPicture::gaussian(double sigma, EdgeMode edge) {
+    size_t width = (unsigned short)header.width;
+    size_t height = (unsigned short)header.height;
+    filterPlanes(*this, [=](const unsigned char* in, unsigned char* out) {
+        gaussianBlur(in, out, width, height, 1, sigma, edge);
+    });
+}
+
+void PlanarPicture::sharpen(double amount, double sigma, EdgeMode edge) {
+    size_t width = (unsigned short)header.width;
+    size_t height = (unsigned short)header.height;
+    filterPlanes(*this, [=](const unsigned char* in, unsigned char* out) {
+        unsharpMask(in, out, width, height, 1, amount, sigma, edge);
+    });
+}
+
+typedef void (ImageStats::*StatsTable)(int, unsigned char*) const;
+
+static void applyStatsTable(PlanarPicture& image, StatsTable table) {
+    ImageStats stats;
+    imageStats(image, stats);
+    ChannelLut lut;
+    for (int c = 0; c < 3; c++) {
+        unsigned char function[256];
+        (stats.*table)(c, function);
+        lut.map(c, function);
+    }
+    parallelRows(image.size(), (unsigned short)image.header.width, [&](size_t begin, size_t end) {
+        if (image.gray) {
+            lut.applyGray(image.planes[0].data() + begin, end - begin);
+            return;
+        }
+        unsigned char* const planes[3] = {
+            image.planes[0].data() + begin,
+            image.planes[1].data() + begin,
+            image.planes[2].data() + begin
+        };
+        lut.applyPlanar(planes, end - begin);
+    });
+}
+
+void PlanarPicture::autolevels() {
+    applyStatsTable(*this, &ImageStats::autolevelsTable);
+}
+
+void PlanarPicture::equalize() {
+    applyStatsTable(*this, &ImageStats::equalizeTable);
+}
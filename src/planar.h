@@ -0,0 +1,95 @@
+#ifndef planar_h
+#define planar_h
+
+#include <cstddef>
+#include <string>
+#include "tgaimage.h"
+using namespace std;
+
+// Planes start on and are padded to this many bytes, so a full-width
+// vector load never crosses the end of an allocation.
+const size_t PLANE_ALIGNMENT = 64;
+
+const int PLANE_ALPHA = 3;
+
+// One channel of an image as a contiguous byte array.
+class Plane{
+    public:
+        Plane();
+        ~Plane();
+
+        void resize(size_t count);
+        void swap(Plane& other);
+        unsigned char* data();
+        const unsigned char* data() const;
+        size_t size() const;
+
+    private:
+        unsigned char* bytes;
+        size_t count;
+        size_t capacity;
+
+        Plane(const Plane&);
+        Plane& operator=(const Plane&);
+};
+
+// Structure-of-arrays image: planes[CHANNEL_BLUE/GREEN/RED], and
+// planes[PLANE_ALPHA] for a BGRA image (empty otherwise). A channel
+// operation touches one plane instead of striding through every pixel.
+// Interleaved pixels only exist in the file: readData splits them and
+// writeData merges them back.
+//
+// A gray image (three equal channels, no alpha) keeps planes[0] alone,
+// so every stage reads and writes a third of the bytes. readData keeps a
+// grayscale file that way and reduce drops a grayscale result back to
+// it; a stage that would make the channels differ expands it first.
+class PlanarPicture{
+    public:
+        Picture header;
+        Plane planes[4];
+        bool gray;
+
+        PlanarPicture();
+
+        size_t size() const;
+        // Resizes the color planes, and the alpha plane if there is one.
+        void resize(size_t count);
+        bool hasAlpha() const;
+        // Planes the geometry goes through: 4 with alpha, 1 when gray,
+        // else 3.
+        int planeCount() const;
+        // Color channel c, which is planes[0] for every c when gray.
+        const unsigned char* channel(int c) const;
+
+        // Keeps planes[0] alone; the channels must be equal.
+        void reduce();
+        // Copies planes[0] back into planes 1 and 2.
+        void expand();
+
+        bool readData(const string& filePath);
+        bool writeData(const string& filePath) const;
+
+        void fromInterleaved(const Picture& image);
+        void toInterleaved(Picture& image) const;
+
+        // 180 degree rotation, each plane reversed in parallel.
+        void flip();
+        // The Picture geometry methods, plane by plane.
+        void mirrorh();
+        void mirrorv();
+        void transpose();
+        void rotate90();
+        void rotate270();
+        bool crop(int x, int y, int w, int h);
+        // Resamples every plane to w x h (resize.h).
+        void resize(int w, int h);
+        // The neighbourhood filters, plane by plane.
+        void boxblur(int radius, EdgeMode edge);
+        void gaussian(double sigma, EdgeMode edge);
+        void sharpen(double amount, double sigma, EdgeMode edge);
+        // The Picture histogram methods, each plane through its own table.
+        void autolevels();
+        void equalize();
+};
+
+#endif
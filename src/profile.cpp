@@ -0,0 +1,237 @@
+#include <iostream>
+#include "profile.h"
+
+using namespace std;
+
+#ifndef PROJECT2_PROFILE
+
+bool enableProfile(const string&) {
+    cout << "Profiling is not built in, build with make profile." << endl;
+    return false;
+}
+
+#else
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Atomic because pool helpers add their chunks' counts from their own
+// threads. Thread storage is zero-initialized.
+class ProfileCounters{
+    public:
+        atomic<size_t> values[PROFILE_COUNTERS];
+};
+
+static thread_local ProfileCounters threadCounters;
+static bool profiling = false;
+static string profileJsonPath;
+
+void profileCount(ProfileCounter counter, size_t amount) {
+    threadCounters.values[counter].fetch_add(amount, memory_order_relaxed);
+}
+
+ProfileCounters* profileOwner() {
+    return &threadCounters;
+}
+
+// Every allocation goes through these while the profile build runs, so
+// scopes can report how many they made.
+
+void* operator new(size_t size) {
+    profileCount(PROFILE_ALLOCATIONS, 1);
+    profileCount(PROFILE_ALLOCATED_BYTES, size);
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+class ProfileRecord{
+    public:
+        string kind;
+        string name;
+        size_t calls;
+        double wall;
+        double cpu;
+        size_t pixels;
+        size_t counters[PROFILE_COUNTERS];
+};
+
+// Records in the order their scopes first finished.
+static vector<ProfileRecord>& records() {
+    static vector<ProfileRecord>* list = new vector<ProfileRecord>;
+    return *list;
+}
+
+static mutex recordsLock;
+
+static double now(clockid_t clock) {
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+ProfileHelp::ProfileHelp(ProfileCounters* o) {
+    owner = profiling && o != &threadCounters ? o : 0;
+    if (!owner) {
+        return;
+    }
+    for (int i = 0; i < PROFILE_COUNTERS; i++) {
+        counterStart[i] = threadCounters.values[i].load(memory_order_relaxed);
+    }
+    cpuStart = now(CLOCK_THREAD_CPUTIME_ID);
+}
+
+ProfileHelp::~ProfileHelp() {
+    if (!owner) {
+        return;
+    }
+    double cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    for (int i = 0; i < PROFILE_COUNTERS; i++) {
+        size_t delta = threadCounters.values[i].load(memory_order_relaxed) - counterStart[i];
+        owner->values[i].fetch_add(delta, memory_order_relaxed);
+    }
+    owner->values[PROFILE_HELPER_CPU_NS].fetch_add((size_t)(cpu * 1e9), memory_order_relaxed);
+}
+
+ProfileScope::ProfileScope(const char* k, const string& n) {
+    pixels = 0;
+    active = profiling;
+    if (!active) {
+        return;
+    }
+    kind = k;
+    name = n;
+    for (int i = 0; i < PROFILE_COUNTERS; i++) {
+        counterStart[i] = threadCounters.values[i].load(memory_order_relaxed);
+    }
+    cpuStart = now(CLOCK_THREAD_CPUTIME_ID);
+    wallStart = now(CLOCK_MONOTONIC);
+}
+
+ProfileScope::~ProfileScope() {
+    if (!active) {
+        return;
+    }
+    double wall = now(CLOCK_MONOTONIC) - wallStart;
+    size_t counterEnd[PROFILE_COUNTERS];
+    for (int i = 0; i < PROFILE_COUNTERS; i++) {
+        counterEnd[i] = threadCounters.values[i].load(memory_order_relaxed);
+    }
+    double cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpuStart +
+                 (counterEnd[PROFILE_HELPER_CPU_NS] - counterStart[PROFILE_HELPER_CPU_NS]) * 1e-9;
+
+    lock_guard<mutex> guard(recordsLock);
+    vector<ProfileRecord>& list = records();
+    size_t index = 0;
+    while (index < list.size() && !(list[index].kind == kind && list[index].name == name)) {
+        index++;
+    }
+    if (index == list.size()) {
+        ProfileRecord record;
+        record.kind = kind;
+        record.name = name;
+        record.calls = 0;
+        record.wall = 0;
+        record.cpu = 0;
+        record.pixels = 0;
+        for (int i = 0; i < PROFILE_COUNTERS; i++) {
+            record.counters[i] = 0;
+        }
+        list.push_back(record);
+    }
+    ProfileRecord& record = list[index];
+    record.calls++;
+    record.wall += wall;
+    record.cpu += cpu;
+    record.pixels += pixels;
+    for (int i = 0; i < PROFILE_COUNTERS; i++) {
+        record.counters[i] += counterEnd[i] - counterStart[i];
+    }
+}
+
+static string jsonString(const string& text) {
+    string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '"' || text[i] == '\\') {
+            quoted += '\\';
+        }
+        quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+static void printProfile() {
+    lock_guard<mutex> guard(recordsLock);
+    const vector<ProfileRecord>& list = records();
+
+    // Scopes nest (a stage runs inside "run", a decode inside "operands"),
+    // so the rows are not meant to add up.
+    char line[256];
+    snprintf(line, sizeof(line), "%-9s %-28s %5s %10s %10s %12s %12s %5s %11s %7s",
+             "kind", "name", "calls", "wall(ms)", "cpu(ms)", "read", "written", "opens", "pixels", "allocs");
+    cout << line << endl;
+    for (size_t i = 0; i < list.size(); i++) {
+        const ProfileRecord& r = list[i];
+        string name = r.name.size() > 28 ? "..." + r.name.substr(r.name.size() - 25) : r.name;
+        snprintf(line, sizeof(line), "%-9s %-28s %5zu %10.3f %10.3f %12zu %12zu %5zu %11zu %7zu",
+                 r.kind.c_str(), name.c_str(), r.calls, r.wall * 1e3, r.cpu * 1e3,
+                 r.counters[PROFILE_BYTES_READ], r.counters[PROFILE_BYTES_WRITTEN],
+                 r.counters[PROFILE_FILES_OPENED], r.pixels, r.counters[PROFILE_ALLOCATIONS]);
+        cout << line << endl;
+    }
+
+    if (profileJsonPath.empty()) {
+        return;
+    }
+    ofstream file(profileJsonPath);
+    if (!file.is_open()) {
+        cout << "Could not write " << profileJsonPath << endl;
+        return;
+    }
+    file << "{\"records\": [\n";
+    for (size_t i = 0; i < list.size(); i++) {
+        const ProfileRecord& r = list[i];
+        file << "  {\"kind\": " << jsonString(r.kind) << ", \"name\": " << jsonString(r.name)
+             << ", \"calls\": " << r.calls << ", \"wall_ms\": " << r.wall * 1e3
+             << ", \"cpu_ms\": " << r.cpu * 1e3
+             << ", \"bytes_read\": " << r.counters[PROFILE_BYTES_READ]
+             << ", \"bytes_written\": " << r.counters[PROFILE_BYTES_WRITTEN]
+             << ", \"files_opened\": " << r.counters[PROFILE_FILES_OPENED]
+             << ", \"pixels\": " << r.pixels
+             << ", \"allocations\": " << r.counters[PROFILE_ALLOCATIONS]
+             << ", \"allocated_bytes\": " << r.counters[PROFILE_ALLOCATED_BYTES] << "}"
+             << (i + 1 < list.size() ? "," : "") << "\n";
+    }
+    file << "]}\n";
+}
+
+bool enableProfile(const string& jsonPath) {
+    if (!profiling) {
+        atexit(printProfile);
+    }
+    profiling = true;
+    profileJsonPath = jsonPath;
+    return true;
+}
+
+#endif
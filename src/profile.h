@@ -0,0 +1,96 @@
+#ifndef profile_h
+#define profile_h
+
+#include <cstddef>
+#include <string>
+using namespace std;
+
+// Per-stage profiling for --profile. The instrumentation only exists in
+// builds with PROJECT2_PROFILE defined (make profile); otherwise the
+// PROFILE_* macros expand to nothing and their arguments are never
+// evaluated, so the normal binary pays nothing for them.
+
+enum ProfileCounter {
+    PROFILE_BYTES_READ,
+    PROFILE_BYTES_WRITTEN,
+    PROFILE_FILES_OPENED,
+    PROFILE_ALLOCATIONS,
+    PROFILE_ALLOCATED_BYTES,
+    // CPU time pool workers spent on the thread's parallelFor chunks.
+    PROFILE_HELPER_CPU_NS,
+    PROFILE_COUNTERS
+};
+
+// Counters are kept per thread, so work another thread does at the same
+// time (the operand prefetch loader) is never charged to this thread's
+// scopes. The one exception is parallelFor: a pool worker's chunks count
+// toward the thread that called it, through ProfileHelp.
+class ProfileCounters;
+
+#ifdef PROJECT2_PROFILE
+
+// Measures wall time, the thread's CPU time (plus its pool helpers') and
+// the change in every counter of the thread between construction and
+// destruction, and adds them to the record for kind/name. Records with
+// the same kind and name accumulate.
+class ProfileScope{
+    public:
+        size_t pixels;
+
+        ProfileScope(const char* kind, const string& name);
+        ~ProfileScope();
+
+    private:
+        bool active;
+        const char* kind;
+        string name;
+        double wallStart;
+        double cpuStart;
+        size_t counterStart[PROFILE_COUNTERS];
+
+        ProfileScope(const ProfileScope&);
+        ProfileScope& operator=(const ProfileScope&);
+};
+
+// Adds what the calling thread counts, and the CPU time it uses, while
+// alive to owner's counters.
+class ProfileHelp{
+    public:
+        explicit ProfileHelp(ProfileCounters* owner);
+        ~ProfileHelp();
+
+    private:
+        ProfileCounters* owner;
+        double cpuStart;
+        size_t counterStart[PROFILE_COUNTERS];
+
+        ProfileHelp(const ProfileHelp&);
+        ProfileHelp& operator=(const ProfileHelp&);
+};
+
+void profileCount(ProfileCounter counter, size_t amount);
+// The calling thread's counters.
+ProfileCounters* profileOwner();
+
+#define PROFILE_SCOPE(kind, name) ProfileScope profileScope(kind, name)
+#define PROFILE_PIXELS(count) (profileScope.pixels += (count))
+#define PROFILE_COUNT(counter, amount) profileCount(counter, amount)
+#define PROFILE_OWNER() profileOwner()
+#define PROFILE_HELP(owner) ProfileHelp profileHelp(owner)
+
+#else
+
+#define PROFILE_SCOPE(kind, name) ((void)0)
+#define PROFILE_PIXELS(count) ((void)0)
+#define PROFILE_COUNT(counter, amount) ((void)0)
+#define PROFILE_OWNER() ((ProfileCounters*)0)
+#define PROFILE_HELP(owner) ((void)(owner))
+
+#endif
+
+// Starts recording. Returns false in builds without PROJECT2_PROFILE.
+// The summary table is printed at exit, and the JSON record written to
+// jsonPath when it is not empty.
+bool enableProfile(const string& jsonPath);
+
+#endif
@@ -0,0 +1,445 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+#include "resize.h"
+#include "threadpool.h"
+#include "bufferpool.h"
+#include "profile.h"
+#include "cpu.h"
+
+using namespace std;
+
+// 2x2 averaging: out[i] = (top[2i] + top[2i + 1] + bottom[2i] + bottom[2i + 1] + 2) / 4
+// per channel, for count output pixels of interleaved BGR (halvePixels),
+// BGRA (halveQuads) or of a single plane (halveBytes).
+typedef void (*HalveKernel)(const unsigned char* top, const unsigned char* bottom, unsigned char* out,
+                            size_t count);
+// total[i] += weight * row[i]: one input row's share of an output row. The
+// vector versions multiply and add separately, so every level produces
+// the same floats.
+typedef void (*AccumulateKernel)(float* total, const unsigned char* row, float weight, size_t count);
+
+struct ResizeKernels {
+    HalveKernel halvePixels;
+    HalveKernel halveQuads;
+    HalveKernel halveBytes;
+    AccumulateKernel accumulate;
+};
+
+static void halveScalar(const unsigned char* top, const unsigned char* bottom, unsigned char* out, size_t count,
+                        size_t channels) {
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* t = top + i * 2 * channels;
+        const unsigned char* b = bottom + i * 2 * channels;
+        for (size_t c = 0; c < channels; c++) {
+            out[i * channels + c] = (unsigned char)((t[c] + t[c + channels] + b[c] + b[c + channels] + 2) >> 2);
+        }
+    }
+}
+
+static void halvePixelsScalar(const unsigned char* top, const unsigned char* bottom, unsigned char* out,
+                              size_t count) {
+    halveScalar(top, bottom, out, count, 3);
+}
+
+static void halveQuadsScalar(const unsigned char* top, const unsigned char* bottom, unsigned char* out,
+                             size_t count) {
+    halveScalar(top, bottom, out, count, 4);
+}
+
+static void halveBytesScalar(const unsigned char* top, const unsigned char* bottom, unsigned char* out,
+                             size_t count) {
+    halveScalar(top, bottom, out, count, 1);
+}
+
+static void accumulateScalar(float* total, const unsigned char* row, float weight, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        total[i] += weight * row[i];
+    }
+}
+
+// Even and odd bytes of sixteen, widened: the two halves of eight pairs.
+static inline __m128i pairSumsSSE2(__m128i bytes) {
+    __m128i even = _mm_and_si128(bytes, _mm_set1_epi16(0xff));
+    return _mm_add_epi16(even, _mm_srli_epi16(bytes, 8));
+}
+
+static void halveBytesSSE2(const unsigned char* top, const unsigned char* bottom, unsigned char* out,
+                           size_t count) {
+    __m128i two = _mm_set1_epi16(2);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i* t = reinterpret_cast<const __m128i*>(top + 2 * i);
+        const __m128i* b = reinterpret_cast<const __m128i*>(bottom + 2 * i);
+        __m128i low = _mm_add_epi16(pairSumsSSE2(_mm_loadu_si128(t)), pairSumsSSE2(_mm_loadu_si128(b)));
+        __m128i high = _mm_add_epi16(pairSumsSSE2(_mm_loadu_si128(t + 1)), pairSumsSSE2(_mm_loadu_si128(b + 1)));
+        low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+        high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(low, high));
+    }
+    halveBytesScalar(top + 2 * i, bottom + 2 * i, out + i, count - i);
+}
+
+// Four-byte pixels need no shuffle: the two pixels of a pair are the two
+// 64-bit halves of a widened register.
+static inline __m128i pixelPairSumsSSE2(__m128i bytes) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    __m128i high = _mm_unpackhi_epi8(bytes, zero);
+    return _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+}
+
+static void halveQuadsSSE2(const unsigned char* top, const unsigned char* bottom, unsigned char* out,
+                           size_t count) {
+    __m128i two = _mm_set1_epi16(2);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i* t = reinterpret_cast<const __m128i*>(top + 8 * i);
+        const __m128i* b = reinterpret_cast<const __m128i*>(bottom + 8 * i);
+        __m128i low = _mm_add_epi16(pixelPairSumsSSE2(_mm_loadu_si128(t)), pixelPairSumsSSE2(_mm_loadu_si128(b)));
+        __m128i high = _mm_add_epi16(pixelPairSumsSSE2(_mm_loadu_si128(t + 1)),
+                                     pixelPairSumsSSE2(_mm_loadu_si128(b + 1)));
+        low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+        high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), _mm_packus_epi16(low, high));
+    }
+    halveQuadsScalar(top + 8 * i, bottom + 8 * i, out + 4 * i, count - i);
+}
+
+static void accumulateSSE2(float* total, const unsigned char* row, float weight, size_t count) {
+    __m128 w = _mm_set1_ps(weight);
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i words[4] = {_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                            _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)};
+        for (int j = 0; j < 4; j++) {
+            __m128 sum = _mm_loadu_ps(total + i + 4 * j);
+            sum = _mm_add_ps(sum, _mm_mul_ps(w, _mm_cvtepi32_ps(words[j])));
+            _mm_storeu_ps(total + i + 4 * j, sum);
+        }
+    }
+    accumulateScalar(total + i, row + i, weight, count - i);
+}
+
+// Each 128-bit lane takes four input pixels (12 bytes) of a row and
+// widens the first and second pixel of both pairs into 16-bit lanes, so
+// one lane yields two output pixels. The lanes read 16 bytes at offsets 0
+// and 12 and store 8 bytes at offsets 0 and 6: the second store covers the
+// two spare bytes of the first, and the next iteration those of the
+// second.
+__attribute__((target("avx2")))
+static void halvePixelsAVX2(const unsigned char* top, const unsigned char* bottom, unsigned char* out,
+                            size_t count) {
+    const __m256i firsts = _mm256_setr_epi8(0, -1, 1, -1, 2, -1, 6, -1, 7, -1, 8, -1, -1, -1, -1, -1,
+                                            0, -1, 1, -1, 2, -1, 6, -1, 7, -1, 8, -1, -1, -1, -1, -1);
+    const __m256i seconds = _mm256_setr_epi8(3, -1, 4, -1, 5, -1, 9, -1, 10, -1, 11, -1, -1, -1, -1, -1,
+                                             3, -1, 4, -1, 5, -1, 9, -1, 10, -1, 11, -1, -1, -1, -1, -1);
+    const __m256i two = _mm256_set1_epi16(2);
+    size_t i = 0;
+    // The second load ends 4 bytes past the 24 input bytes it covers.
+    for (; i * 6 + 28 <= count * 6; i += 4) {
+        const unsigned char* t = top + i * 6;
+        const unsigned char* b = bottom + i * 6;
+        __m256i tv = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(t + 12)), 1);
+        __m256i bv = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 12)), 1);
+        __m256i sum = _mm256_add_epi16(_mm256_shuffle_epi8(tv, firsts), _mm256_shuffle_epi8(tv, seconds));
+        sum = _mm256_add_epi16(sum, _mm256_shuffle_epi8(bv, firsts));
+        sum = _mm256_add_epi16(sum, _mm256_shuffle_epi8(bv, seconds));
+        sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+        __m256i bytes = _mm256_packus_epi16(sum, sum);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * 3), _mm256_castsi256_si128(bytes));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * 3 + 6), _mm256_extracti128_si256(bytes, 1));
+    }
+    halvePixelsScalar(top + i * 6, bottom + i * 6, out + i * 3, count - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulateAVX2(float* total, const unsigned char* row, float weight, size_t count) {
+    __m256 w = _mm256_set1_ps(weight);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+        _mm256_storeu_ps(total + i, _mm256_add_ps(_mm256_loadu_ps(total + i), _mm256_mul_ps(w, low)));
+        _mm256_storeu_ps(total + i + 8, _mm256_add_ps(_mm256_loadu_ps(total + i + 8), _mm256_mul_ps(w, high)));
+    }
+    accumulateScalar(total + i, row + i, weight, count - i);
+}
+
+static const ResizeKernels scalarKernels = {halvePixelsScalar, halveQuadsScalar, halveBytesScalar,
+                                            accumulateScalar};
+// Without a byte shuffle, SSE2 leaves BGR pixels to the scalar kernel.
+static const ResizeKernels sse2Kernels = {halvePixelsScalar, halveQuadsSSE2, halveBytesSSE2, accumulateSSE2};
+static const ResizeKernels avx2Kernels = {halvePixelsAVX2, halveQuadsSSE2, halveBytesSSE2, accumulateAVX2};
+
+// AVX-512 runs the AVX2 kernels: halving is bound by memory, not width.
+static const ResizeKernels* resizeKernels() {
+    switch (activeIsa()) {
+        case ISA_SSE2: return &sse2Kernels;
+        case ISA_AVX2:
+        case ISA_AVX512: return &avx2Kernels;
+        default: return &scalarKernels;
+    }
+}
+
+static void halveImage(const unsigned char* in, size_t inWidth, unsigned char* out, size_t outWidth,
+                       size_t outHeight, size_t channels) {
+    const ResizeKernels* kernels = resizeKernels();
+    HalveKernel kernel = kernels->halvePixels;
+    if (channels == 1) {
+        kernel = kernels->halveBytes;
+    }
+    else if (channels == 4) {
+        kernel = kernels->halveQuads;
+    }
+    size_t inRow = inWidth * channels;
+    size_t outRow = outWidth * channels;
+    parallelRows(outWidth * outHeight, outWidth, [=](size_t begin, size_t end) {
+        for (size_t y = begin / outWidth; y < end / outWidth; y++) {
+            const unsigned char* top = in + 2 * y * inRow;
+            kernel(top, top + inRow, out + y * outRow, outWidth);
+        }
+    });
+}
+
+// General path
+
+// The input samples each output sample o of one axis reads: taps
+// consecutive samples from first[o], with weights [o * taps, (o + 1) * taps).
+// Outputs that need fewer samples have zero weights for the rest.
+class AxisTaps{
+    public:
+        vector<size_t> first;
+        vector<float> weight;
+        size_t taps;
+
+        AxisTaps(size_t in, size_t out);
+};
+
+AxisTaps::AxisTaps(size_t in, size_t out) {
+    vector<size_t> starts;
+    vector<vector<float> > weights(out);
+    double scale = (double)in / out;
+    for (size_t o = 0; o < out; o++) {
+        size_t start = 0;
+        if (out <= in) {
+            // Area: the overlap of each input sample with [low, high).
+            double low = o * scale;
+            double high = (o + 1) * scale;
+            start = (size_t)low;
+            for (size_t i = start; i < in && i < high; i++) {
+                double overlap = min(high, (double)i + 1) - max(low, (double)i);
+                weights[o].push_back((float)(max(overlap, 0.0) / scale));
+            }
+        }
+        else {
+            // Bilinear between the two nearest sample centres.
+            double source = (o + 0.5) * scale - 0.5;
+            source = min(max(source, 0.0), (double)(in - 1));
+            start = (size_t)source;
+            float fraction = (float)(source - start);
+            weights[o].push_back(1 - fraction);
+            if (fraction > 0) {
+                weights[o].push_back(fraction);
+            }
+        }
+        starts.push_back(start);
+    }
+    taps = 1;
+    for (size_t o = 0; o < out; o++) {
+        taps = max(taps, weights[o].size());
+    }
+    first.resize(out);
+    weight.assign(out * taps, 0.0f);
+    for (size_t o = 0; o < out; o++) {
+        // Near the end the window moves back to stay inside the axis.
+        size_t start = min(starts[o], in - taps);
+        first[o] = start;
+        for (size_t k = 0; k < weights[o].size(); k++) {
+            weight[o * taps + starts[o] - start + k] = weights[o][k];
+        }
+    }
+}
+
+static unsigned char toByte(float value) {
+    return (unsigned char)(min(max(value, 0.0f), 255.0f) + 0.5f);
+}
+
+// One output row: the input rows it reads are summed with their weights
+// into a row of floats, which is then resampled horizontally. Each input
+// row is visited once per output row that covers it.
+static void resampleRow(const float* source, unsigned char* target, const AxisTaps& columns, size_t outWidth,
+                        size_t channels) {
+    size_t taps = columns.taps;
+    const float* weight = columns.weight.data();
+    if (channels == 1) {
+        for (size_t x = 0; x < outWidth; x++) {
+            const float* sample = source + columns.first[x];
+            const float* w = weight + x * taps;
+            float total = 0;
+            for (size_t k = 0; k < taps; k++) {
+                total += w[k] * sample[k];
+            }
+            target[x] = toByte(total);
+        }
+        return;
+    }
+    if (channels == 4) {
+        for (size_t x = 0; x < outWidth; x++) {
+            const float* sample = source + columns.first[x] * 4;
+            const float* w = weight + x * taps;
+            float total[4] = {0, 0, 0, 0};
+            for (size_t k = 0; k < taps; k++) {
+                for (size_t c = 0; c < 4; c++) {
+                    total[c] += w[k] * sample[k * 4 + c];
+                }
+            }
+            for (size_t c = 0; c < 4; c++) {
+                target[x * 4 + c] = toByte(total[c]);
+            }
+        }
+        return;
+    }
+    for (size_t x = 0; x < outWidth; x++) {
+        const float* sample = source + columns.first[x] * 3;
+        const float* w = weight + x * taps;
+        float blue = 0;
+        float green = 0;
+        float red = 0;
+        for (size_t k = 0; k < taps; k++) {
+            blue += w[k] * sample[k * 3];
+            green += w[k] * sample[k * 3 + 1];
+            red += w[k] * sample[k * 3 + 2];
+        }
+        target[x * 3] = toByte(blue);
+        target[x * 3 + 1] = toByte(green);
+        target[x * 3 + 2] = toByte(red);
+    }
+}
+
+static void resizeRows(const unsigned char* in, size_t inWidth, unsigned char* out, size_t outWidth,
+                       size_t channels, const AxisTaps& columns, const AxisTaps& rows, size_t first, size_t last) {
+    static thread_local vector<float> sum;
+    size_t inLength = inWidth * channels;
+    sum.resize(inLength);
+    float* total = sum.data();
+    AccumulateKernel accumulate = resizeKernels()->accumulate;
+    for (size_t y = first; y < last; y++) {
+        fill(sum.begin(), sum.end(), 0.0f);
+        for (size_t k = 0; k < rows.taps; k++) {
+            float w = rows.weight[y * rows.taps + k];
+            if (w != 0) {
+                accumulate(total, in + (rows.first[y] + k) * inLength, w, inLength);
+            }
+        }
+        resampleRow(total, out + y * outWidth * channels, columns, outWidth, channels);
+    }
+}
+
+void resizeImage(const unsigned char* in, size_t inWidth, size_t inHeight, unsigned char* out,
+                 size_t outWidth, size_t outHeight, size_t channels) {
+    if (inWidth == 2 * outWidth && inHeight == 2 * outHeight) {
+        halveImage(in, inWidth, out, outWidth, outHeight, channels);
+        return;
+    }
+    AxisTaps columns(inWidth, outWidth);
+    AxisTaps rows(inHeight, outHeight);
+    parallelRows(outWidth * outHeight, outWidth, [&](size_t begin, size_t end) {
+        resizeRows(in, inWidth, out, outWidth, channels, columns, rows, begin / outWidth, end / outWidth);
+    });
+}
+
+// Pyramids
+
+string pyramidLevelPath(const string& outputPath, size_t level) {
+    return outputPath.substr(0, outputPath.size() - 4) + "_" + to_string(level) + ".tga";
+}
+
+static int halfSide(short side) {
+    return max((unsigned short)side / 2, 1);
+}
+
+static void nextLevel(const Picture& from, Picture& to) {
+    to.copyHeader(from);
+    to.resize(from, halfSide(from.width), halfSide(from.height), to);
+}
+
+static void nextLevel(const PlanarPicture& from, PlanarPicture& to) {
+    size_t width = halfSide(from.header.width);
+    size_t height = halfSide(from.header.height);
+    to.header.copyHeader(from.header);
+    to.header.width = (short)width;
+    to.header.height = (short)height;
+    to.planes[PLANE_ALPHA].resize(from.hasAlpha() ? width * height : 0);
+    to.gray = from.gray;
+    to.resize(width * height);
+    for (int c = 0; c < from.planeCount(); c++) {
+        resizeImage(from.planes[c].data(), (unsigned short)from.header.width, (unsigned short)from.header.height,
+                    to.planes[c].data(), width, height, 1);
+    }
+}
+
+static bool writeLevel(const Picture& image, const string& filePath) {
+    return image.writeData(filePath, image);
+}
+
+static bool writeLevel(const PlanarPicture& image, const string& filePath) {
+    return image.writeData(filePath);
+}
+
+static void releaseLevel(Picture& image) {
+    defaultBufferPool().release(image);
+}
+
+static void releaseLevel(PlanarPicture&) {
+}
+
+// Two level buffers alternate: the next level is computed into the one
+// whose write has finished while the other is still being written.
+template <class Image>
+static bool writeLevels(const Image& image, size_t levels, const string& outputPath) {
+    PROFILE_SCOPE("pyramid", outputPath);
+    Image buffers[2];
+    const Image* from = &image;
+    bool written = true;
+    thread writer;
+    for (size_t level = 1; level <= levels; level++) {
+        Image& to = buffers[level % 2];
+        nextLevel(*from, to);
+        if (writer.joinable()) {
+            writer.join();
+        }
+        string path = pyramidLevelPath(outputPath, level);
+        writer = thread([&to, &written, path] {
+            written = writeLevel(to, path) && written;
+        });
+        from = &to;
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+    releaseLevel(buffers[0]);
+    releaseLevel(buffers[1]);
+    return written;
+}
+
+bool writePyramid(const Picture& image, size_t levels, const string& outputPath) {
+    return levels == 0 || writeLevels(image, levels, outputPath);
+}
+
+bool writePyramid(const PlanarPicture& image, size_t levels, const string& outputPath) {
+    return levels == 0 || writeLevels(image, levels, outputPath);
+}
@@ -0,0 +1,30 @@
+#ifndef resize_h
+#define resize_h
+
+#include <cstddef>
+#include <string>
+#include "tgaimage.h"
+#include "planar.h"
+using namespace std;
+
+// Resampling of 8-bit rows of interleaved channels (3 for Pixel data, 4
+// for AlphaPixel, 1 for a single plane) from inWidth x inHeight to outWidth x outHeight. out
+// must not alias in.
+//
+// Each axis is reduced by area averaging (an output pixel is the mean of
+// the input area it covers) or enlarged bilinearly. Halving both axes
+// exactly runs the vectorized 2x2 averaging kernels instead. Output rows
+// are split into bands on the thread pool.
+void resizeImage(const unsigned char* in, size_t inWidth, size_t inHeight, unsigned char* out,
+                 size_t outWidth, size_t outHeight, size_t channels);
+
+// Mipmap pyramids. Level n + 1 is level n resized to half its width and
+// height (at least 1), level 0 being the image itself; the output file of
+// level n is out_n.tga for out.tga. writePyramid writes levels 1 to levels
+// and leaves level 0 to the caller. Each level is written on a separate
+// thread while the next one is computed.
+string pyramidLevelPath(const string& outputPath, size_t level);
+bool writePyramid(const Picture& image, size_t levels, const string& outputPath);
+bool writePyramid(const PlanarPicture& image, size_t levels, const string& outputPath);
+
+#endif
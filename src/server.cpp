@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "server.h"
+#include "cache.h"
+#include "tgaio.h"
+#include "threadpool.h"
+#include "bufferpool.h"
+#include "resize.h"
+
+using namespace std;
+
+static const size_t DEFAULT_RESIDENT_BYTES = (size_t)512 * 1024 * 1024;
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static double percentile(vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    sort(values.begin(), values.end());
+    size_t index = (size_t)(p / 100.0 * (values.size() - 1) + 0.5);
+    return values[min(index, values.size() - 1)];
+}
+
+static void printLatency(const string& label, const vector<double>& seconds) {
+    char line[160];
+    snprintf(line, sizeof(line), "%s: %zu requests, p50 %.1f us, p99 %.1f us, max %.1f us",
+             label.c_str(), seconds.size(), percentile(seconds, 50) * 1e6, percentile(seconds, 99) * 1e6,
+             percentile(seconds, 100) * 1e6);
+    cout << line << endl;
+}
+
+static bool sendLine(int fd, const string& line) {
+    string framed = line + "\n";
+    return writeFully(fd, framed.data(), framed.size());
+}
+
+// Reads up to the next newline; pending holds bytes received past it.
+static bool receiveLine(int fd, string& pending, string& line) {
+    while (true) {
+        size_t end = pending.find('\n');
+        if (end != string::npos) {
+            line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            return true;
+        }
+        char buffer[4096];
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        pending.append(buffer, got);
+    }
+}
+
+static bool socketAddress(const string& socketPath, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cout << "Socket path " << socketPath << " is too long." << endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    return true;
+}
+
+// ResidentOperands
+
+// A resident picture's pixel bytes, in whichever layout it was decoded.
+static size_t residentBytes(const Picture& picture) {
+    return picture.pixels.size() * sizeof(Pixel) + picture.grayPixels.size() +
+           picture.alphaPixels.size() * sizeof(AlphaPixel);
+}
+
+ResidentOperands::ResidentOperands() {
+    limit = DEFAULT_RESIDENT_BYTES;
+    bytes = 0;
+    useClock = 0;
+}
+
+bool ResidentOperands::acquire(const string& filePath, shared_ptr<const Picture>& picture) {
+    string identity;
+    if (!fileIdentity(filePath, identity)) {
+        return false;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        map<string, Resident>::iterator found = residents.find(filePath);
+        if (found != residents.end() && found->second.identity == identity) {
+            found->second.lastUse = ++useClock;
+            picture = found->second.picture;
+            return true;
+        }
+    }
+
+    // Decoded outside the lock so other requests keep going; two requests
+    // missing on the same file at once both decode it.
+    shared_ptr<Picture> decoded(new Picture);
+    if (!decoded->readData(filePath, *decoded)) {
+        return false;
+    }
+    picture = decoded;
+
+    lock_guard<mutex> guard(lock);
+    Resident& resident = residents[filePath];
+    if (resident.picture) {
+        bytes -= residentBytes(*resident.picture);
+    }
+    resident.identity = identity;
+    resident.picture = picture;
+    resident.lastUse = ++useClock;
+    bytes += residentBytes(*picture);
+
+    while (bytes > limit && residents.size() > 1) {
+        map<string, Resident>::iterator oldest = residents.end();
+        for (map<string, Resident>::iterator it = residents.begin(); it != residents.end(); ++it) {
+            if (it->first != filePath && (oldest == residents.end() || it->second.lastUse < oldest->second.lastUse)) {
+                oldest = it;
+            }
+        }
+        bytes -= residentBytes(*oldest->second.picture);
+        residents.erase(oldest);
+    }
+    return true;
+}
+
+// Server
+
+Server::Server() {
+    outputType = 0;
+    edge = EDGE_CLAMP;
+    grayOutput = false;
+    listener = -1;
+    stopping = false;
+}
+
+bool Server::run() {
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        return false;
+    }
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, 64) != 0) {
+        cout << "Could not listen on " << socketPath << ": " << strerror(errno) << endl;
+        return false;
+    }
+    // A client that disconnects early must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+    cout << "Listening on " << socketPath << " with " << threadCount() << " threads." << endl;
+
+    // Connections get their own threads so an idle client never holds a
+    // pool worker; the image work of every request still runs on the pool.
+    while (!stopping) {
+        int connection = accept(listener, 0, 0);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        {
+            lock_guard<mutex> guard(connectionsLock);
+            if (stopping) {
+                close(connection);
+                break;
+            }
+            openConnections.insert(connection);
+        }
+        thread([this, connection]() {
+            serve(connection);
+            lock_guard<mutex> guard(connectionsLock);
+            openConnections.erase(connection);
+            close(connection);
+            connectionsDone.notify_all();
+        }).detach();
+    }
+    {
+        unique_lock<mutex> guard(connectionsLock);
+        connectionsDone.wait(guard, [this]() { return openConnections.empty(); });
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    printLatency("Served", serviceSeconds);
+    return true;
+}
+
+void Server::serve(int connection) {
+    string pending, request;
+    while (!stopping && receiveLine(connection, pending, request)) {
+        if (request == "shutdown") {
+            stopping = true;
+            sendLine(connection, "OK 0");
+            // Wakes the accept loop and the connections waiting for a request;
+            // requests already running finish first.
+            lock_guard<mutex> guard(connectionsLock);
+            shutdown(listener, SHUT_RDWR);
+            for (set<int>::iterator it = openConnections.begin(); it != openConnections.end(); ++it) {
+                shutdown(*it, SHUT_RD);
+            }
+            return;
+        }
+        // Messages such as stats go back to the client ahead of the reply.
+        MessageCapture messages;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        string error = handle(request);
+        double elapsed = secondsSince(start);
+        {
+            lock_guard<mutex> guard(statsLock);
+            serviceSeconds.push_back(elapsed);
+        }
+        stringstream lines(messages.text);
+        string line;
+        while (getline(lines, line)) {
+            if (!sendLine(connection, "OUT " + line)) {
+                return;
+            }
+        }
+        if (!sendLine(connection, error.empty() ? "OK " + to_string((long long)(elapsed * 1e6)) : "ERROR " + error)) {
+            return;
+        }
+    }
+}
+
+// Runs one request; returns the error, or an empty string on success.
+string Server::handle(const string& request) {
+    vector<string> fields;
+    stringstream split(request);
+    string field;
+    while (getline(split, field, '\t')) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 3) {
+        return "expected directory, output and first image";
+    }
+
+    // Relative paths are the client's, so they are resolved against its
+    // working directory: the output, the first image and every .tga operand.
+    const string& directory = fields[0];
+    if (directory.empty() || directory[0] != '/') {
+        return "expected an absolute client directory";
+    }
+    if (!validOutputFileName(fields[1])) {
+        return "invalid output file name";
+    }
+    vector<char*> argv;
+    argv.push_back(const_cast<char*>("project2.out"));
+    for (size_t i = 1; i < fields.size(); i++) {
+        string& argument = fields[i];
+        bool path = i <= 2 || (argument.size() >= 4 && argument.substr(argument.size() - 4) == ".tga");
+        if (path && !argument.empty() && argument[0] != '/') {
+            argument = directory + "/" + argument;
+        }
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    if (!validFileName(fields[2])) {
+        return "invalid first image";
+    }
+    argv.push_back(0);
+    int argc = (int)argv.size() - 1;
+
+    Pipeline pipeline;
+    pipeline.verbose = false;
+    pipeline.edge = edge;
+    pipeline.grayOutput = grayOutput;
+    if (!pipeline.parse(argc, argv.data(), 3)) {
+        return "invalid methods";
+    }
+    OperandStore store;
+    for (size_t i = 0; i < pipeline.operations.size(); i++) {
+        for (size_t j = 0; j < pipeline.operations[i].operands.size(); j++) {
+            const string& path = pipeline.operations[i].operands[j];
+            shared_ptr<const Picture> picture;
+            if (!operands.acquire(path, picture)) {
+                return "could not read " + path;
+            }
+            store.adopt(path, picture);
+        }
+    }
+
+    // The image buffer goes back to the pool for the next request.
+    Picture image;
+    string error;
+    if (!image.readData(argv[2], image)) {
+        error = "could not read " + string(argv[2]);
+    }
+    else if (!pipeline.execute(image, store)) {
+        error = "pipeline failed";
+    }
+    else {
+        if (outputType) {
+            setRunLength(image, outputType == TGA_TRUECOLOR_RLE);
+        }
+        if (!image.writeData(argv[1], image)) {
+            error = "could not write " + string(argv[1]);
+        }
+        else if (!writePyramid(image, pipeline.pyramidLevels(), argv[1])) {
+            error = "could not write pyramid of " + string(argv[1]);
+        }
+    }
+    defaultBufferPool().release(image);
+    return error;
+}
+
+// Client
+
+static bool forkRequest(const vector<string>& args) {
+    pid_t child = fork();
+    if (child < 0) {
+        return false;
+    }
+    if (child == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        vector<char*> argv;
+        argv.push_back(const_cast<char*>("project2.out"));
+        for (size_t i = 0; i < args.size(); i++) {
+            argv.push_back(const_cast<char*>(args[i].c_str()));
+        }
+        argv.push_back(0);
+        execv("/proc/self/exe", argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool runClient(const string& socketPath, const vector<string>& args, size_t count, bool fork) {
+    int connection = -1;
+    string request;
+    if (!fork) {
+        sockaddr_un address;
+        if (!socketAddress(socketPath, address)) {
+            return false;
+        }
+        connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            cout << "Could not connect to " << socketPath << ": " << strerror(errno) << endl;
+            if (connection >= 0) {
+                close(connection);
+            }
+            return false;
+        }
+        char directory[4096];
+        request = getcwd(directory, sizeof(directory)) ? directory : ".";
+        for (size_t i = 0; i < args.size(); i++) {
+            request += "\t" + args[i];
+        }
+        if (args.size() == 1 && args[0] == "shutdown") {
+            request = "shutdown";
+        }
+    }
+
+    vector<double> seconds;
+    string pending, reply, output;
+    bool ok = true;
+    for (size_t i = 0; ok && i < count; i++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (fork) {
+            ok = forkRequest(args);
+            reply = ok ? "OK" : "ERROR request failed";
+        }
+        else {
+            // Only the last request's output is printed.
+            output.clear();
+            string line;
+            ok = sendLine(connection, request);
+            while (ok && (ok = receiveLine(connection, pending, line)) && line.compare(0, 4, "OUT ") == 0) {
+                output += line.substr(4) + "\n";
+            }
+            reply = ok ? line : "";
+            ok = ok && reply.compare(0, 2, "OK") == 0;
+        }
+        seconds.push_back(secondsSince(start));
+    }
+    if (connection >= 0) {
+        close(connection);
+    }
+    cout << output;
+    cout << (reply.empty() ? "ERROR no reply" : reply) << endl;
+    printLatency(fork ? "Fork per request" : "Server", seconds);
+    return ok;
+}
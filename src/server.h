@@ -0,0 +1,75 @@
+#ifndef server_h
+#define server_h
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "pipeline.h"
+using namespace std;
+
+// Operand layers kept decoded between requests, shared by every request
+// that names them. A layer is decoded again when its file changes. Past
+// limit bytes the least recently used layers are dropped; requests still
+// running on one keep it alive until they finish.
+class ResidentOperands{
+    public:
+        size_t limit;
+
+        ResidentOperands();
+        bool acquire(const string& filePath, shared_ptr<const Picture>& picture);
+
+    private:
+        struct Resident{
+            string identity;
+            shared_ptr<const Picture> picture;
+            unsigned long long lastUse;
+        };
+        map<string, Resident> residents;
+        size_t bytes;
+        unsigned long long useClock;
+        mutex lock;
+};
+
+// Long-running server on a Unix domain socket. A request is one line of
+// tab-separated fields: the client's working directory, then the same
+// arguments main takes (output, first image, methods...). The reply is
+// "OK <microseconds>" or "ERROR <reason>", after one "OUT <line>" for
+// each line the request printed (such as stats). A connection may send any
+// number of requests; the line "shutdown" stops the server. Each
+// connection is served on its own thread, and the requests' image work
+// runs on the shared pool.
+class Server{
+    public:
+        string socketPath;
+        ResidentOperands operands;
+        char outputType;
+        EdgeMode edge;
+        bool grayOutput;
+
+        Server();
+        bool run();
+
+    private:
+        int listener;
+        atomic<bool> stopping;
+        mutex statsLock;
+        vector<double> serviceSeconds;
+        mutex connectionsLock;
+        condition_variable connectionsDone;
+        set<int> openConnections;
+
+        void serve(int connection);
+        string handle(const string& request);
+};
+
+// Sends the request in args (main's arguments) count times over one
+// connection, or with fork set runs this program once per request
+// instead, and prints the p50/p99 latency.
+bool runClient(const string& socketPath, const vector<string>& args, size_t count, bool fork);
+
+#endif
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stream.h"
+#include "kernels.h"
+#include "tgaio.h"
+#include "profile.h"
+
+using namespace std;
+
+static const size_t DEFAULT_BAND_BYTES = 4 * 1024 * 1024;
+
+// An open input file and the pixels of its current band.
+class StreamSource{
+    public:
+        string path;
+        int fd;
+        Picture header;
+        vector<Pixel> band;
+        bool truncated;
+
+        StreamSource() {
+            fd = -1;
+            truncated = false;
+        }
+
+        ~StreamSource() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        bool open(const string& filePath) {
+            path = filePath;
+            fd = ::open(filePath.c_str(), O_RDONLY);
+            unsigned char buffer[TGA_HEADER_SIZE];
+            if (fd < 0 || !readFully(fd, buffer, sizeof(buffer))) {
+                cout << "File not found" << endl;
+                return false;
+            }
+            PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+            decodeHeader(buffer, header);
+            if (header.dataTypeCode != TGA_TRUECOLOR || header.bitsPerPixel != 24) {
+                cout << filePath << ": streaming needs uncompressed 24-bit TGA." << endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Loads pixels [begin, end) of the file, or their mirror image
+        // [total - end, total - begin) reversed when mirrored is set, so the
+        // band lines up with output pixels [begin, end) either way.
+        bool load(size_t begin, size_t end, size_t total, bool mirrored) {
+            size_t count = end - begin;
+            size_t first = mirrored ? total - end : begin;
+            band.resize(count);
+            char* target = reinterpret_cast<char*>(band.data());
+            size_t wanted = count * sizeof(Pixel);
+            off_t offset = pixelDataOffset(header) + (off_t)first * sizeof(Pixel);
+            size_t got = 0;
+            while (got < wanted) {
+                ssize_t n = pread(fd, target + got, wanted - got, offset + got);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                PROFILE_COUNT(PROFILE_BYTES_READ, n);
+                got += n;
+            }
+            // Like readData, missing data reads as black and is reported
+            // once.
+            fill(target + got, target + wanted, 0);
+            if (got < wanted && !truncated) {
+                truncated = true;
+                cout << "Image data in " << path << " ends early." << endl;
+            }
+            if (mirrored) {
+                flipPixels(band.data(), count);
+            }
+            return true;
+        }
+};
+
+StreamRunner::StreamRunner() {
+    bandRows = 0;
+    outputType = 0;
+}
+
+bool StreamRunner::run(const Pipeline& pipeline, const string& inputPath, const string& outputPath) const {
+    PROFILE_SCOPE("stream", inputPath);
+    const vector<Operation>& operations = pipeline.operations;
+    for (size_t i = 0; i < operations.size(); i++) {
+        if (!operations[i].isPointOperation() && operations[i].type != OP_FLIP) {
+            cout << operations[i].name << " is not supported with --stream." << endl;
+            return false;
+        }
+    }
+
+    StreamSource input;
+    if (!input.open(inputPath)) {
+        return false;
+    }
+    size_t width = (unsigned short)input.header.width;
+    size_t total = imagePixelCount(input.header);
+
+    // flipsAfter[i]: flips still to come after operation i. An odd count
+    // means that operation sees the image mirrored relative to the output.
+    vector<size_t> flipsAfter(operations.size() + 1, 0);
+    for (size_t i = operations.size(); i-- > 0;) {
+        flipsAfter[i] = flipsAfter[i + 1] + (operations[i].type == OP_FLIP ? 1 : 0);
+    }
+    size_t inputFlips = operations.empty() ? 0 : flipsAfter[0];
+
+    vector<vector<StreamSource*> > sources(operations.size());
+    vector<StreamSource*> owned;
+    bool ok = true;
+    for (size_t i = 0; ok && i < operations.size(); i++) {
+        for (size_t j = 0; ok && j < operations[i].operands.size(); j++) {
+            StreamSource* source = new StreamSource;
+            owned.push_back(source);
+            sources[i].push_back(source);
+            ok = source->open(operations[i].operands[j]);
+            if (ok && imagePixelCount(source->header) < total) {
+                cout << "Operand " << operations[i].operands[j] << " is smaller than the image." << endl;
+                ok = false;
+            }
+        }
+    }
+
+    int out = -1;
+    if (ok) {
+        out = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            cout << "File not found" << endl;
+            ok = false;
+        }
+        PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+    }
+    Picture header;
+    header.copyHeader(input.header);
+    pipeline.updateType(header, false);
+    if (outputType) {
+        setRunLength(header, outputType == TGA_TRUECOLOR_RLE);
+    }
+    size_t pixelBytes = storedPixelBytes(header, false);
+    bool runLength = isRunLength(header);
+    if (ok) {
+        unsigned char buffer[TGA_HEADER_SIZE];
+        encodeHeader(header, pixelBytes, buffer);
+        ok = writeFully(out, buffer, sizeof(buffer));
+    }
+
+    size_t rows = bandRows;
+    if (rows == 0) {
+        rows = max<size_t>(DEFAULT_BAND_BYTES / (max<size_t>(width, 1) * sizeof(Pixel)), 1);
+    }
+    size_t bandPixels = rows * max<size_t>(width, 1);
+    vector<Stage> stages = pipeline.plan();
+    vector<vector<ImageView> > inputs(operations.size());
+    vector<unsigned char> packed;
+    vector<unsigned char> encoded;
+
+    for (size_t begin = 0; ok && begin < total; begin += bandPixels) {
+        size_t end = min(total, begin + bandPixels);
+        size_t count = end - begin;
+        PROFILE_PIXELS(count);
+        input.load(begin, end, total, inputFlips % 2 == 1);
+        for (size_t i = 0; i < operations.size(); i++) {
+            inputs[i].clear();
+            for (size_t j = 0; j < sources[i].size(); j++) {
+                sources[i][j]->load(begin, end, total, flipsAfter[i] % 2 == 1);
+                inputs[i].push_back(ImageView(0, 0, sources[i][j]->band.data(), count));
+            }
+        }
+        for (size_t s = 0; s < stages.size(); s++) {
+            if (stages[s].fused) {
+                pipeline.runFused(stages[s], input.band.data(), count, width, inputs);
+            }
+        }
+        // Bands are whole rows, so each one packs and encodes on its own.
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(input.band.data());
+        if (pixelBytes != sizeof(Pixel)) {
+            packed.resize(count * pixelBytes);
+            packPixels(input.band.data(), 0, pixelBytes, packed.data(), count);
+            data = packed.data();
+        }
+        size_t length = count * pixelBytes;
+        if (runLength) {
+            encoded.clear();
+            encodeRle(data, pixelBytes, width, count / max<size_t>(width, 1), encoded);
+            data = encoded.data();
+            length = encoded.size();
+        }
+        ok = writeFully(out, data, length);
+        if (!ok) {
+            cout << "Failed to write " << outputPath << endl;
+        }
+    }
+
+    if (out >= 0) {
+        close(out);
+    }
+    for (size_t i = 0; i < owned.size(); i++) {
+        delete owned[i];
+    }
+    return ok;
+}
@@ -0,0 +1,30 @@
+#ifndef stream_h
+#define stream_h
+
+#include <cstddef>
+#include <string>
+#include "pipeline.h"
+using namespace std;
+
+// Constant-memory execution: the input and every operand file are read in
+// matching row bands, the pipeline runs on each band and the band is
+// appended to the output, so peak memory is about bandRows rows per input
+// whatever the image size. Point operations and flip are supported; a
+// flip is resolved by reading bands from the mirrored end of each file and
+// reversing them, so it costs no pass of its own. Input files must be
+// uncompressed 24-bit TGA; the output takes the type the pipeline gives
+// it (grayscale with --gray) and is run-length encoded band by band with
+// --rle, as packets never span rows.
+class StreamRunner{
+    public:
+        // Rows per band; 0 picks about 4 MB per band.
+        size_t bandRows;
+        // TGA type for the output, or 0 to keep the input's type.
+        char outputType;
+
+        StreamRunner();
+
+        bool run(const Pipeline& pipeline, const string& inputPath, const string& outputPath) const;
+};
+
+#endif
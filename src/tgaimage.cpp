@@ -3,7 +3,23 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "tgaimage.h"
+#include "tgaio.h"
+#include "kernels.h"
+#include "threadpool.h"
+#include "profile.h"
+#include "bufferpool.h"
+#include "filter.h"
+#include "histogram.h"
+#include "resize.h"
+#include "lut.h"
 
 using namespace std;
 
@@ -19,6 +35,20 @@ Pixel::Pixel(char b, char g, char r) {
     red = r;
 }
 
+AlphaPixel::AlphaPixel() {
+    blue = 0;
+    green = 0;
+    red = 0;
+    alpha = 0;
+}
+
+AlphaPixel::AlphaPixel(char b, char g, char r, char a) {
+    blue = b;
+    green = g;
+    red = r;
+    alpha = a;
+}
+
 Picture::Picture() {
     idLength = 0;
     colorMapType = 0;
@@ -36,7 +66,7 @@ Picture::Picture() {
 
 Picture::Picture(char idL, char colorM, char dataT, short colorMapO, short colorMapL,
                  char colorMapD, short xOri, short yOri, short w, short h,
-                 char bitsP, char imageD, vector<Pixel> pixel) {
+                 char bitsP, char imageD, vector<Pixel>&& pixel) {
     idLength = idL;
     colorMapType = colorM;
     dataTypeCode = dataT;
@@ -49,304 +79,1012 @@ Picture::Picture(char idL, char colorM, char dataT, short colorMapO, short color
     height = h;
     bitsPerPixel = bitsP;
     imageDescriptor = imageD;
-    pixels = pixel;
+    pixels.swap(pixel);
 }
 
-// Read and Write
+Picture::Picture(Picture&& other) {
+    copyHeader(other);
+    pixels.swap(other.pixels);
+    grayPixels.swap(other.grayPixels);
+    alphaPixels.swap(other.alphaPixels);
+}
 
-void Picture::readData(const string& filePath, Picture& image) {
-    ifstream file(filePath, ios::in | ios::binary);
-    if (file.is_open()) {
-        file.read(reinterpret_cast<char*>(&image.idLength), sizeof(image.idLength));
-        file.read(reinterpret_cast<char*>(&image.colorMapType), sizeof(image.colorMapType));
-        file.read(reinterpret_cast<char*>(&image.dataTypeCode), sizeof(image.dataTypeCode));
-        file.read(reinterpret_cast<char*>(&image.colorMapOrigin), sizeof(image.colorMapOrigin));
-        file.read(reinterpret_cast<char*>(&image.colorMapLength), sizeof(image.colorMapLength));
-        file.read(reinterpret_cast<char*>(&image.colorMapDepth), sizeof(image.colorMapDepth));
-        file.read(reinterpret_cast<char*>(&image.xOrigin), sizeof(image.xOrigin));
-        file.read(reinterpret_cast<char*>(&image.yOrigin), sizeof(image.yOrigin));
-        file.read(reinterpret_cast<char*>(&image.width), sizeof(image.width));
-        file.read(reinterpret_cast<char*>(&image.height), sizeof(image.height));
-        file.read(reinterpret_cast<char*>(&image.bitsPerPixel), sizeof(image.bitsPerPixel));
-        file.read(reinterpret_cast<char*>(&image.imageDescriptor), sizeof(image.imageDescriptor));
-
-        int imageSize = image.width * image.height;
-        image.pixels.resize(imageSize);
-
-        for(unsigned int i = 0; i < imageSize; i++) {
-            file.read(reinterpret_cast<char*>(&image.pixels[i].blue), sizeof(image.pixels[i].blue));
-            file.read(reinterpret_cast<char*>(&image.pixels[i].green), sizeof(image.pixels[i].green));
-            file.read(reinterpret_cast<char*>(&image.pixels[i].red), sizeof(image.pixels[i].red));
-        }
+Picture& Picture::operator=(Picture&& other) {
+    copyHeader(other);
+    pixels.swap(other.pixels);
+    grayPixels.swap(other.grayPixels);
+    alphaPixels.swap(other.alphaPixels);
+    return *this;
+}
+
+void Picture::copyHeader(const Picture& from) {
+    idLength = from.idLength;
+    colorMapType = from.colorMapType;
+    dataTypeCode = from.dataTypeCode;
+    colorMapOrigin = from.colorMapOrigin;
+    colorMapLength = from.colorMapLength;
+    colorMapDepth = from.colorMapDepth;
+    xOrigin = from.xOrigin;
+    yOrigin = from.yOrigin;
+    width = from.width;
+    height = from.height;
+    bitsPerPixel = from.bitsPerPixel;
+    imageDescriptor = from.imageDescriptor;
+}
 
-        file.close();
+static size_t layoutBytes(PixelLayout layout) {
+    switch (layout) {
+        case LAYOUT_GRAY: return 1;
+        case LAYOUT_BGRA: return sizeof(AlphaPixel);
+        default: return sizeof(Pixel);
     }
-    else {
-        cout << "File not found" << endl;
-    }
-}
-
-void Picture::writeData(const string& filePath, Picture& image) {
-    ofstream file(filePath, ios::out | ios::binary);
-    if (file.is_open()) {
-        file.write(reinterpret_cast<char*>(&image.idLength), sizeof(image.idLength));
-        file.write(reinterpret_cast<char*>(&image.colorMapType), sizeof(image.colorMapType));
-        file.write(reinterpret_cast<char*>(&image.dataTypeCode), sizeof(image.dataTypeCode));
-        file.write(reinterpret_cast<char*>(&image.colorMapOrigin), sizeof(image.colorMapOrigin));
-        file.write(reinterpret_cast<char*>(&image.colorMapLength), sizeof(image.colorMapLength));
-        file.write(reinterpret_cast<char*>(&image.colorMapDepth), sizeof(image.colorMapDepth));
-        file.write(reinterpret_cast<char*>(&image.xOrigin), sizeof(image.xOrigin));
-        file.write(reinterpret_cast<char*>(&image.yOrigin), sizeof(image.yOrigin));
-        file.write(reinterpret_cast<char*>(&image.width), sizeof(image.width));
-        file.write(reinterpret_cast<char*>(&image.height), sizeof(image.height));
-        file.write(reinterpret_cast<char*>(&image.bitsPerPixel), sizeof(image.bitsPerPixel));
-        file.write(reinterpret_cast<char*>(&image.imageDescriptor), sizeof(image.imageDescriptor));
-
-        int imageSize = image.width * image.height;
-        image.pixels.resize(imageSize);
-
-        for(unsigned int i = 0; i < imageSize; i++) {
-            file.write(reinterpret_cast<char*>(&image.pixels[i].blue), sizeof(image.pixels[i].blue));
-            file.write(reinterpret_cast<char*>(&image.pixels[i].green), sizeof(image.pixels[i].green));
-            file.write(reinterpret_cast<char*>(&image.pixels[i].red), sizeof(image.pixels[i].red));
-        }
+}
+
+// The pixels of an image or view as bytes, layoutBytes apiece.
+static const unsigned char* bytesOf(const ImageView& view) {
+    if (view.grayPixels) {
+        return view.grayPixels;
+    }
+    if (view.alphaPixels) {
+        return reinterpret_cast<const unsigned char*>(view.alphaPixels);
+    }
+    return reinterpret_cast<const unsigned char*>(view.pixels);
+}
 
-        file.close();
+static unsigned char* bytesOf(Picture& image) {
+    switch (image.layout()) {
+        case LAYOUT_GRAY: return image.grayPixels.data();
+        case LAYOUT_BGRA: return reinterpret_cast<unsigned char*>(image.alphaPixels.data());
+        default: return reinterpret_cast<unsigned char*>(image.pixels.data());
+    }
+}
+
+void Picture::copyFrom(const Picture& from) {
+    copyHeader(from);
+    allocate(from.layout(), from.size());
+    if (from.size() > 0) {
+        memcpy(bytesOf(*this), bytesOf(ImageView(from)), from.size() * layoutBytes(from.layout()));
+    }
+}
+
+PixelLayout Picture::layout() const {
+    if (!alphaPixels.empty()) {
+        return LAYOUT_BGRA;
+    }
+    return grayPixels.empty() ? LAYOUT_BGR : LAYOUT_GRAY;
+}
+
+size_t Picture::size() const {
+    return pixels.size() + grayPixels.size() + alphaPixels.size();
+}
+
+void Picture::allocate(PixelLayout to, size_t count) {
+    BufferPool& pool = defaultBufferPool();
+    if (to == LAYOUT_BGR) {
+        pool.acquire(pixels, count);
+    }
+    else {
+        pool.release(pixels);
+    }
+    if (to == LAYOUT_GRAY) {
+        pool.acquire(grayPixels, count);
     }
     else {
-        cout << "File not found" << endl;
+        pool.release(grayPixels);
+    }
+    if (to == LAYOUT_BGRA) {
+        pool.acquire(alphaPixels, count);
+    }
+    else {
+        pool.release(alphaPixels);
     }
 }
 
-void Picture::initializeImage(Picture& original, Picture& copy) {
-    copy.idLength = original.idLength;
-    copy.colorMapType = original.colorMapType;
-    copy.dataTypeCode = original.dataTypeCode;
-    copy.colorMapOrigin = original.colorMapOrigin;
-    copy.colorMapLength = original.colorMapLength;
-    copy.colorMapDepth = original.colorMapDepth;
-    copy.xOrigin = original.xOrigin;
-    copy.yOrigin = original.yOrigin;
-    copy.width = original.width;
-    copy.height = original.height;
-    copy.bitsPerPixel = original.bitsPerPixel;
-    copy.imageDescriptor = original.imageDescriptor;
-    copy.pixels.resize(original.width * original.height);
+void Picture::expandGray() {
+    if (layout() != LAYOUT_GRAY) {
+        return;
+    }
+    size_t count = grayPixels.size();
+    defaultBufferPool().acquire(pixels, count);
+    const unsigned char* in = grayPixels.data();
+    Pixel* out = pixels.data();
+    parallelRows(count, (unsigned short)width, [=](size_t begin, size_t end) {
+        unpackPixels(in + begin, 1, out + begin, 0, end - begin);
+    });
+    defaultBufferPool().release(grayPixels);
 }
 
-// Algorithms and other functions
+void Picture::reduceGray() {
+    if (layout() != LAYOUT_BGR || pixels.empty()) {
+        return;
+    }
+    size_t count = pixels.size();
+    defaultBufferPool().acquire(grayPixels, count);
+    const Pixel* in = pixels.data();
+    unsigned char* out = grayPixels.data();
+    parallelRows(count, (unsigned short)width, [=](size_t begin, size_t end) {
+        packPixels(in + begin, 0, 1, out + begin, end - begin);
+    });
+    defaultBufferPool().release(pixels);
+}
+
+ImageView::ImageView() {
+    width = 0;
+    height = 0;
+    pixels = 0;
+    grayPixels = 0;
+    alphaPixels = 0;
+    count = 0;
+}
 
-void Picture::multiply(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer) {
-    for(unsigned int i = 0; i < outcomeLayer.pixels.size(); i++){
-        float normalizedTopBlue = static_cast<float>(topLayer.pixels[i].blue) / 255.0f;
-        float normalizedBotBlue = static_cast<float>(botLayer.pixels[i].blue) / 255.0f;
-        float outcomeBlue = normalizedTopBlue * normalizedBotBlue * 255.0f;
-        outcomeLayer.pixels[i].blue = (unsigned char)(outcomeBlue + 0.5f);
+ImageView::ImageView(const Picture& image) {
+    width = image.width;
+    height = image.height;
+    pixels = image.pixels.empty() ? 0 : image.pixels.data();
+    grayPixels = image.grayPixels.empty() ? 0 : image.grayPixels.data();
+    alphaPixels = image.alphaPixels.empty() ? 0 : image.alphaPixels.data();
+    count = image.size();
+}
 
-        float normalizedTopGreen = static_cast<float>(topLayer.pixels[i].green) / 255.0f;
-        float normalizedBotGreen = static_cast<float>(botLayer.pixels[i].green) / 255.0f;
-        float outcomeGreen = normalizedTopGreen * normalizedBotGreen * 255.0f;
-        outcomeLayer.pixels[i].green = (unsigned char)(outcomeGreen + 0.5f);
+ImageView::ImageView(short w, short h, const Pixel* data, size_t n) {
+    width = w;
+    height = h;
+    pixels = data;
+    grayPixels = 0;
+    alphaPixels = 0;
+    count = n;
+}
 
-        float normalizedTopRed = static_cast<float>(topLayer.pixels[i].red) / 255.0f;
-        float normalizedBotRed = static_cast<float>(botLayer.pixels[i].red) / 255.0f;
-        float outcomeRed = normalizedTopRed * normalizedBotRed * 255.0f;
-        outcomeLayer.pixels[i].red = (unsigned char)(outcomeRed + 0.5f);
+PixelLayout ImageView::layout() const {
+    if (alphaPixels) {
+        return LAYOUT_BGRA;
     }
+    return grayPixels ? LAYOUT_GRAY : LAYOUT_BGR;
 }
 
-void Picture::subtract(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer) {
-    int temp;
+size_t ImageView::size() const {
+    return count;
+}
 
-    for (unsigned int i = 0; i < outcomeLayer.pixels.size(); i++) {
-        temp = (int) topLayer.pixels[i].blue - (int) botLayer.pixels[i].blue;
-        if (temp < 0) {
-            temp = 0;
-        }
-        outcomeLayer.pixels[i].blue = (unsigned char) temp;
+// Read and Write
 
-        temp = (int) topLayer.pixels[i].green - (int) botLayer.pixels[i].green;
-        if (temp < 0) {
-            temp = 0;
-        }
-        outcomeLayer.pixels[i].green = (unsigned char) temp;
+static PixelLayout fileLayout(size_t pixelBytes) {
+    switch (pixelBytes) {
+        case 1: return LAYOUT_GRAY;
+        case 4: return LAYOUT_BGRA;
+        default: return LAYOUT_BGR;
+    }
+}
 
-        temp = (int) topLayer.pixels[i].red - (int) botLayer.pixels[i].red;
-        if (temp < 0) {
-            temp = 0;
-        }
-        outcomeLayer.pixels[i].red = (unsigned char) temp;
+bool Picture::readData(const string& filePath, Picture& image) {
+    PROFILE_SCOPE("decode", filePath);
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        reportMessage("File not found");
+        return false;
     }
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+
+    unsigned char header[TGA_HEADER_SIZE];
+    if (!readFully(fd, header, sizeof(header))) {
+        reportMessage("Invalid file, header is truncated.");
+        close(fd);
+        return false;
+    }
+    decodeHeader(header, image);
+
+    size_t pixelBytes = filePixelBytes(image);
+    if (pixelBytes == 0) {
+        reportMessage("Unsupported TGA format in " + filePath + ".");
+        close(fd);
+        return false;
+    }
+
+    // The pixels land in the file's own layout, with no conversion.
+    size_t imageSize = imagePixelCount(image);
+    image.allocate(fileLayout(pixelBytes), imageSize);
+    PROFILE_PIXELS(imageSize);
+
+    // A short file still loads, with the missing pixels black (and
+    // transparent).
+    if (!readStoredPixels(fd, image, bytesOf(image), imageSize)) {
+        reportMessage("Image data in " + filePath + " ends early.");
+    }
+    close(fd);
+    return true;
 }
 
-void Picture::overlay(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer) {
-    for(unsigned int i = 0; i < outcomeLayer.pixels.size(); i++){
-        float normalizedTopBlue = (float)topLayer.pixels[i].blue / 255;
-        float normalizedBotBlue = (float)botLayer.pixels[i].blue / 255;
-        if(normalizedBotBlue <= 0.5) {
-            float outcomeBlue = 2 * normalizedTopBlue * normalizedBotBlue * 255;
-            outcomeLayer.pixels[i].blue = (unsigned char)(outcomeBlue + 0.5f);
-        }
-        else {
-            float outcomeBlue = (1 - (2 * (1 - normalizedTopBlue) * (1 - normalizedBotBlue))) * 255;
-            outcomeLayer.pixels[i].blue = (unsigned char)(outcomeBlue + 0.5f);
+bool Picture::writeData(const string& filePath, const Picture& image) const {
+    PROFILE_SCOPE("encode", filePath);
+    int fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        reportMessage("File not found");
+        return false;
+    }
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+
+    size_t imageSize = imagePixelCount(image);
+    PROFILE_PIXELS(imageSize);
+    PixelLayout layout = image.layout();
+    size_t pixelBytes = layoutBytes(layout);
+    // A buffer shorter than the header says is written padded with black
+    // (and opaque).
+    const unsigned char* data = bytesOf(ImageView(image));
+    vector<unsigned char> padded;
+    if (image.size() < imageSize) {
+        padded.assign(data, data + image.size() * pixelBytes);
+        padded.resize(imageSize * pixelBytes);
+        for (size_t i = image.size(); layout == LAYOUT_BGRA && i < imageSize; i++) {
+            padded[i * pixelBytes + 3] = 255;
         }
+        data = padded.data();
+    }
 
-        float normalizedTopGreen = (float)topLayer.pixels[i].green / 255;
-        float normalizedBotGreen = (float)botLayer.pixels[i].green / 255;
-        if(normalizedBotGreen <= 0.5) {
-            float outcomeGreen = 2 * normalizedTopGreen * normalizedBotGreen * 255;
-            outcomeLayer.pixels[i].green = (unsigned char)(outcomeGreen + 0.5f);
+    size_t stored = storedPixelBytes(image, layout == LAYOUT_BGRA);
+    if (stored != pixelBytes) {
+        // Another format than the layout's: a gray layout written as true
+        // color, or BGR written as grayscale.
+        vector<Pixel> converted;
+        vector<unsigned char> alpha(layout == LAYOUT_BGRA ? imageSize : 0);
+        const Pixel* pixels = reinterpret_cast<const Pixel*>(data);
+        if (layout != LAYOUT_BGR) {
+            converted.resize(imageSize);
+            unpackPixels(data, pixelBytes, converted.data(), alpha.empty() ? 0 : alpha.data(), imageSize);
+            pixels = converted.data();
         }
-        else {
-            float outcomeGreen = (1 - (2 * (1 - normalizedTopGreen) * (1 - normalizedBotGreen))) * 255;
-            outcomeLayer.pixels[i].green = (unsigned char)(outcomeGreen + 0.5f);
+        bool ok = writePixels(fd, image, pixels, alpha.empty() ? 0 : alpha.data(), imageSize);
+        close(fd);
+        if (!ok) {
+            reportMessage("Failed to write " + filePath);
+        }
+        return ok;
+    }
+    if (isRunLength(image)) {
+        bool ok = writeRle(fd, image, pixelBytes, data);
+        close(fd);
+        if (!ok) {
+            reportMessage("Failed to write " + filePath);
         }
+        return ok;
+    }
+
+    // Header and pixels leave in a single gathered write.
+    unsigned char header[TGA_HEADER_SIZE];
+    encodeHeader(image, pixelBytes, header);
+    struct iovec parts[2];
+    parts[0].iov_base = header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = const_cast<unsigned char*>(data);
+    parts[1].iov_len = imageSize * pixelBytes;
 
-        float normalizedTopRed = (float)topLayer.pixels[i].red / 255;
-        float normalizedBotRed = (float)botLayer.pixels[i].red / 255;
-        if(normalizedBotRed <= 0.5) {
-            float outcomeRed = 2 * normalizedTopRed * normalizedBotRed * 255;
-            outcomeLayer.pixels[i].red = (unsigned char)(outcomeRed + 0.5f);
+    ssize_t written = writev(fd, parts, 2);
+    PROFILE_COUNT(PROFILE_BYTES_WRITTEN, written > 0 ? written : 0);
+    size_t total = parts[0].iov_len + parts[1].iov_len;
+    bool ok = written == (ssize_t)total;
+    if (!ok && written >= 0) {
+        // Fall back to plain writes for whatever the gathered write left.
+        size_t done = written;
+        if (done < sizeof(header)) {
+            ok = writeFully(fd, header + done, sizeof(header) - done) &&
+                 writeFully(fd, parts[1].iov_base, parts[1].iov_len);
         }
         else {
-            float outcomeRed = (1 - (2 * (1 - normalizedTopRed) * (1 - normalizedBotRed))) * 255;
-            outcomeLayer.pixels[i].red = (unsigned char)(outcomeRed + 0.5f);
+            ok = writeFully(fd, static_cast<char*>(parts[1].iov_base) + (done - sizeof(header)),
+                            total - done);
         }
+    }
+    close(fd);
 
+    if (!ok) {
+        reportMessage("Failed to write " + filePath);
     }
+    return ok;
+}
+
+void Picture::initializeImage(const Picture& original, Picture& copy) {
+    copy.copyHeader(original);
+    copy.allocate(original.layout(), imagePixelCount(original));
+}
+
+// Algorithms and other functions. Each method runs its kernel over row
+// bands on the default thread pool.
 
+static size_t rowWidth(const Picture& image) {
+    return (unsigned short)image.width;
 }
 
-void Picture::screen(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer) {
-    for (unsigned int i = 0; i < outcomeLayer.pixels.size(); i++) {
-        float normalizedTopBlue = (float) topLayer.pixels[i].blue / 255;
-        float normalizedBotBlue = (float) botLayer.pixels[i].blue / 255;
-        float outcomeBlue = (1 - ((1 - normalizedTopBlue) * (1 - normalizedBotBlue))) * 255;
-        outcomeLayer.pixels[i].blue = (unsigned char) (outcomeBlue + 0.5f);
+// Layouts. Methods that keep the layout are written once as a template
+// over the pixel type, T being Pixel, AlphaPixel or unsigned char (gray),
+// and withLayout runs Operation<T> for the layer's layout.
 
-        float normalizedTopGreen = (float) topLayer.pixels[i].green / 255;
-        float normalizedBotGreen = (float) botLayer.pixels[i].green / 255;
-        float outcomeGreen = (1 - ((1 - normalizedTopGreen) * (1 - normalizedBotGreen))) * 255;
-        outcomeLayer.pixels[i].green = (unsigned char) (outcomeGreen + 0.5f);
+template <class T>
+struct Buffer;
 
-        float normalizedTopRed = (float) topLayer.pixels[i].red / 255;
-        float normalizedBotRed = (float) botLayer.pixels[i].red / 255;
-        float outcomeRed = (1 - ((1 - normalizedTopRed) * (1 - normalizedBotRed))) * 255;
-        outcomeLayer.pixels[i].red = (unsigned char) (outcomeRed + 0.5f);
+template <>
+struct Buffer<Pixel> {
+    static const PixelLayout layout = LAYOUT_BGR;
+    static Pixel* of(Picture& image) {
+        return image.pixels.data();
     }
+    static const Pixel* of(const ImageView& view) {
+        return view.pixels;
+    }
+};
 
-}
+template <>
+struct Buffer<unsigned char> {
+    static const PixelLayout layout = LAYOUT_GRAY;
+    static unsigned char* of(Picture& image) {
+        return image.grayPixels.data();
+    }
+    static const unsigned char* of(const ImageView& view) {
+        return view.grayPixels;
+    }
+};
 
+template <>
+struct Buffer<AlphaPixel> {
+    static const PixelLayout layout = LAYOUT_BGRA;
+    static AlphaPixel* of(Picture& image) {
+        return image.alphaPixels.data();
+    }
+    static const AlphaPixel* of(const ImageView& view) {
+        return view.alphaPixels;
+    }
+};
 
-void Picture::combine(Picture& redLayer, Picture& greenLayer, Picture& blueLayer, Picture& outcomeLayer) {
-    for (unsigned int i = 0; i < redLayer.pixels.size(); i++) {
-        outcomeLayer.pixels[i].red = redLayer.pixels[i].red;
-        outcomeLayer.pixels[i].green = greenLayer.pixels[i].green;
-        outcomeLayer.pixels[i].blue = blueLayer.pixels[i].blue;
+template <template <class> class Operation, class... Arguments>
+static void withLayout(PixelLayout layout, Arguments&&... arguments) {
+    switch (layout) {
+        case LAYOUT_GRAY: Operation<unsigned char>::run(forward<Arguments>(arguments)...); break;
+        case LAYOUT_BGRA: Operation<AlphaPixel>::run(forward<Arguments>(arguments)...); break;
+        default: Operation<Pixel>::run(forward<Arguments>(arguments)...); break;
     }
 }
 
-void Picture::flip(Picture& layer, Picture& outcomeLayer) {
-    reverse(layer.pixels.begin(), layer.pixels.end());
+// Whether view reads one of image's buffers.
+static bool reads(const ImageView& view, const Picture& image) {
+    return (view.pixels && view.pixels == image.pixels.data()) ||
+           (view.grayPixels && view.grayPixels == image.grayPixels.data()) ||
+           (view.alphaPixels && view.alphaPixels == image.alphaPixels.data());
 }
 
-void Picture::onlyred(Picture& layer, Picture& outcomeLayer) {
-    for (unsigned int i = 0; i < layer.pixels.size(); i++) {
-        outcomeLayer.pixels[i].blue = layer.pixels[i].red;
-        outcomeLayer.pixels[i].green = layer.pixels[i].red;
-        outcomeLayer.pixels[i].red = layer.pixels[i].red;
-    }
+// Methods that change the layout cannot write an outcome that is one of
+// their inputs in another layout: allocating the new one would free it.
+// They write a separate image and swap it in afterwards.
+static bool needsSeparate(PixelLayout to, const ImageView& first, const ImageView& second,
+                          const Picture& outcomeLayer) {
+    return outcomeLayer.layout() != to && (reads(first, outcomeLayer) || reads(second, outcomeLayer));
 }
 
-void Picture::onlygreen(Picture& layer, Picture& outcomeLayer) {
-    for (unsigned int i = 0; i < layer.pixels.size(); i++) {
-        outcomeLayer.pixels[i].blue = layer.pixels[i].green;
-        outcomeLayer.pixels[i].green = layer.pixels[i].green;
-        outcomeLayer.pixels[i].red = layer.pixels[i].green;
-    }
+// Moves outcome into layer, whose own buffers go back to the pool.
+static void replace(Picture& layer, Picture& outcome) {
+    defaultBufferPool().release(layer);
+    layer = move(outcome);
 }
 
-void Picture::onlyblue(Picture& layer, Picture& outcomeLayer) {
-    for (unsigned int i = 0; i < layer.pixels.size(); i++) {
-        outcomeLayer.pixels[i].blue = layer.pixels[i].blue;
-        outcomeLayer.pixels[i].green = layer.pixels[i].blue;
-        outcomeLayer.pixels[i].red = layer.pixels[i].blue;
+// Runs kernel(block, begin, count) over [begin, end) of a gray layer with
+// the pixels expanded to BGR a block at a time, for methods whose outcome
+// has channels that differ.
+static const size_t EXPAND_BLOCK = 256;
+
+template <class Kernel>
+static void expandedBlocks(const unsigned char* gray, size_t begin, size_t end, Kernel kernel) {
+    Pixel block[EXPAND_BLOCK];
+    for (size_t first = begin; first < end; first += EXPAND_BLOCK) {
+        size_t count = min(EXPAND_BLOCK, end - first);
+        unpackPixels(gray + first, 1, block, 0, count);
+        kernel(block, first, count);
     }
 }
 
-void Picture::addred(Picture& layer, int value, Picture& outcomeLayer) {
-    cout << "adding red" << endl;
-    for(int i = 0; i < layer.pixels.size(); i++){
-        int temp = int(layer.pixels[i].red) + value;
-        if(temp > 255){
-            outcomeLayer.pixels[i].red = (unsigned char)(255);
+// Blends. A BGRA top layer keeps its layout and alpha, and a gray one
+// stays gray on a gray bottom layer; anything else comes out BGR. The
+// bottom layer may be in any layout, its alpha being the coverage.
+
+static void blendLayers(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer,
+                        BlendMode mode) {
+    PixelLayout layout = topLayer.layout();
+    PixelLayout to = layout;
+    if (layout == LAYOUT_GRAY && botLayer.layout() != LAYOUT_GRAY) {
+        to = LAYOUT_BGR;
+    }
+    if (needsSeparate(to, topLayer, botLayer, outcomeLayer)) {
+        Picture outcome;
+        outcome.copyHeader(outcomeLayer);
+        blendLayers(topLayer, botLayer, outcome, mode);
+        replace(outcomeLayer, outcome);
+        return;
+    }
+    size_t count = topLayer.size();
+    outcomeLayer.allocate(to, count);
+    ImageView bot = botLayer;
+    parallelRows(count, rowWidth(outcomeLayer), [&](size_t begin, size_t end) {
+        if (to == LAYOUT_BGRA) {
+            blendPixels(mode, topLayer.alphaPixels + begin, bot, begin, outcomeLayer.alphaPixels.data() + begin,
+                        end - begin);
+        }
+        else if (to == LAYOUT_GRAY) {
+            blendPixels(mode, topLayer.grayPixels + begin, bot, begin, outcomeLayer.grayPixels.data() + begin,
+                        end - begin);
         }
-        else if(temp < 0){
-            outcomeLayer.pixels[i].red = (unsigned char)(0);
+        else if (layout == LAYOUT_BGR) {
+            blendPixels(mode, topLayer.pixels + begin, bot, begin, outcomeLayer.pixels.data() + begin, end - begin);
         }
         else {
-            layer.pixels[i].red = (unsigned char)(temp);
+            Pixel* out = outcomeLayer.pixels.data();
+            expandedBlocks(topLayer.grayPixels, begin, end, [&](const Pixel* block, size_t first, size_t n) {
+                blendPixels(mode, block, bot, first, out + first, n);
+            });
         }
+    });
+}
+
+void Picture::multiply(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer) {
+    blendLayers(topLayer, botLayer, outcomeLayer, BLEND_MULTIPLY);
+}
+
+void Picture::subtract(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer) {
+    blendLayers(topLayer, botLayer, outcomeLayer, BLEND_SUBTRACT);
+}
+
+void Picture::overlay(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer) {
+    blendLayers(topLayer, botLayer, outcomeLayer, BLEND_OVERLAY);
+}
+
+void Picture::screen(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer) {
+    blendLayers(topLayer, botLayer, outcomeLayer, BLEND_SCREEN);
+}
+
+// The outcome is BGRA when the red layer is, BGR otherwise.
+void Picture::combine(const ImageView& redLayer, const ImageView& greenLayer, const ImageView& blueLayer, Picture& outcomeLayer) {
+    PixelLayout layout = redLayer.layout();
+    PixelLayout to = layout == LAYOUT_BGRA ? LAYOUT_BGRA : LAYOUT_BGR;
+    if (needsSeparate(to, redLayer, greenLayer, outcomeLayer) ||
+        (outcomeLayer.layout() != to && reads(blueLayer, outcomeLayer))) {
+        Picture outcome;
+        outcome.copyHeader(outcomeLayer);
+        combine(redLayer, greenLayer, blueLayer, outcome);
+        replace(outcomeLayer, outcome);
+        return;
     }
+    size_t count = redLayer.size();
+    outcomeLayer.allocate(to, count);
+    ImageView green = greenLayer;
+    ImageView blue = blueLayer;
+    parallelRows(count, rowWidth(outcomeLayer), [&](size_t begin, size_t end) {
+        if (to == LAYOUT_BGRA) {
+            combinePixels(redLayer.alphaPixels + begin, green, blue, begin, outcomeLayer.alphaPixels.data() + begin,
+                          end - begin);
+        }
+        else if (layout == LAYOUT_BGR) {
+            combinePixels(redLayer.pixels + begin, green, blue, begin, outcomeLayer.pixels.data() + begin,
+                          end - begin);
+        }
+        else {
+            Pixel* out = outcomeLayer.pixels.data();
+            expandedBlocks(redLayer.grayPixels, begin, end, [&](const Pixel* block, size_t first, size_t n) {
+                combinePixels(block, green, blue, first, out + first, n);
+            });
+        }
+    });
 }
 
-void Picture::addgreen(Picture& layer, int value, Picture& outcomeLayer) {
-    for(int i = 0; i < layer.pixels.size(); i++){
-        int temp = int(layer.pixels[i].green) + value;
-        if(temp > 255){
-            outcomeLayer.pixels[i].green = (unsigned char)(255);
+// Geometry that keeps the shape. Each one works in place when the outcome
+// is the layer itself.
+
+template <class T>
+struct FlipLayer {
+    static void run(const ImageView& layer, Picture& outcomeLayer) {
+        const T* in = Buffer<T>::of(layer);
+        size_t count = layer.size();
+        if (in == Buffer<T>::of(outcomeLayer)) {
+            T* pixels = Buffer<T>::of(outcomeLayer);
+            parallelRows(count / 2, rowWidth(outcomeLayer), [=](size_t begin, size_t end) {
+                swapMirrored(pixels, count, begin, end);
+            });
+            return;
         }
-        else if(temp < 0){
-            outcomeLayer.pixels[i].green = (unsigned char)(0);
+        outcomeLayer.allocate(Buffer<T>::layout, count);
+        T* out = Buffer<T>::of(outcomeLayer);
+        parallelRows(count, rowWidth(outcomeLayer), [=](size_t begin, size_t end) {
+            copyMirrored(in, out, count, begin, end);
+        });
+    }
+};
+
+void Picture::flip(const ImageView& layer, Picture& outcomeLayer) {
+    withLayout<FlipLayer>(layer.layout(), layer, outcomeLayer);
+}
+
+template <class T>
+struct MirrorLayer {
+    static void run(const ImageView& layer, Picture& outcomeLayer) {
+        outcomeLayer.allocate(Buffer<T>::layout, layer.size());
+        const T* in = Buffer<T>::of(layer);
+        T* out = Buffer<T>::of(outcomeLayer);
+        size_t width = rowWidth(outcomeLayer);
+        parallelRows(layer.size(), width, [=](size_t begin, size_t end) {
+            mirrorRows(in, out, width, begin / width, end / width);
+        });
+    }
+};
+
+void Picture::mirrorh(const ImageView& layer, Picture& outcomeLayer) {
+    withLayout<MirrorLayer>(layer.layout(), layer, outcomeLayer);
+}
+
+template <class T>
+struct FlipRowsLayer {
+    static void run(const ImageView& layer, Picture& outcomeLayer) {
+        const T* in = Buffer<T>::of(layer);
+        size_t width = rowWidth(outcomeLayer);
+        size_t height = (unsigned short)outcomeLayer.height;
+        // In place only the first half of the rows is swapped.
+        size_t rows = height;
+        if (in == Buffer<T>::of(outcomeLayer)) {
+            rows = height / 2;
         }
         else {
-            layer.pixels[i].green = (unsigned char)(temp);
+            outcomeLayer.allocate(Buffer<T>::layout, layer.size());
         }
+        T* out = Buffer<T>::of(outcomeLayer);
+        parallelRows(rows * width, width, [=](size_t begin, size_t end) {
+            flipRows(in, out, width, height, begin / width, end / width);
+        });
     }
+};
+
+void Picture::mirrorv(const ImageView& layer, Picture& outcomeLayer) {
+    withLayout<FlipRowsLayer>(layer.layout(), layer, outcomeLayer);
 }
 
-void Picture::addblue(Picture& layer, int value, Picture& outcomeLayer) {
-    for(int i = 0; i < layer.pixels.size(); i++){
-        int temp = int(layer.pixels[i].blue) + value;
-        if(temp > 255){
-            outcomeLayer.pixels[i].blue = (unsigned char)(255);
+// Channel operations. Picking one channel leaves a gray image, BGRA
+// keeping its alpha; a gray layer already is one. Adjusting one channel
+// makes a gray layer BGR.
+
+template <class Bgr, class Bgra>
+static void adjustChannel(const ImageView& layer, Picture& outcomeLayer, Bgr bgr, Bgra bgra) {
+    PixelLayout layout = layer.layout();
+    PixelLayout to = layout == LAYOUT_GRAY ? LAYOUT_BGR : layout;
+    if (needsSeparate(to, layer, layer, outcomeLayer)) {
+        Picture outcome;
+        outcome.copyHeader(outcomeLayer);
+        adjustChannel(layer, outcome, bgr, bgra);
+        replace(outcomeLayer, outcome);
+        return;
+    }
+    outcomeLayer.allocate(to, layer.size());
+    parallelRows(layer.size(), rowWidth(outcomeLayer), [&](size_t begin, size_t end) {
+        if (layout == LAYOUT_BGRA) {
+            bgra(layer.alphaPixels + begin, outcomeLayer.alphaPixels.data() + begin, end - begin);
         }
-        else if(temp < 0){
-            outcomeLayer.pixels[i].blue = (unsigned char)(0);
+        else if (layout == LAYOUT_BGR) {
+            bgr(layer.pixels + begin, outcomeLayer.pixels.data() + begin, end - begin);
         }
         else {
-            layer.pixels[i].blue = (unsigned char)(temp);
+            Pixel* out = outcomeLayer.pixels.data();
+            expandedBlocks(layer.grayPixels, begin, end, [&](const Pixel* block, size_t first, size_t n) {
+                bgr(block, out + first, n);
+            });
         }
+    });
+}
+
+template <class Bgra>
+static void onlyChannel(const ImageView& layer, int channel, Picture& outcomeLayer, Bgra bgra) {
+    PixelLayout layout = layer.layout();
+    PixelLayout to = layout == LAYOUT_BGR ? LAYOUT_GRAY : layout;
+    if (needsSeparate(to, layer, layer, outcomeLayer)) {
+        Picture outcome;
+        outcome.copyHeader(outcomeLayer);
+        onlyChannel(layer, channel, outcome, bgra);
+        replace(outcomeLayer, outcome);
+        return;
     }
+    outcomeLayer.allocate(to, layer.size());
+    parallelRows(layer.size(), rowWidth(outcomeLayer), [&](size_t begin, size_t end) {
+        if (layout == LAYOUT_BGRA) {
+            bgra(layer.alphaPixels + begin, outcomeLayer.alphaPixels.data() + begin, end - begin);
+        }
+        else if (layout == LAYOUT_BGR) {
+            const unsigned char* in = reinterpret_cast<const unsigned char*>(layer.pixels + begin) + channel;
+            unsigned char* out = outcomeLayer.grayPixels.data() + begin;
+            for (size_t i = 0; i < end - begin; i++) {
+                out[i] = in[i * sizeof(Pixel)];
+            }
+        }
+        else if (layer.grayPixels != outcomeLayer.grayPixels.data()) {
+            memcpy(outcomeLayer.grayPixels.data() + begin, layer.grayPixels + begin, end - begin);
+        }
+    });
+}
+
+void Picture::onlyred(const ImageView& layer, Picture& outcomeLayer) {
+    onlyChannel(layer, CHANNEL_RED, outcomeLayer, [](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        onlyredPixels(in, out, count);
+    });
+}
+
+void Picture::onlygreen(const ImageView& layer, Picture& outcomeLayer) {
+    onlyChannel(layer, CHANNEL_GREEN, outcomeLayer, [](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        onlygreenPixels(in, out, count);
+    });
+}
+
+void Picture::onlyblue(const ImageView& layer, Picture& outcomeLayer) {
+    onlyChannel(layer, CHANNEL_BLUE, outcomeLayer, [](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        onlybluePixels(in, out, count);
+    });
+}
+
+void Picture::addred(const ImageView& layer, int value, Picture& outcomeLayer) {
+    adjustChannel(layer, outcomeLayer, [=](const Pixel* in, Pixel* out, size_t count) {
+        addredPixels(in, value, out, count);
+    }, [=](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        addredPixels(in, value, out, count);
+    });
+}
+
+void Picture::addgreen(const ImageView& layer, int value, Picture& outcomeLayer) {
+    adjustChannel(layer, outcomeLayer, [=](const Pixel* in, Pixel* out, size_t count) {
+        addgreenPixels(in, value, out, count);
+    }, [=](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        addgreenPixels(in, value, out, count);
+    });
+}
+
+void Picture::addblue(const ImageView& layer, int value, Picture& outcomeLayer) {
+    adjustChannel(layer, outcomeLayer, [=](const Pixel* in, Pixel* out, size_t count) {
+        addbluePixels(in, value, out, count);
+    }, [=](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        addbluePixels(in, value, out, count);
+    });
 }
 
-void Picture::scalered(Picture& layer, unsigned int value, Picture& outcomeLayer) {
-    for (int i = 0; i < layer.pixels.size(); i++) {
-        int temp = layer.pixels[i].red * value;
-        if (temp > 255) {
-            temp = 255;
+void Picture::scalered(const ImageView& layer, unsigned int value, Picture& outcomeLayer) {
+    adjustChannel(layer, outcomeLayer, [=](const Pixel* in, Pixel* out, size_t count) {
+        scaleredPixels(in, value, out, count);
+    }, [=](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        scaleredPixels(in, value, out, count);
+    });
+}
+
+void Picture::scalegreen(const ImageView& layer, unsigned int value, Picture& outcomeLayer) {
+    adjustChannel(layer, outcomeLayer, [=](const Pixel* in, Pixel* out, size_t count) {
+        scalegreenPixels(in, value, out, count);
+    }, [=](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        scalegreenPixels(in, value, out, count);
+    });
+}
+
+void Picture::scaleblue(const ImageView& layer, unsigned int value, Picture& outcomeLayer) {
+    adjustChannel(layer, outcomeLayer, [=](const Pixel* in, Pixel* out, size_t count) {
+        scalebluePixels(in, value, out, count);
+    }, [=](const AlphaPixel* in, AlphaPixel* out, size_t count) {
+        scalebluePixels(in, value, out, count);
+    });
+}
+
+// Rows of input handed to each task of a tiled remap, a whole number of
+// tiles.
+static const size_t REMAP_ROWS = 64;
+
+enum RemapKind {
+    REMAP_TRANSPOSE,
+    REMAP_ROTATE90,
+    REMAP_ROTATE270
+};
+
+template <class T>
+struct RemapLayer {
+    static void run(const ImageView& layer, Picture& outcomeLayer, RemapKind kind) {
+        typedef void (*Kernel)(const T*, size_t, size_t, T*, size_t, size_t);
+        Kernel kernel = transposePixels;
+        if (kind == REMAP_ROTATE90) {
+            kernel = rotate90Pixels;
+        }
+        else if (kind == REMAP_ROTATE270) {
+            kernel = rotate270Pixels;
         }
-        outcomeLayer.pixels[i].red = temp;
+        size_t width = (unsigned short)layer.width;
+        size_t height = (unsigned short)layer.height;
+        outcomeLayer.width = layer.height;
+        outcomeLayer.height = layer.width;
+        outcomeLayer.allocate(Buffer<T>::layout, width * height);
+        const T* in = Buffer<T>::of(layer);
+        T* out = Buffer<T>::of(outcomeLayer);
+        defaultPool().parallelFor(height, REMAP_ROWS, [=](size_t begin, size_t end) {
+            kernel(in, width, height, out, begin, end);
+        });
     }
+};
+
+static void remap(const ImageView& layer, Picture& outcomeLayer, RemapKind kind) {
+    withLayout<RemapLayer>(layer.layout(), layer, outcomeLayer, kind);
+}
+
+static void remap(Picture& layer, RemapKind kind) {
+    Picture outcome;
+    outcome.copyHeader(layer);
+    remap(layer, outcome, kind);
+    replace(layer, outcome);
+}
+
+static bool insideImage(const ImageView& layer, int x, int y, int w, int h) {
+    return x >= 0 && y >= 0 && w > 0 && h > 0 && (size_t)x + w <= (unsigned short)layer.width &&
+           (size_t)y + h <= (unsigned short)layer.height;
+}
+
+void Picture::transpose(const ImageView& layer, Picture& outcomeLayer) {
+    remap(layer, outcomeLayer, REMAP_TRANSPOSE);
+}
+
+void Picture::rotate90(const ImageView& layer, Picture& outcomeLayer) {
+    remap(layer, outcomeLayer, REMAP_ROTATE90);
+}
+
+void Picture::rotate270(const ImageView& layer, Picture& outcomeLayer) {
+    remap(layer, outcomeLayer, REMAP_ROTATE270);
+}
+
+template <class T>
+struct CropLayer {
+    static void run(const ImageView& layer, Picture& outcomeLayer, int x, int y, int w, int h) {
+        size_t inWidth = (unsigned short)layer.width;
+        outcomeLayer.width = (short)w;
+        outcomeLayer.height = (short)h;
+        outcomeLayer.allocate(Buffer<T>::layout, (size_t)w * h);
+        const T* in = Buffer<T>::of(layer);
+        T* out = Buffer<T>::of(outcomeLayer);
+        parallelRows((size_t)w * h, w, [=](size_t begin, size_t end) {
+            cropRows(in, inWidth, out, x, y, w, begin / w, end / w);
+        });
+    }
+};
+
+bool Picture::crop(const ImageView& layer, int x, int y, int w, int h, Picture& outcomeLayer) {
+    if (!insideImage(layer, x, y, w, h)) {
+        return false;
+    }
+    withLayout<CropLayer>(layer.layout(), layer, outcomeLayer, x, y, w, h);
+    return true;
+}
+
+void Picture::resize(const ImageView& layer, int w, int h, Picture& outcomeLayer) {
+    PixelLayout layout = layer.layout();
+    outcomeLayer.width = (short)w;
+    outcomeLayer.height = (short)h;
+    outcomeLayer.allocate(layout, (size_t)w * h);
+    resizeImage(bytesOf(layer), (unsigned short)layer.width, (unsigned short)layer.height, bytesOf(outcomeLayer),
+                w, h, layoutBytes(layout));
+}
+
+// Filters write a separate buffer; in place it comes from the pool and
+// replaces the layer's own. The pass is told the channels of its data,
+// the bytes of a pixel in the layer's layout (alpha is filtered with the
+// colors).
+
+typedef function<void(const unsigned char*, unsigned char*, size_t)> FilterPass;
+
+static void filterInto(const ImageView& layer, Picture& outcomeLayer, const FilterPass& pass) {
+    PixelLayout layout = layer.layout();
+    size_t channels = layoutBytes(layout);
+    if (!reads(layer, outcomeLayer)) {
+        outcomeLayer.allocate(layout, layer.size());
+        pass(bytesOf(layer), bytesOf(outcomeLayer), channels);
+        return;
+    }
+    Picture filtered;
+    filtered.allocate(layout, layer.size());
+    pass(bytesOf(layer), bytesOf(filtered), channels);
+    outcomeLayer.pixels.swap(filtered.pixels);
+    outcomeLayer.grayPixels.swap(filtered.grayPixels);
+    outcomeLayer.alphaPixels.swap(filtered.alphaPixels);
+    defaultBufferPool().release(filtered);
+}
+
+void Picture::boxblur(const ImageView& layer, int radius, EdgeMode edge, Picture& outcomeLayer) {
+    size_t width = (unsigned short)layer.width;
+    size_t height = (unsigned short)layer.height;
+    filterInto(layer, outcomeLayer, [=](const unsigned char* in, unsigned char* out, size_t channels) {
+        boxBlur(in, out, width, height, channels, radius, edge);
+    });
+}
+
+void Picture::gaussian(const ImageView& layer, double sigma, EdgeMode edge, Picture& outcomeLayer) {
+    size_t width = (unsigned short)layer.width;
+    size_t height = (unsigned short)layer.height;
+    filterInto(layer, outcomeLayer, [=](const unsigned char* in, unsigned char* out, size_t channels) {
+        gaussianBlur(in, out, width, height, channels, sigma, edge);
+    });
+}
+
+void Picture::sharpen(const ImageView& layer, double amount, double sigma, EdgeMode edge, Picture& outcomeLayer) {
+    size_t width = (unsigned short)layer.width;
+    size_t height = (unsigned short)layer.height;
+    filterInto(layer, outcomeLayer, [=](const unsigned char* in, unsigned char* out, size_t channels) {
+        unsharpMask(in, out, width, height, channels, amount, sigma, edge);
+    });
+}
+
+// Tables built from the layer's histograms, applied in a second pass. A
+// gray layer's three histograms are the same, so are its tables.
+
+typedef void (ImageStats::*StatsTable)(int, unsigned char*) const;
+
+static void applyTable(const ChannelLut& lut, const Pixel* in, Pixel* out, size_t count) {
+    lut.apply(in, out, count);
+}
+
+static void applyTable(const ChannelLut& lut, const AlphaPixel* in, AlphaPixel* out, size_t count) {
+    lut.apply(in, out, count);
+}
+
+static void applyTable(const ChannelLut& lut, const unsigned char* in, unsigned char* out, size_t count) {
+    lut.applyGray(in, out, count);
 }
 
-void Picture::scalegreen(Picture& layer, unsigned int value, Picture& outcomeLayer) {
-    for (int i = 0; i < layer.pixels.size(); i++) {
-        int temp = layer.pixels[i].green * value;
-        if (temp > 255) {
-            temp = 255;
+template <class T>
+struct StatsTableLayer {
+    static void run(const ImageView& layer, Picture& outcomeLayer, StatsTable table) {
+        ImageStats stats;
+        imageStats(layer, stats);
+        ChannelLut lut;
+        for (int c = 0; c < 3; c++) {
+            unsigned char function[256];
+            (stats.*table)(c, function);
+            lut.map(c, function);
         }
-        outcomeLayer.pixels[i].green = temp;
+        outcomeLayer.allocate(Buffer<T>::layout, layer.size());
+        const T* in = Buffer<T>::of(layer);
+        T* out = Buffer<T>::of(outcomeLayer);
+        parallelRows(layer.size(), rowWidth(outcomeLayer), [&lut, in, out](size_t begin, size_t end) {
+            applyTable(lut, in + begin, out + begin, end - begin);
+        });
     }
+};
+
+void Picture::autolevels(const ImageView& layer, Picture& outcomeLayer) {
+    withLayout<StatsTableLayer>(layer.layout(), layer, outcomeLayer, &ImageStats::autolevelsTable);
+}
+
+void Picture::equalize(const ImageView& layer, Picture& outcomeLayer) {
+    withLayout<StatsTableLayer>(layer.layout(), layer, outcomeLayer, &ImageStats::equalizeTable);
+}
+
+// In place: the layer is both input and outcome.
+
+void Picture::multiply(Picture& layer, const ImageView& botLayer) {
+    multiply(layer, botLayer, layer);
+}
+
+void Picture::subtract(Picture& layer, const ImageView& botLayer) {
+    subtract(layer, botLayer, layer);
+}
+
+void Picture::overlay(Picture& layer, const ImageView& botLayer) {
+    overlay(layer, botLayer, layer);
+}
+
+void Picture::screen(Picture& layer, const ImageView& botLayer) {
+    screen(layer, botLayer, layer);
+}
+
+void Picture::combine(Picture& layer, const ImageView& greenLayer, const ImageView& blueLayer) {
+    combine(layer, greenLayer, blueLayer, layer);
+}
+
+void Picture::flip(Picture& layer) {
+    flip(layer, layer);
+}
+
+void Picture::onlyred(Picture& layer) {
+    onlyred(layer, layer);
+}
+
+void Picture::onlygreen(Picture& layer) {
+    onlygreen(layer, layer);
+}
+
+void Picture::onlyblue(Picture& layer) {
+    onlyblue(layer, layer);
+}
+
+void Picture::addred(Picture& layer, int value) {
+    addred(layer, value, layer);
+}
+
+void Picture::addgreen(Picture& layer, int value) {
+    addgreen(layer, value, layer);
+}
+
+void Picture::addblue(Picture& layer, int value) {
+    addblue(layer, value, layer);
+}
+
+void Picture::scalered(Picture& layer, unsigned int value) {
+    scalered(layer, value, layer);
 }
 
-void Picture::scaleblue(Picture& layer, unsigned int value, Picture& outcomeLayer) {
-    for (int i = 0; i < layer.pixels.size(); i++) {
-        int temp = layer.pixels[i].blue * value;
-        if (temp > 255) {
-            temp = 255;
+void Picture::scalegreen(Picture& layer, unsigned int value) {
+    scalegreen(layer, value, layer);
+}
+
+void Picture::scaleblue(Picture& layer, unsigned int value) {
+    scaleblue(layer, value, layer);
+}
+
+void Picture::mirrorh(Picture& layer) {
+    mirrorh(layer, layer);
+}
+
+void Picture::mirrorv(Picture& layer) {
+    mirrorv(layer, layer);
+}
+
+void Picture::transpose(Picture& layer) {
+    remap(layer, REMAP_TRANSPOSE);
+}
+
+void Picture::rotate90(Picture& layer) {
+    remap(layer, REMAP_ROTATE90);
+}
+
+void Picture::rotate270(Picture& layer) {
+    remap(layer, REMAP_ROTATE270);
+}
+
+template <class T>
+struct CropInPlace {
+    static void run(Picture& layer, int x, int y, int w, int h) {
+        size_t inWidth = rowWidth(layer);
+        T* pixels = Buffer<T>::of(layer);
+        if ((size_t)w == inWidth) {
+            if (y > 0) {
+                memmove(pixels, pixels + (size_t)y * inWidth, (size_t)w * h * sizeof(T));
+            }
+        }
+        else {
+            cropRows(pixels, inWidth, pixels, x, y, w, 0, h);
         }
-        outcomeLayer.pixels[i].blue = temp;
+        layer.allocate(Buffer<T>::layout, (size_t)w * h);
+    }
+};
+
+bool Picture::crop(Picture& layer, int x, int y, int w, int h) {
+    if (!insideImage(layer, x, y, w, h)) {
+        return false;
     }
+    withLayout<CropInPlace>(layer.layout(), layer, x, y, w, h);
+    layer.width = (short)w;
+    layer.height = (short)h;
+    return true;
+}
+
+void Picture::boxblur(Picture& layer, int radius, EdgeMode edge) {
+    boxblur(layer, radius, edge, layer);
+}
+
+void Picture::gaussian(Picture& layer, double sigma, EdgeMode edge) {
+    gaussian(layer, sigma, edge, layer);
+}
+
+void Picture::sharpen(Picture& layer, double amount, double sigma, EdgeMode edge) {
+    sharpen(layer, amount, sigma, edge, layer);
+}
+
+void Picture::resize(Picture& layer, int w, int h) {
+    Picture outcome;
+    outcome.copyHeader(layer);
+    resize(layer, w, h, outcome);
+    replace(layer, outcome);
+}
+
+void Picture::autolevels(Picture& layer) {
+    autolevels(layer, layer);
+}
+
+void Picture::equalize(Picture& layer) {
+    equalize(layer, layer);
 }
@@ -1,5 +1,5 @@
 #ifndef tga_image_h
-#define tga_imaga_h
+#define tga_image_h
 
 #include <iostream>
 #include <fstream>
@@ -7,6 +7,17 @@
 #include <vector>
 using namespace std;
 
+class ImageView;
+
+// How the neighbourhood filters read past the image border: repeat the
+// edge pixel, reflect about it, wrap to the other side, or read black.
+enum EdgeMode {
+    EDGE_CLAMP,
+    EDGE_MIRROR,
+    EDGE_WRAP,
+    EDGE_BLACK
+};
+
 class Pixel{
     public:
         unsigned char blue;
@@ -17,6 +28,44 @@ class Pixel{
         Pixel(char b, char g, char r);
 };
 
+// One pixel of a 32-bit image, as stored in the file. Four bytes, so the
+// kernels load whole pixels at aligned offsets.
+class AlphaPixel{
+    public:
+        unsigned char blue;
+        unsigned char green;
+        unsigned char red;
+        unsigned char alpha;
+
+        AlphaPixel();
+        AlphaPixel(char b, char g, char r, char a);
+};
+
+// How a Picture holds its pixels: three bytes each, one byte standing for
+// three equal channels, or four bytes with alpha.
+enum PixelLayout {
+    LAYOUT_BGR,
+    LAYOUT_GRAY,
+    LAYOUT_BGRA
+};
+
+// Owns the pixels of one image. Pictures move but never copy implicitly:
+// copyHeader and copyFrom make every duplicate explicit.
+//
+// The pixels are in one of three layouts, the other two vectors being
+// empty: pixels (BGR), grayPixels or alphaPixels (BGRA). readData keeps the
+// file's own. A gray image stays one byte per pixel while its channels
+// stay equal, so every operation on it moves a third of the bytes; one
+// that would make them differ expands it to BGR first. A BGRA image keeps
+// its alpha through the geometry, point operations leave it as it is, and
+// the blends use the bottom layer's alpha as coverage. The type
+// (dataTypeCode) decides how the image is written: grayscale takes the
+// green channel, a gray layout under true color writes three equal ones.
+//
+// Methods taking an ImageView and an outcomeLayer are out of place: the
+// inputs are only read and outcomeLayer receives the result, in the
+// layout the method leaves; it may be one of the inputs. Methods taking
+// only a Picture layer work in place on it.
 class Picture{
     public:
         char idLength;
@@ -32,30 +81,132 @@ class Picture{
         char bitsPerPixel;
         char imageDescriptor;
         vector<Pixel> pixels;
+        vector<unsigned char> grayPixels;
+        vector<AlphaPixel> alphaPixels;
 
         Picture();
         Picture(char idL, char colorM, char dataT, short colorMapO, short colorMapL,
                 char colorMapD, short xOri, short yOri, short w, short h,
-                char bitsP, char imageD, vector<Pixel> pixel);
-
-        void readData(const string& filePath, Picture& image);
-        void writeData(const string& filePath, Picture& image);
-        void initializeImage(Picture& original, Picture& copy);
-        void multiply(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer);
-        void subtract(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer);
-        void overlay(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer);
-        void screen(Picture& topLayer, Picture& botLayer, Picture& outcomeLayer);
-        void combine(Picture& redLayer, Picture& greenLayer, Picture& blueLayer, Picture& outcomeLayer);
-        void flip(Picture& layer, Picture& outcomeLayer);
-        void onlyred(Picture& layer, Picture& outcomeLayer);
-        void onlygreen(Picture& layer, Picture& outcomeLayer);
-        void onlyblue(Picture& layer, Picture& outcomeLayer);
-        void addred(Picture& layer, int value, Picture& outcomeLayer);
-        void addgreen(Picture& layer, int value, Picture& outcomeLayer);
-        void addblue(Picture& layer, int value, Picture& outcomeLayer);
-        void scalered(Picture& layer, unsigned int value, Picture& outcomeLayer);
-        void scalegreen(Picture& layer, unsigned int value, Picture& outcomeLayer);
-        void scaleblue(Picture& layer, unsigned int value, Picture& outcomeLayer);
+                char bitsP, char imageD, vector<Pixel>&& pixel);
+        Picture(Picture&& other);
+        Picture& operator=(Picture&& other);
+
+        void copyHeader(const Picture& from);
+        void copyFrom(const Picture& from);
+
+        PixelLayout layout() const;
+        size_t size() const;
+        // Sizes the layout's buffer to count pixels, from the buffer pool
+        // when it is too small, and returns the other two to the pool.
+        void allocate(PixelLayout to, size_t count);
+        // expandGray copies a gray image's byte into three channels;
+        // reduceGray keeps the green channel of a BGR image whose channels
+        // are equal.
+        void expandGray();
+        void reduceGray();
+
+        // readData reuses the image's buffer, or one from the buffer pool,
+        // when it is large enough.
+        bool readData(const string& filePath, Picture& image);
+        bool writeData(const string& filePath, const Picture& image) const;
+        void initializeImage(const Picture& original, Picture& copy);
+
+        void multiply(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer);
+        void subtract(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer);
+        void overlay(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer);
+        void screen(const ImageView& topLayer, const ImageView& botLayer, Picture& outcomeLayer);
+        void combine(const ImageView& redLayer, const ImageView& greenLayer, const ImageView& blueLayer, Picture& outcomeLayer);
+        void flip(const ImageView& layer, Picture& outcomeLayer);
+        void onlyred(const ImageView& layer, Picture& outcomeLayer);
+        void onlygreen(const ImageView& layer, Picture& outcomeLayer);
+        void onlyblue(const ImageView& layer, Picture& outcomeLayer);
+        void addred(const ImageView& layer, int value, Picture& outcomeLayer);
+        void addgreen(const ImageView& layer, int value, Picture& outcomeLayer);
+        void addblue(const ImageView& layer, int value, Picture& outcomeLayer);
+        void scalered(const ImageView& layer, unsigned int value, Picture& outcomeLayer);
+        void scalegreen(const ImageView& layer, unsigned int value, Picture& outcomeLayer);
+        void scaleblue(const ImageView& layer, unsigned int value, Picture& outcomeLayer);
+        void mirrorh(const ImageView& layer, Picture& outcomeLayer);
+        void mirrorv(const ImageView& layer, Picture& outcomeLayer);
+
+        // Geometry that changes the shape of the image. outcomeLayer must be
+        // a separate image with the input's header (initializeImage); it
+        // takes the new width and height. crop fails when the x, y, w, h
+        // region is not inside the image.
+        void transpose(const ImageView& layer, Picture& outcomeLayer);
+        void rotate90(const ImageView& layer, Picture& outcomeLayer);
+        void rotate270(const ImageView& layer, Picture& outcomeLayer);
+        bool crop(const ImageView& layer, int x, int y, int w, int h, Picture& outcomeLayer);
+        // Resamples to w x h (resize.h), both from 1 to 65535.
+        void resize(const ImageView& layer, int w, int h, Picture& outcomeLayer);
+
+        // Neighbourhood filters (filter.h). Passing the layer itself as
+        // outcomeLayer filters it in place.
+        void boxblur(const ImageView& layer, int radius, EdgeMode edge, Picture& outcomeLayer);
+        void gaussian(const ImageView& layer, double sigma, EdgeMode edge, Picture& outcomeLayer);
+        void sharpen(const ImageView& layer, double amount, double sigma, EdgeMode edge, Picture& outcomeLayer);
+        // Histogram-driven tone (histogram.h): one pass gathers per-channel
+        // histograms, a second maps the pixels through tables built from them.
+        void autolevels(const ImageView& layer, Picture& outcomeLayer);
+        void equalize(const ImageView& layer, Picture& outcomeLayer);
+
+        void multiply(Picture& layer, const ImageView& botLayer);
+        void subtract(Picture& layer, const ImageView& botLayer);
+        void overlay(Picture& layer, const ImageView& botLayer);
+        void screen(Picture& layer, const ImageView& botLayer);
+        void combine(Picture& layer, const ImageView& greenLayer, const ImageView& blueLayer);
+        void flip(Picture& layer);
+        void onlyred(Picture& layer);
+        void onlygreen(Picture& layer);
+        void onlyblue(Picture& layer);
+        void addred(Picture& layer, int value);
+        void addgreen(Picture& layer, int value);
+        void addblue(Picture& layer, int value);
+        void scalered(Picture& layer, unsigned int value);
+        void scalegreen(Picture& layer, unsigned int value);
+        void scaleblue(Picture& layer, unsigned int value);
+        void mirrorh(Picture& layer);
+        void mirrorv(Picture& layer);
+        // In place through a pooled buffer of the new shape.
+        void transpose(Picture& layer);
+        void rotate90(Picture& layer);
+        void rotate270(Picture& layer);
+        // Moves the region's rows down within the layer's own buffer; a
+        // full-width band starting at row 0 is only truncated.
+        bool crop(Picture& layer, int x, int y, int w, int h);
+        // Through a pooled buffer of the new size.
+        void resize(Picture& layer, int w, int h);
+        // Through a pooled buffer, as a pixel's neighbours are still read
+        // after it has been written.
+        void boxblur(Picture& layer, int radius, EdgeMode edge);
+        void gaussian(Picture& layer, double sigma, EdgeMode edge);
+        void sharpen(Picture& layer, double amount, double sigma, EdgeMode edge);
+        void autolevels(Picture& layer);
+        void equalize(Picture& layer);
+
+    private:
+        Picture(const Picture&);
+        Picture& operator=(const Picture&);
+};
+
+// Read-only window onto pixel data owned by a Picture or a mapped file.
+// Operands of the blend methods only need to be read, so they are passed
+// as views and never copied. Only the pointer of the view's layout is set.
+class ImageView{
+    public:
+        short width;
+        short height;
+        const Pixel* pixels;
+        const unsigned char* grayPixels;
+        const AlphaPixel* alphaPixels;
+        size_t count;
+
+        ImageView();
+        ImageView(const Picture& image);
+        ImageView(short w, short h, const Pixel* data, size_t n);
+
+        PixelLayout layout() const;
+        size_t size() const;
 };
 
 #endif
@@ -0,0 +1,607 @@
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <immintrin.h>
+#include "tgaio.h"
+#include "profile.h"
+#include "cpu.h"
+
+using namespace std;
+
+static_assert(sizeof(Pixel) == 3, "Pixel must match the 24-bit TGA layout");
+static_assert(sizeof(AlphaPixel) == 4, "AlphaPixel must match the 32-bit TGA layout");
+
+static unsigned short readShort(const unsigned char* buffer) {
+    return (unsigned short)(buffer[0] | (buffer[1] << 8));
+}
+
+static void writeShort(unsigned char* buffer, short value) {
+    buffer[0] = (unsigned char)(value & 0xFF);
+    buffer[1] = (unsigned char)((value >> 8) & 0xFF);
+}
+
+void decodeHeader(const unsigned char* buffer, Picture& image) {
+    image.idLength = buffer[0];
+    image.colorMapType = buffer[1];
+    image.dataTypeCode = buffer[2];
+    image.colorMapOrigin = readShort(buffer + 3);
+    image.colorMapLength = readShort(buffer + 5);
+    image.colorMapDepth = buffer[7];
+    image.xOrigin = readShort(buffer + 8);
+    image.yOrigin = readShort(buffer + 10);
+    image.width = readShort(buffer + 12);
+    image.height = readShort(buffer + 14);
+    image.bitsPerPixel = buffer[16];
+    image.imageDescriptor = buffer[17];
+}
+
+// Only the header and the pixels are ever written, so the image id and
+// color map fields of the input are left out.
+void encodeHeader(const Picture& image, unsigned char* buffer) {
+    buffer[0] = 0;
+    buffer[1] = 0;
+    buffer[2] = image.dataTypeCode;
+    writeShort(buffer + 3, 0);
+    writeShort(buffer + 5, 0);
+    buffer[7] = 0;
+    writeShort(buffer + 8, image.xOrigin);
+    writeShort(buffer + 10, image.yOrigin);
+    writeShort(buffer + 12, image.width);
+    writeShort(buffer + 14, image.height);
+    buffer[16] = image.bitsPerPixel;
+    buffer[17] = image.imageDescriptor;
+}
+
+void encodeHeader(const Picture& image, size_t pixelBytes, unsigned char* buffer) {
+    encodeHeader(image, buffer);
+    buffer[16] = (unsigned char)(pixelBytes * 8);
+    buffer[17] = (unsigned char)((image.imageDescriptor & 0xF0) | (pixelBytes == 4 ? 8 : 0));
+}
+
+size_t pixelDataOffset(const Picture& image) {
+    size_t offset = TGA_HEADER_SIZE + (unsigned char)image.idLength;
+    if (image.colorMapType == 1) {
+        size_t entryBytes = ((unsigned char)image.colorMapDepth + 7) / 8;
+        offset += (unsigned short)image.colorMapLength * entryBytes;
+    }
+    return offset;
+}
+
+size_t imagePixelCount(const Picture& image) {
+    return (size_t)(unsigned short)image.width * (unsigned short)image.height;
+}
+
+// Formats
+
+bool isGrayscale(const Picture& image) {
+    return image.dataTypeCode == TGA_GRAYSCALE || image.dataTypeCode == TGA_GRAYSCALE_RLE;
+}
+
+bool isRunLength(const Picture& image) {
+    return image.dataTypeCode == TGA_TRUECOLOR_RLE || image.dataTypeCode == TGA_GRAYSCALE_RLE;
+}
+
+size_t filePixelBytes(const Picture& image) {
+    int bits = (unsigned char)image.bitsPerPixel;
+    if (isGrayscale(image)) {
+        return bits == 8 ? 1 : 0;
+    }
+    if (image.dataTypeCode == TGA_TRUECOLOR || image.dataTypeCode == TGA_TRUECOLOR_RLE) {
+        return bits == 24 || bits == 32 ? bits / 8 : 0;
+    }
+    return 0;
+}
+
+size_t storedPixelBytes(const Picture& image, bool alpha) {
+    if (isGrayscale(image)) {
+        return 1;
+    }
+    return alpha ? 4 : sizeof(Pixel);
+}
+
+void setGrayscale(Picture& image, bool gray) {
+    bool rle = isRunLength(image);
+    if (gray) {
+        image.dataTypeCode = rle ? TGA_GRAYSCALE_RLE : TGA_GRAYSCALE;
+        image.bitsPerPixel = 8;
+    }
+    else if (isGrayscale(image)) {
+        image.dataTypeCode = rle ? TGA_TRUECOLOR_RLE : TGA_TRUECOLOR;
+        image.bitsPerPixel = 24;
+    }
+}
+
+void setRunLength(Picture& image, bool rle) {
+    if (isGrayscale(image)) {
+        image.dataTypeCode = rle ? TGA_GRAYSCALE_RLE : TGA_GRAYSCALE;
+    }
+    else {
+        image.dataTypeCode = rle ? TGA_TRUECOLOR_RLE : TGA_TRUECOLOR;
+    }
+}
+
+// Four pixels at a time as whole 32-bit words: four BGRA words or gray
+// bytes against the three words holding four BGR pixels.
+
+static inline uint32_t loadWord(const unsigned char* p) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static inline void storeWord(unsigned char* p, uint32_t word) {
+    memcpy(p, &word, sizeof(word));
+}
+
+// AVX2 (and its byte shuffle) takes the bulk of the pixels and returns how
+// many it converted. A BGRA lane of four pixels becomes 12 BGR bytes and
+// the 4 alpha bytes; its 16-byte store runs 4 bytes over into the next
+// lane's, so the loop stops with room to spare.
+__attribute__((target("avx2")))
+static size_t unpackBgraAVX2(const unsigned char* in, unsigned char* out, unsigned char* alpha, size_t count) {
+    const __m256i split = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 3, 7, 11, 15,
+                                           0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i * 3 + 28 <= count * 3; i += 8) {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i * 4)), split);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 3), _mm256_castsi256_si128(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 3 + 12), _mm256_extracti128_si256(v, 1));
+        if (alpha) {
+            storeWord(alpha + i, (uint32_t)_mm256_extract_epi32(v, 3));
+            storeWord(alpha + i + 4, (uint32_t)_mm256_extract_epi32(v, 7));
+        }
+    }
+    return i;
+}
+
+// Sixteen gray bytes become three full vectors of BGR.
+__attribute__((target("avx2")))
+static size_t unpackGrayAVX2(const unsigned char* in, unsigned char* out, size_t count) {
+    const __m128i first = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i second = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i third = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i grays = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 3), _mm_shuffle_epi8(grays, first));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 3 + 16), _mm_shuffle_epi8(grays, second));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 3 + 32), _mm_shuffle_epi8(grays, third));
+    }
+    return i;
+}
+
+void unpackPixels(const unsigned char* in, size_t pixelBytes, Pixel* out, unsigned char* alpha, size_t count) {
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(out);
+    bool avx2 = activeIsa() >= ISA_AVX2;
+    size_t i = 0;
+    if (pixelBytes == 1) {
+        if (avx2) {
+            i = unpackGrayAVX2(in, bytes, count);
+        }
+        for (; i + 4 <= count; i += 4) {
+            uint32_t grays = loadWord(in + i);
+            uint32_t g0 = grays & 0xFF;
+            uint32_t g1 = (grays >> 8) & 0xFF;
+            uint32_t g2 = (grays >> 16) & 0xFF;
+            uint32_t g3 = grays >> 24;
+            storeWord(bytes + i * 3, g0 * 0x010101 | g1 << 24);
+            storeWord(bytes + i * 3 + 4, g1 * 0x0101 | g2 * 0x01010000);
+            storeWord(bytes + i * 3 + 8, g2 | g3 * 0x01010100);
+        }
+        for (; i < count; i++) {
+            out[i].blue = in[i];
+            out[i].green = in[i];
+            out[i].red = in[i];
+        }
+    }
+    else if (pixelBytes == 4) {
+        if (avx2) {
+            i = unpackBgraAVX2(in, bytes, alpha, count);
+        }
+        for (; i + 4 <= count; i += 4) {
+            uint32_t p0 = loadWord(in + i * 4);
+            uint32_t p1 = loadWord(in + i * 4 + 4);
+            uint32_t p2 = loadWord(in + i * 4 + 8);
+            uint32_t p3 = loadWord(in + i * 4 + 12);
+            storeWord(bytes + i * 3, (p0 & 0xFFFFFF) | p1 << 24);
+            storeWord(bytes + i * 3 + 4, ((p1 >> 8) & 0xFFFF) | p2 << 16);
+            storeWord(bytes + i * 3 + 8, ((p2 >> 16) & 0xFF) | p3 << 8);
+            if (alpha) {
+                storeWord(alpha + i, (p0 >> 24) | (p1 >> 24) << 8 | (p2 >> 24) << 16 | (p3 >> 24) << 24);
+            }
+        }
+        for (; i < count; i++) {
+            memcpy(out + i, in + i * 4, sizeof(Pixel));
+            if (alpha) {
+                alpha[i] = in[i * 4 + 3];
+            }
+        }
+    }
+    else {
+        memcpy(out, in, count * sizeof(Pixel));
+    }
+}
+
+void packPixels(const Pixel* in, const unsigned char* alpha, size_t pixelBytes, unsigned char* out, size_t count) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+    size_t i = 0;
+    if (pixelBytes == 1) {
+        for (; i < count; i++) {
+            out[i] = in[i].green;
+        }
+    }
+    else if (pixelBytes == 4) {
+        for (; i + 4 <= count; i += 4) {
+            uint32_t w0 = loadWord(bytes + i * 3);
+            uint32_t w1 = loadWord(bytes + i * 3 + 4);
+            uint32_t w2 = loadWord(bytes + i * 3 + 8);
+            uint32_t a = alpha ? loadWord(alpha + i) : 0xFFFFFFFF;
+            storeWord(out + i * 4, (w0 & 0xFFFFFF) | a << 24);
+            storeWord(out + i * 4 + 4, w0 >> 24 | (w1 & 0xFFFF) << 8 | (a >> 8) << 24);
+            storeWord(out + i * 4 + 8, w1 >> 16 | (w2 & 0xFF) << 16 | (a >> 16) << 24);
+            storeWord(out + i * 4 + 12, w2 >> 8 | (a >> 24) << 24);
+        }
+        for (; i < count; i++) {
+            memcpy(out + i * 4, in + i, sizeof(Pixel));
+            out[i * 4 + 3] = alpha ? alpha[i] : 255;
+        }
+    }
+    else {
+        memcpy(out, in, count * sizeof(Pixel));
+    }
+}
+
+bool readFully(int fd, void* buffer, size_t length) {
+    char* cursor = static_cast<char*>(buffer);
+    while (length > 0) {
+        ssize_t got = ::read(fd, cursor, length);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        PROFILE_COUNT(PROFILE_BYTES_READ, got);
+        cursor += got;
+        length -= got;
+    }
+    return true;
+}
+
+size_t readAvailable(int fd, void* buffer, size_t length) {
+    char* cursor = static_cast<char*>(buffer);
+    size_t got = 0;
+    while (got < length) {
+        ssize_t n = ::read(fd, cursor + got, length - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        PROFILE_COUNT(PROFILE_BYTES_READ, n);
+        got += n;
+    }
+    return got;
+}
+
+bool writeFully(int fd, const void* buffer, size_t length) {
+    const char* cursor = static_cast<const char*>(buffer);
+    while (length > 0) {
+        ssize_t put = ::write(fd, cursor, length);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return false;
+        }
+        PROFILE_COUNT(PROFILE_BYTES_WRITTEN, put);
+        cursor += put;
+        length -= put;
+    }
+    return true;
+}
+
+// Run-length encoding
+
+// Fills count copies of the pixelBytes at value: grey or single-byte values
+// are a plain memset, others are written once and then doubled with memcpy.
+static void fillPixels(unsigned char* out, const unsigned char* value, size_t pixelBytes, size_t count) {
+    bool uniform = true;
+    for (size_t b = 1; b < pixelBytes; b++) {
+        uniform = uniform && value[b] == value[0];
+    }
+    if (uniform) {
+        memset(out, value[0], count * pixelBytes);
+        return;
+    }
+    memcpy(out, value, pixelBytes);
+    size_t filled = 1;
+    while (filled < count) {
+        size_t chunk = min(filled, count - filled);
+        memcpy(out + filled * pixelBytes, out, chunk * pixelBytes);
+        filled += chunk;
+    }
+}
+
+bool decodeRle(const unsigned char* data, size_t length, size_t pixelBytes, unsigned char* out, size_t count) {
+    size_t position = 0;
+    size_t done = 0;
+    while (done < count) {
+        if (position >= length) {
+            memset(out + done * pixelBytes, 0, (count - done) * pixelBytes);
+            return false;
+        }
+        unsigned char packet = data[position++];
+        size_t run = min<size_t>((packet & 0x7F) + 1, count - done);
+        if (packet & 0x80) {
+            if (position + pixelBytes > length) {
+                position = length;
+                continue;
+            }
+            fillPixels(out + done * pixelBytes, data + position, pixelBytes, run);
+            position += pixelBytes;
+        }
+        else {
+            size_t available = (length - position) / pixelBytes;
+            size_t copied = min(run, available);
+            memcpy(out + done * pixelBytes, data + position, copied * pixelBytes);
+            position += copied * pixelBytes;
+            if (copied < run) {
+                done += copied;
+                position = length;
+                continue;
+            }
+        }
+        done += run;
+    }
+    return true;
+}
+
+// Number of identical pixels starting at p, at most limit. A run of n
+// pixels is exactly the bytes where p[j] == p[j + pixelBytes] for
+// j < pixelBytes * (n - 1), so the scan compares 16 bytes at a time against
+// the next pixel.
+static size_t runLength(const unsigned char* p, size_t pixelBytes, size_t limit) {
+    size_t bytes = (limit - 1) * pixelBytes;
+    size_t j = 0;
+#ifdef __SSE2__
+    for (; j + 16 <= bytes; j += 16) {
+        __m128i here = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + j));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + j + pixelBytes));
+        int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(here, next));
+        if (equal != 0xFFFF) {
+            j += __builtin_ctz(~equal);
+            return j / pixelBytes + 1;
+        }
+    }
+#endif
+    while (j < bytes && p[j] == p[j + pixelBytes]) {
+        j++;
+    }
+    return j / pixelBytes + 1;
+}
+
+void encodeRle(const unsigned char* in, size_t pixelBytes, size_t width, size_t height, vector<unsigned char>& out) {
+    for (size_t y = 0; y < height; y++) {
+        const unsigned char* row = in + y * width * pixelBytes;
+        size_t x = 0;
+        while (x < width) {
+            size_t limit = min<size_t>(128, width - x);
+            size_t run = runLength(row + x * pixelBytes, pixelBytes, limit);
+            if (run >= 2) {
+                out.push_back((unsigned char)(0x80 | (run - 1)));
+                const unsigned char* value = row + x * pixelBytes;
+                out.insert(out.end(), value, value + pixelBytes);
+                x += run;
+                continue;
+            }
+            // Raw packet: extend until the next pair of equal pixels.
+            size_t raw = 1;
+            while (raw < limit && !(x + raw + 1 < width &&
+                                    memcmp(row + (x + raw) * pixelBytes, row + (x + raw + 1) * pixelBytes,
+                                           pixelBytes) == 0)) {
+                raw++;
+            }
+            out.push_back((unsigned char)(raw - 1));
+            const unsigned char* values = row + x * pixelBytes;
+            out.insert(out.end(), values, values + raw * pixelBytes);
+            x += raw;
+        }
+    }
+}
+
+bool readRle(int fd, const Picture& header, size_t pixelBytes, unsigned char* out, size_t count) {
+    struct stat info;
+    off_t offset = pixelDataOffset(header);
+    if (fstat(fd, &info) != 0 || info.st_size <= offset) {
+        memset(out, 0, count * pixelBytes);
+        return false;
+    }
+    vector<unsigned char> packets(info.st_size - offset);
+    lseek(fd, offset, SEEK_SET);
+    if (!readFully(fd, packets.data(), packets.size())) {
+        memset(out, 0, count * pixelBytes);
+        return false;
+    }
+    return decodeRle(packets.data(), packets.size(), pixelBytes, out, count);
+}
+
+bool writeRle(int fd, const Picture& header, size_t pixelBytes, const unsigned char* data) {
+    size_t width = (unsigned short)header.width;
+    size_t height = (unsigned short)header.height;
+    vector<unsigned char> file(TGA_HEADER_SIZE);
+    // Worst case is one raw packet byte per 128 pixels on top of the data.
+    file.reserve(TGA_HEADER_SIZE + width * height * pixelBytes + height * (width / 128 + 1));
+    encodeHeader(header, pixelBytes, file.data());
+    encodeRle(data, pixelBytes, width, height, file);
+    return writeFully(fd, file.data(), file.size());
+}
+
+// Any format
+
+// Pixels converted per read of a raw 8 or 32-bit file, so the staging
+// buffer stays in cache.
+static const size_t UNPACK_CHUNK_PIXELS = 1 << 14;
+
+bool readStoredPixels(int fd, const Picture& header, unsigned char* out, size_t count) {
+    size_t pixelBytes = filePixelBytes(header);
+    if (isRunLength(header)) {
+        return readRle(fd, header, pixelBytes, out, count);
+    }
+    // One transfer for the whole pixel block.
+    lseek(fd, pixelDataOffset(header), SEEK_SET);
+    size_t dataBytes = count * pixelBytes;
+    size_t got = readAvailable(fd, out, dataBytes);
+    memset(out + got, 0, dataBytes - got);
+    return got == dataBytes;
+}
+
+bool readPixels(int fd, const Picture& header, Pixel* out, unsigned char* alpha, size_t count) {
+    size_t pixelBytes = filePixelBytes(header);
+    if (pixelBytes == sizeof(Pixel)) {
+        return readStoredPixels(fd, header, reinterpret_cast<unsigned char*>(out), count);
+    }
+    if (isRunLength(header)) {
+        // 8 and 32-bit packets are staged and converted.
+        vector<unsigned char> staging(count * pixelBytes);
+        bool complete = readRle(fd, header, pixelBytes, staging.data(), count);
+        unpackPixels(staging.data(), pixelBytes, out, alpha, count);
+        return complete;
+    }
+
+    // A short file leaves the remainder black (and transparent) rather
+    // than failing.
+    lseek(fd, pixelDataOffset(header), SEEK_SET);
+    vector<unsigned char> staging(min(count, UNPACK_CHUNK_PIXELS) * pixelBytes);
+    for (size_t done = 0; done < count;) {
+        size_t n = min(UNPACK_CHUNK_PIXELS, count - done);
+        size_t wanted = n * pixelBytes;
+        size_t got = readAvailable(fd, staging.data(), wanted);
+        memset(staging.data() + got, 0, wanted - got);
+        unpackPixels(staging.data(), pixelBytes, out + done, alpha ? alpha + done : 0, n);
+        done += n;
+        if (got < wanted) {
+            fill(out + done, out + count, Pixel());
+            if (alpha) {
+                memset(alpha + done, 0, count - done);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool writePixels(int fd, const Picture& header, const Pixel* pixels, const unsigned char* alpha, size_t count) {
+    size_t pixelBytes = storedPixelBytes(header, alpha != 0);
+    if (isRunLength(header)) {
+        vector<unsigned char> staging;
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(pixels);
+        if (pixelBytes != sizeof(Pixel)) {
+            staging.resize(count * pixelBytes);
+            packPixels(pixels, alpha, pixelBytes, staging.data(), count);
+            data = staging.data();
+        }
+        return writeRle(fd, header, pixelBytes, data);
+    }
+    // The whole file is assembled in one buffer and written at once.
+    vector<unsigned char> file(TGA_HEADER_SIZE + count * pixelBytes);
+    encodeHeader(header, pixelBytes, file.data());
+    packPixels(pixels, alpha, pixelBytes, file.data() + TGA_HEADER_SIZE, count);
+    return writeFully(fd, file.data(), file.size());
+}
+
+// Messages
+
+static thread_local MessageCapture* activeCapture = 0;
+
+MessageCapture::MessageCapture() {
+    previous = activeCapture;
+    activeCapture = this;
+}
+
+MessageCapture::~MessageCapture() {
+    activeCapture = previous;
+}
+
+void reportMessage(const string& message) {
+    if (activeCapture) {
+        activeCapture->text += message + "\n";
+    }
+    else {
+        cout << message << endl;
+    }
+}
+
+// MappedImage
+
+MappedImage::MappedImage() {
+    base = 0;
+    length = 0;
+    pixels = 0;
+}
+
+MappedImage::~MappedImage() {
+    close();
+}
+
+bool MappedImage::open(const string& filePath) {
+    PROFILE_SCOPE("map", filePath);
+    close();
+
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    PROFILE_COUNT(PROFILE_FILES_OPENED, 1);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < TGA_HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    decodeHeader(static_cast<const unsigned char*>(mapping), header);
+    size_t offset = pixelDataOffset(header);
+    size_t needed = offset + imagePixelCount(header) * sizeof(Pixel);
+    // Only raw true-color data can be used in place; anything else has to
+    // go through Picture::readData.
+    if (header.dataTypeCode != TGA_TRUECOLOR || header.bitsPerPixel != 24 || needed > (size_t)info.st_size) {
+        munmap(mapping, info.st_size);
+        return false;
+    }
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+    base = mapping;
+    length = info.st_size;
+    pixels = reinterpret_cast<const Pixel*>(static_cast<const char*>(mapping) + offset);
+    return true;
+}
+
+void MappedImage::close() {
+    if (base) {
+        munmap(base, length);
+    }
+    base = 0;
+    length = 0;
+    pixels = 0;
+}
+
+bool MappedImage::isOpen() const {
+    return base != 0;
+}
+
+ImageView MappedImage::view() const {
+    return ImageView(header.width, header.height, pixels, imagePixelCount(header));
+}
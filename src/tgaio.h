@@ -0,0 +1,129 @@
+#ifndef tga_io_h
+#define tga_io_h
+
+#include <string>
+#include <cstddef>
+#include <vector>
+#include "tgaimage.h"
+using namespace std;
+
+const size_t TGA_HEADER_SIZE = 18;
+
+// Header encoding. The on-disk header is 18 little-endian bytes; these move
+// it between a single buffer and the Picture fields in one step. Encoding
+// writes no image id and no color map, since no writer emits them; the
+// second encodeHeader sets the depth fields for pixelBytes per pixel instead of
+// copying them: bitsPerPixel, and the descriptor's alpha bits (8 for BGRA).
+void decodeHeader(const unsigned char* buffer, Picture& image);
+void encodeHeader(const Picture& image, unsigned char* buffer);
+void encodeHeader(const Picture& image, size_t pixelBytes, unsigned char* buffer);
+
+// Byte offset of the first pixel (header + image id + color map).
+size_t pixelDataOffset(const Picture& image);
+// Width and height are read as unsigned short, so every size up to this
+// is valid; pixel counts and offsets go through size_t.
+size_t imagePixelCount(const Picture& image);
+const size_t MAX_IMAGE_SIDE = 65535;
+
+// TGA image types handled here: true color as 24-bit BGR or 32-bit BGRA,
+// and 8-bit grayscale, each raw or run-length encoded.
+const char TGA_TRUECOLOR = 2;
+const char TGA_GRAYSCALE = 3;
+const char TGA_TRUECOLOR_RLE = 10;
+const char TGA_GRAYSCALE_RLE = 11;
+
+bool isGrayscale(const Picture& image);
+bool isRunLength(const Picture& image);
+// Bytes per pixel of a file with this header, or 0 for a format not
+// handled here.
+size_t filePixelBytes(const Picture& image);
+// Bytes per pixel image is written with: 1 for grayscale, 4 when it has
+// alpha, 3 otherwise.
+size_t storedPixelBytes(const Picture& image, bool alpha);
+// Switches the type between true color and grayscale, or between raw and
+// run-length encoded (--raw, --rle), keeping the other half.
+void setGrayscale(Picture& image, bool gray);
+void setRunLength(Picture& image, bool rle);
+
+// Conversion between file pixels of pixelBytes each and Pixel data. Gray
+// values go to all three channels and are taken from green when packing;
+// BGRA alpha goes to its own plane, which may be null (packed as opaque).
+void unpackPixels(const unsigned char* in, size_t pixelBytes, Pixel* out, unsigned char* alpha, size_t count);
+void packPixels(const Pixel* in, const unsigned char* alpha, size_t pixelBytes, unsigned char* out, size_t count);
+
+// Run-length packets (types 10 and 11): a header byte whose top bit marks
+// a run and whose low 7 bits hold count - 1, followed by one pixel for a
+// run or count pixels for a raw packet. decodeRle fills out[0, count) with
+// pixels of pixelBytes and returns false if the data ends early (the rest
+// is left black). encodeRle appends the packets for a width x height image
+// to out, never letting a packet span two rows.
+bool decodeRle(const unsigned char* data, size_t length, size_t pixelBytes, unsigned char* out, size_t count);
+void encodeRle(const unsigned char* in, size_t pixelBytes, size_t width, size_t height, vector<unsigned char>& out);
+
+// File-level RLE helpers shared by the interleaved and planar readers:
+// readRle decodes everything after the header of an open file (one read
+// of the remaining bytes), writeRle sends header and packets in one write.
+bool readRle(int fd, const Picture& header, size_t pixelBytes, unsigned char* out, size_t count);
+bool writeRle(int fd, const Picture& header, size_t pixelBytes, const unsigned char* data);
+
+// Pixel data of an open file in any format above, as the file stores it
+// (filePixelBytes per pixel). Returns false if the data ends early (the
+// rest is zeroed).
+bool readStoredPixels(int fd, const Picture& header, unsigned char* out, size_t count);
+
+// Pixel data of an open file in any format above. readPixels returns
+// false if the data ends early (the rest is left black); alpha receives
+// the alpha plane of a BGRA file and may be null. writePixels writes the
+// header and the data in the image's stored format in one write.
+bool readPixels(int fd, const Picture& header, Pixel* out, unsigned char* alpha, size_t count);
+bool writePixels(int fd, const Picture& header, const Pixel* pixels, const unsigned char* alpha, size_t count);
+
+// Whole-buffer transfers that retry on short reads/writes. readAvailable
+// stops at the end of the file and returns how much it read.
+bool readFully(int fd, void* buffer, size_t length);
+size_t readAvailable(int fd, void* buffer, size_t length);
+bool writeFully(int fd, const void* buffer, size_t length);
+
+// Messages of the image readers and writers. They go to cout unless the
+// calling thread has a MessageCapture alive, which collects them instead,
+// so a worker can print them together with its own lines.
+class MessageCapture{
+    public:
+        string text;
+
+        MessageCapture();
+        ~MessageCapture();
+
+    private:
+        MessageCapture* previous;
+
+        MessageCapture(const MessageCapture&);
+        MessageCapture& operator=(const MessageCapture&);
+};
+
+void reportMessage(const string& message);
+
+// Read-only memory mapping of an uncompressed 24-bit TGA. The pixels are
+// used straight from the page cache, so an operand layer costs no copy.
+class MappedImage{
+    public:
+        Picture header;
+
+        MappedImage();
+        ~MappedImage();
+
+        bool open(const string& filePath);
+        void close();
+        bool isOpen() const;
+        ImageView view() const;
+
+    private:
+        void* base;
+        size_t length;
+        const Pixel* pixels;
+
+        MappedImage(const MappedImage&);
+        MappedImage& operator=(const MappedImage&);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "threadpool.h"
+#include "tgaimage.h"
+#include "profile.h"
+
+using namespace std;
+
+// Target bytes of one row band: fits in L2 next to its operand bands.
+static const size_t BAND_BYTES = 256 * 1024;
+
+// Set on pool workers and on a caller while it helps with a parallelFor:
+// parallel calls made from inside a chunk then run inline.
+static thread_local bool insideParallel = false;
+
+ThreadPool::ThreadPool(unsigned threads) {
+    stopping = false;
+    // The calling thread takes part in every parallelFor, so it counts as
+    // one of the threads.
+    for (unsigned i = 1; i < threads; i++) {
+        workers.push_back(thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+unsigned ThreadPool::size() const {
+    return (unsigned)workers.size() + 1;
+}
+
+void ThreadPool::workerLoop() {
+    insideParallel = true;
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::post(const function<void()>& task) {
+    {
+        lock_guard<mutex> guard(lock);
+        tasks.push_back(task);
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t total, size_t grain, const function<void(size_t, size_t)>& body) {
+    if (total == 0) {
+        return;
+    }
+    grain = max<size_t>(grain, 1);
+    size_t chunks = (total + grain - 1) / grain;
+    size_t helpers = min<size_t>(workers.size(), chunks - 1);
+    // Nested calls run inline rather than waiting on workers that are busy
+    // with the outer loop.
+    if (helpers == 0 || insideParallel) {
+        body(0, total);
+        return;
+    }
+
+    struct Shared {
+        atomic<size_t> next;
+        size_t running;
+        mutex lock;
+        condition_variable finished;
+    };
+    shared_ptr<Shared> shared = make_shared<Shared>();
+    shared->next = 0;
+    shared->running = helpers;
+
+    function<void()> drain = [shared, total, grain, chunks, &body]() {
+        size_t chunk;
+        while ((chunk = shared->next++) < chunks) {
+            size_t begin = chunk * grain;
+            body(begin, min(total, begin + grain));
+        }
+    };
+
+    // Helpers' chunks count toward the caller's profile scopes.
+    ProfileCounters* owner = PROFILE_OWNER();
+    for (size_t i = 0; i < helpers; i++) {
+        post([shared, drain, owner]() {
+            {
+                PROFILE_HELP(owner);
+                drain();
+            }
+            lock_guard<mutex> guard(shared->lock);
+            if (--shared->running == 0) {
+                shared->finished.notify_one();
+            }
+        });
+    }
+    insideParallel = true;
+    drain();
+    insideParallel = false;
+
+    unique_lock<mutex> guard(shared->lock);
+    shared->finished.wait(guard, [&shared] { return shared->running == 0; });
+}
+
+static unsigned requestedThreads = 0;
+
+void setThreadCount(unsigned threads) {
+    requestedThreads = threads;
+}
+
+unsigned threadCount() {
+    if (requestedThreads > 0) {
+        return requestedThreads;
+    }
+    unsigned hardware = thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+ThreadPool& defaultPool() {
+    static ThreadPool pool(threadCount());
+    return pool;
+}
+
+void parallelRows(size_t count, size_t width, const function<void(size_t, size_t)>& body) {
+    size_t rowBytes = max<size_t>(width, 1) * sizeof(Pixel);
+    size_t rows = max<size_t>(BAND_BYTES / rowBytes, 1);
+    defaultPool().parallelFor(count, rows * max<size_t>(width, 1), body);
+}
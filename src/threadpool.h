@@ -0,0 +1,48 @@
+#ifndef thread_pool_h
+#define thread_pool_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Fixed set of worker threads. parallelFor splits [0, total) into chunks
+// of grain items that the workers and the calling thread pull in order;
+// chunks never overlap, so the result does not depend on the schedule.
+class ThreadPool{
+    public:
+        explicit ThreadPool(unsigned threads);
+        ~ThreadPool();
+
+        unsigned size() const;
+        void parallelFor(size_t total, size_t grain, const function<void(size_t, size_t)>& body);
+
+    private:
+        vector<thread> workers;
+        deque<function<void()> > tasks;
+        mutex lock;
+        condition_variable wake;
+        bool stopping;
+
+        void workerLoop();
+        void post(const function<void()>& task);
+
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+};
+
+// Process-wide pool used by the Picture operations and the pipeline. Its
+// size is the hardware concurrency unless setThreadCount() runs first.
+ThreadPool& defaultPool();
+void setThreadCount(unsigned threads);
+unsigned threadCount();
+
+// Runs body over [0, count) pixels of an image in row bands sized to stay
+// in cache (whole rows of the given width, at least one).
+void parallelRows(size_t count, size_t width, const function<void(size_t, size_t)>& body);
+
+#endif